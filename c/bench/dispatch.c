@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include "../src/rpn.h"
+#include "../src/stb_ds.h"
+
+// Measures the interpreter overhead per instruction on cheap arithmetic.
+// Build with -DMATH_EXPR_NO_COMPUTED_GOTO to compare against the switch dispatch, the JIT is measured where supported.
+
+#define TERMS 100
+#define REPEAT 20000
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(MathParser *parser, const MathExpr *expr, const char *dispatch)
+{
+  double result;
+  double start = now();
+  for (size_t i = 0; i < REPEAT; ++i)
+  {
+    assert(math_expr_eval(parser, expr, &result) == MERR_OK);
+  }
+  double eval = now() - start;
+
+  double instrs = (double) arrlenu(expr->code) * REPEAT;
+  printf("%-8s dispatch: %zu instructions, %6.2f ns/instruction (result %g)\n", dispatch, arrlenu(expr->code), eval / instrs * 1e9, result);
+}
+
+int main(int argc, char **argv)
+{
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  char buf[128];
+  MathExpr expr;
+  char *input = NULL;
+  for (size_t i = 0; i < TERMS; ++i)
+  {
+    int len = snprintf(buf, sizeof(buf), "%sx*y - (x + %zu)/y ", i ? "+ " : "", i);
+    memcpy(arraddnptr(input, len), buf, len);
+  }
+  assert(math_parser_compile(&parser, lexer_init("bench", sv_from_parts(input, arrlenu(input))), &expr) == MERR_OK);
+  assert(math_parser_set_var(&parser, SV("x"), 1.5));
+  assert(math_parser_set_var(&parser, SV("y"), 2.5));
+
+#ifdef MATH_EXPR_NO_COMPUTED_GOTO
+  const char *dispatch = "switch";
+#else
+  const char *dispatch = "threaded";
+#endif
+  bench(&parser, &expr, dispatch);
+  if (math_jit_compile(&expr)) bench(&parser, &expr, "jit");
+  math_expr_free(&expr);
+  arrfree(input);
+  math_parser_free(&parser);
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../src/format.h"
+
+// Compares math_format_double with printf on typical results (a few digits) and on random bit patterns (17 digits).
+
+#define COUNT (1 << 20)
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t xorshift(void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static double values[COUNT];
+static volatile size_t sink;
+
+static double bench_format(void)
+{
+  char buf[MATH_FORMAT_BUFFER_SIZE];
+  double start = now();
+  for (size_t i = 0; i < COUNT; ++i) sink += math_format_double(values[i], buf);
+  return (now() - start) / COUNT * 1e9;
+}
+
+static double bench_printf(const char *fmt)
+{
+  char buf[512];
+  double start = now();
+  for (size_t i = 0; i < COUNT; ++i) sink += snprintf(buf, sizeof(buf), fmt, values[i]);
+  return (now() - start) / COUNT * 1e9;
+}
+
+static void bench(const char *name)
+{
+  printf("%-8s shortest %7.1f ns, %%.17g %7.1f ns, %%lf %7.1f ns\n", name, bench_format(), bench_printf("%.17g"), bench_printf("%lf"));
+}
+
+int main(int argc, char **argv)
+{
+  for (size_t i = 0; i < COUNT; ++i) values[i] = (double) (xorshift() % 100000) / 100;
+  bench("short");
+  for (size_t i = 0; i < COUNT; ++i)
+  {
+    uint64_t bits = xorshift() & ~(0x7ffull << 52);
+    bits |= (uint64_t) (1023 - 30 + xorshift() % 60) << 52; // around 1, where %lf stays short
+    memcpy(&values[i], &bits, sizeof(double));
+  }
+  bench("full");
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/lexer.h"
+
+// Measures lexer throughput on generated expression files, the kind of input that is fed in by the megabyte.
+// Build with -DLEXER_NO_SIMD to compare against scanning with the character class table only.
+
+#define SIZE (4 << 20)
+#define REPEAT 10
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Statements of a generated model: indented, long names, literals of all lengths
+static size_t generate_model(char *buf, size_t size)
+{
+  size_t len = 0;
+  for (size_t i = 0; len + 256 < size; ++i)
+  {
+    len += snprintf(buf + len, size - len,
+                    "        coefficient_of_term_%04zu = previous_state_%zu * 0.%06zu + input_signal_%zu\n"
+                    "                                  - (damping_factor * velocity_%zu) / %zu.125;\n\n",
+                    i, i % 97, i * 7919 % 1000000, i % 13, i % 31, i % 1000 + 1);
+  }
+  return len;
+}
+
+// One long line of short tokens and no whitespace
+static size_t generate_compact(char *buf, size_t size)
+{
+  size_t len = 0;
+  for (size_t i = 0; len + 64 < size; ++i)
+  {
+    len += snprintf(buf + len, size - len, "x%zu*%zu+y-(z/%zu)^2;", i % 10, i % 100, i % 7 + 1);
+  }
+  return len;
+}
+
+static void bench(const char *name, const char *input, size_t len)
+{
+  double best = 1e9;
+  size_t tokens = 0;
+  for (size_t r = 0; r < REPEAT; ++r)
+  {
+    Lexer lexer = lexer_init("bench", sv_from_parts(input, len));
+    Token token;
+    LexerError err;
+    tokens = 0;
+    double start = now();
+    while ((err = lexer_next_token(&lexer, &token)) == LERR_OK) ++tokens;
+    double elapsed = now() - start;
+    assert(err == LERR_EOF);
+    if (elapsed < best) best = elapsed;
+  }
+  printf("%-8s %6.2f MB %9zu tokens %8.1f MB/s %6.1f ns/token\n", name, len / 1e6, tokens, len / best / 1e6, best / tokens * 1e9);
+}
+
+int main(int argc, char **argv)
+{
+  char *buf = malloc(SIZE);
+  assert(buf != NULL);
+#ifdef LEXER_NO_SIMD
+  printf("scanning: table\n");
+#else
+  printf("scanning: simd where supported\n");
+#endif
+  bench("model", buf, generate_model(buf, SIZE));
+  bench("compact", buf, generate_compact(buf, SIZE));
+  free(buf);
+  return 0;
+}
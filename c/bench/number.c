@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/number.h"
+
+// Compares math_number_parse_double and math_number_parse_int64 with strtod and strtoll on typical literals
+// (a few digits), full precision literals (17 digits and an exponent) and integers.
+
+#define COUNT (1 << 20)
+#define LITERAL_SIZE 32
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t xorshift(void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static char literals[COUNT][LITERAL_SIZE];
+static size_t lengths[COUNT];
+static volatile double sink;
+
+static double bench_parse(int integer)
+{
+  double start = now();
+  for (size_t i = 0; i < COUNT; ++i)
+  {
+    double value;
+    int64_t n;
+    if (integer) assert(math_number_parse_int64(literals[i], lengths[i], &n) == MATH_NUMBER_OK), value = n;
+    else assert(math_number_parse_double(literals[i], lengths[i], &value) == MATH_NUMBER_OK);
+    sink += value;
+  }
+  return (now() - start) / COUNT * 1e9;
+}
+
+static double bench_strto(int integer)
+{
+  double start = now();
+  for (size_t i = 0; i < COUNT; ++i) sink += integer ? strtoll(literals[i], NULL, 10) : strtod(literals[i], NULL);
+  return (now() - start) / COUNT * 1e9;
+}
+
+static void bench(const char *name, int integer)
+{
+  for (size_t i = 0; i < COUNT; ++i) lengths[i] = strlen(literals[i]);
+  printf("%-8s parse %7.1f ns, %s %7.1f ns\n", name, bench_parse(integer), integer ? "strtoll" : "strtod ", bench_strto(integer));
+}
+
+int main(int argc, char **argv)
+{
+  for (size_t i = 0; i < COUNT; ++i) snprintf(literals[i], LITERAL_SIZE, "%.2f", (double) (xorshift() % 100000) / 100);
+  bench("short", 0);
+  for (size_t i = 0; i < COUNT; ++i)
+  {
+    double value = (double) (xorshift() >> 11) / (1ull << 53) * 1e3;
+    snprintf(literals[i], LITERAL_SIZE, "%.16e", value * (xorshift() % 2 ? 1e-200 : 1e200));
+  }
+  bench("full", 0);
+  for (size_t i = 0; i < COUNT; ++i) snprintf(literals[i], LITERAL_SIZE, "%llu", (unsigned long long) (xorshift() >> (2 + xorshift() % 60)));
+  bench("integer", 1);
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/rpn.h"
+#include "../src/stb_ds.h"
+
+// Compares polynomials written out term by term against a single BC_POLY (`MathOptimizeOptions.polynomials`),
+// evaluated one at a time by the interpreter and the JIT, and over a batch.
+
+#define REPEAT 1000000
+#define ROWS (1 << 20)
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ns per evaluation
+static double bench_eval(MathParser *parser, const MathExpr *expr, size_t slot)
+{
+  double result, sum = 0;
+  double start = now();
+  for (size_t i = 0; i < REPEAT; ++i)
+  {
+    parser->values[slot] = 0.5 + i * 1e-6;
+    assert(math_expr_eval(parser, expr, &result) == MERR_OK);
+    sum += result;
+  }
+  double elapsed = now() - start;
+  assert(sum == sum);
+  return elapsed / REPEAT * 1e9;
+}
+
+// ns per row
+static double bench_batch(MathParser *parser, const MathExpr *expr, const MathBatchColumn *columns, double *out)
+{
+  double start = now();
+  assert(math_expr_eval_batch(parser, expr, columns, 1, ROWS, out, NULL) == MERR_OK);
+  return (now() - start) / ROWS * 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  const char *inputs[] = {
+    "3*x^4 + 2*x^3 - x + 7",
+    "1 - x^2/2 + x^4/16 - x^6/256 + x^8/4096 - x^10/65536",
+    "x^16 - 4*x^12 + 6*x^8 - 4*x^4 + x - 1",
+  };
+  double *xs = malloc(ROWS * sizeof(double));
+  double *out = malloc(ROWS * sizeof(double));
+  assert(xs != NULL && out != NULL);
+  for (size_t i = 0; i < ROWS; ++i) xs[i] = 0.5 + i * 1e-6;
+  printf("ns          terms      poly     terms      poly     terms      poly\n");
+  printf("            interpreter         jit                 batch (per row)\n");
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+  {
+    double times[2][3];
+    for (int poly = 0; poly < 2; ++poly)
+    {
+      MathParser parser = math_parser_init(EMPTY_LEXER);
+      MathExpr expr;
+      parser.optimize.polynomials = poly;
+      size_t slot = math_parser_bind_var(&parser, SV("x"));
+      assert(math_parser_set_var(&parser, SV("x"), 0.5));
+      assert(math_parser_compile(&parser, lexer_init("bench", sv_from_cstr(inputs[i])), &expr) == MERR_OK);
+      times[poly][0] = bench_eval(&parser, &expr, slot);
+      times[poly][1] = math_jit_compile(&expr) ? bench_eval(&parser, &expr, slot) : 0;
+      MathBatchColumn columns[] = { { .slot = slot, .values = xs } };
+      times[poly][2] = bench_batch(&parser, &expr, columns, out);
+      math_expr_free(&expr);
+      math_parser_free(&parser);
+    }
+    printf("degree %2d %8.2f  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f\n", i == 0 ? 4 : i == 1 ? 10 : 16,
+           times[0][0], times[1][0], times[0][1], times[1][1], times[0][2], times[1][2]);
+  }
+  free(xs);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include "../src/kernels.h"
+#include "../src/vmath.h"
+#include "../src/rpn.h"
+#include "../src/stb_ds.h"
+
+// Compares the batch kernels of each level per opcode, on one block (in cache) and on wide columns (memory bound),
+// the libm builtins against their vectorized versions, then a whole batch evaluation with the best kernels.
+
+#define WIDE (1 << 22)
+#define ROWS (1 << 22)
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench_binary(MathKernelBinary kernel, double *left, const double *right, size_t n)
+{
+  size_t repeat = (1 << 26) / n;
+  double start = now();
+  for (size_t i = 0; i < repeat; ++i)
+  {
+    kernel(left, right, n);
+  }
+  return (now() - start) / ((double) repeat * n) * 1e9;
+}
+
+static double bench_unary(MathKernelUnary kernel, double *a, size_t n)
+{
+  size_t repeat = (1 << 26) / n;
+  double start = now();
+  for (size_t i = 0; i < repeat; ++i)
+  {
+    kernel(a, n);
+  }
+  return (now() - start) / ((double) repeat * n) * 1e9;
+}
+
+// Both run over a block in place, the inputs stay in [1, 2) for all functions
+static double bench_builtin(double (*exact)(double), void (*fast)(double *, size_t), double *a, size_t n)
+{
+  size_t repeat = (1 << 22) / n;
+  double start = now();
+  for (size_t i = 0; i < repeat; ++i)
+  {
+    for (size_t j = 0; j < n; ++j) a[j] = 1.0 + j * (1.0 / n);
+    if (fast) fast(a, n);
+    else for (size_t j = 0; j < n; ++j) a[j] = exact(a[j]);
+  }
+  return (now() - start) / ((double) repeat * n) * 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  double *left = malloc(WIDE * sizeof(double));
+  double *right = malloc(WIDE * sizeof(double));
+  assert(left != NULL && right != NULL);
+  for (size_t i = 0; i < WIDE; ++i)
+  {
+    // keep the values away from overflow and denormals over all repetitions
+    left[i] = 1.0 + i % 17;
+    right[i] = 1.0;
+  }
+  size_t sizes[] = { MATH_EXPR_BATCH_BLOCK, WIDE };
+  printf("ns/value      rows      neg      add      sub      mul      div\n");
+  for (int level = 0; level < MATH_KERNELS_COUNT; ++level)
+  {
+    const MathKernels *kernels = math_kernels_get(level);
+    if (kernels == NULL)
+    {
+      printf("%-8s  not supported\n", level == MATH_KERNELS_AVX2 ? "avx2" : "avx512");
+      continue;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+      size_t n = sizes[i];
+      printf("%-8s %8zu %8.3f %8.3f %8.3f %8.3f %8.3f\n", kernels->name, n,
+             bench_unary(kernels->neg, left, n),
+             bench_binary(kernels->add, left, right, n),
+             bench_binary(kernels->sub, left, right, n),
+             bench_binary(kernels->mul, left, right, n),
+             bench_binary(kernels->div, left, right, n));
+    }
+  }
+
+  struct {
+    const char *name;
+    double (*exact)(double);
+    void (*fast)(double *, size_t);
+  } builtins[] = {
+    { "sin", sin, math_vsin }, { "cos", cos, math_vcos }, { "tan", tan, math_vtan },
+    { "asin", asin, math_vasin }, { "acos", acos, math_vacos }, { "atan", atan, math_vatan },
+    { "sqrt", sqrt, math_vsqrt }, { "log", log, math_vlog }, { "log2", log2, math_vlog2 }, { "log10", log10, math_vlog10 },
+  };
+  printf("\nns/value   libm     fast\n");
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+  {
+    printf("%-6s %8.3f %8.3f\n", builtins[i].name,
+           bench_builtin(builtins[i].exact, NULL, left, MATH_EXPR_BATCH_BLOCK),
+           bench_builtin(NULL, builtins[i].fast, left, MATH_EXPR_BATCH_BLOCK));
+  }
+  for (size_t i = 0; i < WIDE; ++i) left[i] = 1.0 + i % 17;
+
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  assert(math_parser_compile(&parser, lexer_init("bench", sv_from_cstr("-x * y + x / y - 2 * (x - y)")), &expr) == MERR_OK);
+  MathBatchColumn columns[] = {
+    { .slot = math_parser_bind_var(&parser, SV("x")), .values = left },
+    { .slot = math_parser_bind_var(&parser, SV("y")), .values = right },
+  };
+  double *out = malloc(ROWS * sizeof(double));
+  assert(out != NULL);
+  double start = now();
+  assert(math_expr_eval_batch(&parser, &expr, columns, 2, ROWS, out, NULL) == MERR_OK);
+  double batch = now() - start;
+  printf("batch (%s): %zu instructions, %.3f ns/row\n", math_kernels_best()->name, arrlenu(expr.code), batch / ROWS * 1e9);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+  free(out);
+  free(left);
+  free(right);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include "../src/rpn.h"
+#include "../src/stb_ds.h"
+
+// Measures symbol lookups while the number of defined variables and functions grows.
+// Lookups should cost the same regardless of how many symbols are defined.
+
+#define REFERENCES 200
+#define REPEAT 200
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(size_t count)
+{
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  char buf[128];
+  MathExpr expr;
+  double result;
+  for (size_t i = 0; i < count; ++i)
+  {
+    int len = snprintf(buf, sizeof(buf), "var%zu = %zu; fn%zu(x) = x + %zu", i, i, i, i);
+    MathParserError err = math_parser_evaluate_input(&parser, lexer_init("bench", sv_from_parts(buf, len)), &result);
+    assert(err == MERR_OK);
+  }
+
+  // reference symbols spread over the whole table, mixed case to exercise folding
+  char *input = NULL;
+  for (size_t i = 0; i < REFERENCES; ++i)
+  {
+    size_t j = (i * 7919) % count;
+    int len = snprintf(buf, sizeof(buf), "%sVar%zu + FN%zu(pi) ", i ? "+ " : "", j, (j * 31) % count);
+    memcpy(arraddnptr(input, len), buf, len);
+  }
+  Lexer lex = lexer_init("bench", sv_from_parts(input, arrlenu(input)));
+
+  double start = now();
+  for (size_t i = 0; i < REPEAT; ++i)
+  {
+    assert(math_parser_compile(&parser, lex, &expr) == MERR_OK);
+    math_expr_free(&expr);
+  }
+  double compile = now() - start;
+
+  assert(math_parser_compile(&parser, lex, &expr) == MERR_OK);
+  start = now();
+  for (size_t i = 0; i < REPEAT; ++i)
+  {
+    assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  }
+  double eval = now() - start;
+  math_expr_free(&expr);
+
+  double refs = 2. * REFERENCES * REPEAT;
+  printf("%8zu symbols: compile %8.1f ns/reference, eval %8.1f ns/reference\n", count, compile / refs * 1e9, eval / refs * 1e9);
+  arrfree(input);
+  math_parser_free(&parser);
+}
+
+int main(int argc, char **argv)
+{
+  for (size_t count = 10; count <= 100000; count *= 10)
+  {
+    bench(count);
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/pool.h"
+#include "../src/rpn.h"
+#include "../src/stb_ds.h"
+
+// Measures how a large batch scales with the number of threads of the pool, from 1 up to the number of CPUs
+// (or the first argument).
+// Once a few threads saturate memory bandwidth, only formulas doing more work per row keep scaling.
+
+#define ROWS (1 << 24)
+#define REPEAT 3
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench(MathParser *parser, const MathExpr *expr, const MathBatchColumn *columns, double *out, size_t threads)
+{
+  MathThreadPool *pool = math_thread_pool_create(threads);
+  assert(pool != NULL);
+  MathBatchOptions options = { .pool = pool };
+  double best = 1e9;
+  for (size_t i = 0; i < REPEAT; ++i)
+  {
+    double start = now();
+    assert(math_expr_eval_batch(parser, expr, columns, 2, ROWS, out, &options) == MERR_OK);
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+  math_thread_pool_free(pool);
+  return best;
+}
+
+int main(int argc, char **argv)
+{
+  const char *formulas[] = {
+    "-x * y + x / y - 2 * (x - y)",
+    "sin(x) * cos(y) + sqrt(x * x + y * y) - atan(x / y)",
+  };
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_threads = cpus > 0 ? cpus : 1;
+  if (argc > 1) max_threads = strtoul(argv[1], NULL, 10); // e.g. to oversubscribe
+  assert(max_threads > 0);
+  double *xs = malloc(ROWS * sizeof(double)), *ys = malloc(ROWS * sizeof(double)), *out = malloc(ROWS * sizeof(double));
+  assert(xs != NULL && ys != NULL && out != NULL);
+  for (size_t i = 0; i < ROWS; ++i)
+  {
+    xs[i] = 1.0 + i % 17;
+    ys[i] = 0.5 + i % 13;
+  }
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathBatchColumn columns[] = {
+    { .slot = math_parser_bind_var(&parser, SV("x")), .values = xs },
+    { .slot = math_parser_bind_var(&parser, SV("y")), .values = ys },
+  };
+  for (size_t f = 0; f < sizeof(formulas) / sizeof(formulas[0]); ++f)
+  {
+    MathExpr expr;
+    assert(math_parser_compile(&parser, lexer_init("bench", sv_from_cstr(formulas[f])), &expr) == MERR_OK);
+    printf("%s (%d rows)\n", formulas[f], ROWS);
+    double single = 0;
+    for (size_t threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+    {
+      double elapsed = bench(&parser, &expr, columns, out, threads);
+      if (threads == 1) single = elapsed;
+      printf("%4zu threads: %8.3f ns/row, speedup %5.2f\n", threads, elapsed / ROWS * 1e9, single / elapsed);
+      if (threads == max_threads) break;
+    }
+    math_expr_free(&expr);
+  }
+  math_parser_free(&parser);
+  free(out);
+  free(ys);
+  free(xs);
+  return 0;
+}
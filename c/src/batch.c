@@ -0,0 +1,493 @@
+#include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "kernels.h"
+#include "pool.h"
+#include "rpn.h"
+#include "stb_ds.h"
+
+// Batches run one instruction over a block of rows at a time. Each stack slot holds a vector of
+// MATH_EXPR_BATCH_BLOCK values, slot `i` starts at `stack + i * MATH_EXPR_BATCH_BLOCK`.
+#define VEC(i) (stack + (i) * MATH_EXPR_BATCH_BLOCK)
+// Rows a worker of a threaded batch takes at once, sized so its columns and results stay in L2
+#define MATH_EXPR_BATCH_CHUNK_BYTES (256 * 1024)
+// Rows a polynomial is evaluated for at once, all its intermediate values stay in L1
+#define MATH_EXPR_BATCH_POLY_ROWS 32
+
+// Shared by all workers of a batch, everything but `next` and `err` is read-only.
+// The parser is only written to report errors, which the first block finds on the calling thread.
+typedef struct {
+  MathThreadPool *pool;
+  MathParser *parser;
+  const MathExpr *expr;
+  const MathKernels *kernels;
+  MathAccuracy accuracy;
+  const MathBatchColumn *columns;
+  size_t ncolumns;
+  size_t rows;
+  double *out;
+  int64_t *integers; // exact results, if requested
+  bool integer;      // the statement runs on integers, see `MathStatement.integer`
+  size_t capacity; // stack vectors per worker
+  size_t chunk;    // rows per chunk, a multiple of the block size
+  size_t start;    // first row handed to the workers
+  atomic_size_t next; // index of the next chunk to take
+  _Atomic MathParserError err;
+  atomic_bool promoted; // some block overflowed and ran on doubles
+} MathBatchJob;
+
+// Private functions
+
+static const MathBatchColumn *math_batch_find_column(const MathBatchColumn *columns, size_t ncolumns, size_t slot)
+{
+  for (size_t i = 0; i < ncolumns; ++i)
+  {
+    if (columns[i].slot == slot) return &columns[i];
+  }
+  return NULL;
+}
+
+// Whether the last statement of `expr` can run on integers, i.e. all variables it reads hold integers
+static bool math_batch_reads_integers(const MathParser *parser, const MathExpr *expr, const MathBatchColumn *columns, size_t ncolumns)
+{
+  size_t count = arrlenu(expr->statements);
+  if (!expr->statements[count - 1].integer) return false;
+  for (size_t i = count > 1 ? expr->statements[count - 2].reads_end : 0; i < expr->statements[count - 1].reads_end; ++i)
+  {
+    const MathBatchColumn *column = math_batch_find_column(columns, ncolumns, expr->reads[i]);
+    if (column ? column->integers == NULL : !parser->variables[expr->reads[i]].integer) return false;
+  }
+  return true;
+}
+
+// Checks that all global variables read by `expr` are defined or have a column
+static MathParserError math_batch_check_reads(MathParser *parser, const MathExpr *expr, const MathBatchColumn *columns, size_t ncolumns)
+{
+  size_t size = arrlenu(expr->reads);
+  for (size_t i = 0; i < size; ++i)
+  {
+    uint32_t slot = expr->reads[i];
+    if (parser->variables[slot].defined || math_batch_find_column(columns, ncolumns, slot)) continue;
+    // find where it is read for the error message, or report it at the statement reading it
+    size_t statement = 0;
+    while (expr->statements[statement].reads_end <= i) ++statement;
+    size_t start = statement == 0 ? 0 : expr->statements[statement - 1].end, pc = start;
+    while (pc < expr->statements[statement].end && (expr->code[pc].op != BC_LOAD || expr->code[pc].arg != slot)) ++pc;
+    if (pc == expr->statements[statement].end) pc = start;
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_UNRECOGNIZED_VARIABLE, .loc = expr->debug[pc].loc, .text = parser->variables[slot].name });
+    return MERR_UNRECOGNIZED_SYMBOL;
+  }
+  return MERR_OK;
+}
+
+static void math_batch_fill(double *dst, size_t n, double value)
+{
+  for (size_t i = 0; i < n; ++i) dst[i] = value;
+}
+
+// `math_poly` of each of the `n` values of `x`, a step of Estrin's scheme at a time over a few rows
+static void math_batch_poly(const double *coefs, size_t degree, double *x, size_t n)
+{
+  for (size_t from = 0; from < n; from += MATH_EXPR_BATCH_POLY_ROWS)
+  {
+    size_t rows = n - from < MATH_EXPR_BATCH_POLY_ROWS ? n - from : MATH_EXPR_BATCH_POLY_ROWS;
+    double b[MATH_EXPR_POLY_LIMIT / 2 + 1][MATH_EXPR_BATCH_POLY_ROWS];
+    bool zero[MATH_EXPR_POLY_LIMIT / 2 + 1]; // parts with all coefficients 0 are skipped
+    double *p = x + from;
+    size_t count = 0;
+    if (degree == 0)
+    {
+      math_batch_fill(p, rows, coefs[0]);
+      continue;
+    }
+    for (size_t k = 0; k < degree; k += 2, ++count)
+    {
+      zero[count] = coefs[k] == 0 && coefs[k + 1] == 0;
+      if (coefs[k + 1] == 0) math_batch_fill(b[count], rows, coefs[k]);
+      else for (size_t i = 0; i < rows; ++i) b[count][i] = coefs[k] + coefs[k + 1] * p[i];
+    }
+    if (degree % 2 == 0)
+    {
+      zero[count] = coefs[degree] == 0;
+      math_batch_fill(b[count++], rows, coefs[degree]);
+    }
+    while (count > 1)
+    {
+      size_t m = 0;
+      for (size_t i = 0; i < rows; ++i) p[i] *= p[i];
+      for (size_t k = 0; k + 1 < count; k += 2, ++m)
+      {
+        if (zero[k + 1]) memcpy(b[m], b[k], rows * sizeof(double));
+        else for (size_t i = 0; i < rows; ++i) b[m][i] = b[k][i] + b[k + 1][i] * p[i];
+        zero[m] = zero[k] && zero[k + 1];
+      }
+      if (count % 2 == 1)
+      {
+        zero[m] = zero[count - 1];
+        memcpy(b[m++], b[count - 1], rows * sizeof(double));
+      }
+      count = m;
+    }
+    memcpy(p, b[0], rows * sizeof(double));
+  }
+}
+
+// Return address of a user function call, the state of the caller to resume when the callee returns
+typedef struct {
+  const MathExpr *expr;
+  size_t pc;        // the call instruction
+  size_t statement;
+  size_t args;      // first argument vector of the caller, if it is a user function
+  size_t temps;     // first temporary vector of the caller
+} MathBatchFrame;
+
+// Runs the last statement of `expr` on `n` rows starting at `row`, the result is left in the vector of slot `expr->ntemps`.
+// The temporaries of shared subexpressions are in the vectors below it, if there are any, all statements run since
+// the last one may read what earlier ones saved.
+// User functions run on the same stack without recursion, like in `math_expr_run`: a call pushes a frame, the body
+// runs right above the arguments the caller left on top of the stack, and returning replaces them by the result.
+static MathParserError math_batch_run(MathParser *parser, const MathExpr *expr, const MathKernels *kernels, MathAccuracy accuracy, const MathBatchColumn *columns, size_t ncolumns, size_t row, size_t n, double *stack, size_t capacity)
+{
+  MathBatchFrame frames[MATH_EXPR_MAX_CALL_DEPTH];
+  size_t depth = 0;
+  size_t args = 0;  // arguments of the running user function are in the vectors from slot `args`
+  size_t temps = 0; // its temporaries from slot `temps`
+  size_t base, sp, statement, pc;
+  assert(expr->max_stack <= capacity);
+enter: // runs the last statement of `expr`, and the earlier ones too if they save temporaries
+  assert(arrlenu(expr->statements) > 0);
+  statement = expr->ntemps > 0 ? 0 : arrlenu(expr->statements) - 1;
+  base = temps + expr->ntemps;
+  sp = base;
+  for (pc = statement > 0 ? expr->statements[statement - 1].end : 0; pc < arrlast(expr->statements).end; ++pc)
+  {
+    const MathInstr instr = expr->code[pc];
+    if (pc == expr->statements[statement].end)
+    {
+      ++statement;
+      sp = base;
+    }
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST:
+        math_batch_fill(VEC(sp++), n, expr->consts[instr.arg]);
+        break;
+      case BC_LOAD: {
+        const MathBatchColumn *column = math_batch_find_column(columns, ncolumns, instr.arg);
+        double *dst = VEC(sp++);
+        if (column && column->values) memcpy(dst, column->values + row, n * sizeof(double));
+        else if (column) for (size_t i = 0; i < n; ++i) dst[i] = (double) column->integers[row + i];
+        else math_batch_fill(dst, n, parser->values[instr.arg]);
+      } break;
+      case BC_ARG:
+        memcpy(VEC(sp++), VEC(args + instr.arg), n * sizeof(double));
+        break;
+      case BC_SAVE:
+        memcpy(VEC(temps + instr.arg), VEC(sp - 1), n * sizeof(double));
+        break;
+      case BC_TEMP:
+        memcpy(VEC(sp++), VEC(temps + instr.arg), n * sizeof(double));
+        break;
+      case BC_NEG:
+        kernels->neg(VEC(sp - 1), n);
+        break;
+#define KERNEL(_op, _kernel)                           \
+      case _op:                                        \
+        kernels->_kernel(VEC(sp - 2), VEC(sp - 1), n); \
+        --sp;                                          \
+        break;
+      KERNEL(BC_ADD, add)
+      KERNEL(BC_SUB, sub)
+      KERNEL(BC_MUL, mul)
+      KERNEL(BC_DIV, div)
+#undef KERNEL
+#define BINARY(_op, _expr)                    \
+      case _op: {                             \
+        double *left = VEC(sp - 2);           \
+        const double *right = VEC(sp - 1);    \
+        for (size_t i = 0; i < n; ++i)        \
+        {                                     \
+          left[i] = (_expr);                  \
+        }                                     \
+        --sp;                                 \
+      } break;
+      BINARY(BC_POW, pow(left[i], right[i]))
+#undef BINARY
+      case BC_POWI: {
+        double *a = VEC(sp - 1);
+        for (size_t i = 0; i < n; ++i) a[i] = math_powi(a[i], (int32_t) instr.arg);
+      } break;
+      case BC_FMA: {
+        double *a = VEC(sp - 3);
+        const double *b = VEC(sp - 2);
+        const double *c = VEC(sp - 1);
+        if (instr.arg == 1) for (size_t i = 0; i < n; ++i) a[i] = fma(b[i], c[i], a[i]);
+        else for (size_t i = 0; i < n; ++i) a[i] = fma(a[i], b[i], c[i]);
+        sp -= 2;
+      } break;
+      case BC_POLY:
+        math_batch_poly(expr->consts + instr.arg, instr.nargs, VEC(sp - 1), n);
+        break;
+      case BC_CALL1: {
+        const MathBuiltinFunction *builtin = &expr->builtins[instr.arg];
+        double *a = VEC(sp - 1);
+        if (accuracy == MATH_ACCURACY_FAST && builtin->fast.unary)
+        {
+          builtin->fast.unary(a, n);
+          break;
+        }
+        for (size_t i = 0; i < n; ++i) a[i] = builtin->as.unary(a[i]);
+      } break;
+      case BC_CALL2: {
+        const MathBuiltinFunction *builtin = &expr->builtins[instr.arg];
+        double *left = VEC(sp - 2);
+        const double *right = VEC(sp - 1);
+        --sp;
+        if (accuracy == MATH_ACCURACY_FAST && builtin->fast.binary)
+        {
+          builtin->fast.binary(left, right, n);
+          break;
+        }
+        for (size_t i = 0; i < n; ++i) left[i] = builtin->as.binary(left[i], right[i]);
+      } break;
+      case BC_CALL:
+      case BC_CALLU: {
+        ssize_t index = instr.op == BC_CALLU ? (ssize_t) instr.arg : math_parser_find_function(parser, expr->symbols[instr.arg], instr.nargs);
+        if (index < 0)
+        {
+          math_parser_report(parser, (Diagnostic) { .code = DIAG_UNRECOGNIZED_FUNCTION, .loc = expr->debug[pc].loc, .text = expr->debug[pc].text, .value.count = instr.nargs });
+          return MERR_UNRECOGNIZED_SYMBOL;
+        }
+        const MathUserFunction *callee = &parser->functions[index];
+        sp -= instr.nargs;
+        if (depth >= MATH_EXPR_MAX_CALL_DEPTH || sp + callee->nargs + callee->body.max_stack > capacity)
+        {
+          const Diagnostic diags[] = {
+            { .code = DIAG_STACK_OVERFLOW, .loc = expr->debug[pc].loc, .text = callee->name },
+            { .code = DIAG_NOTE_CALL_DEPTH, .value.count = MATH_EXPR_MAX_CALL_DEPTH },
+          };
+          math_parser_report_all(parser, diags, depth >= MATH_EXPR_MAX_CALL_DEPTH ? 2 : 1);
+          return MERR_STACK_OVERFLOW;
+        }
+        MathParserError err = math_batch_check_reads(parser, &callee->body, columns, ncolumns);
+        if (err != MERR_OK) return err;
+        frames[depth++] = (MathBatchFrame) {
+          .expr = expr,
+          .pc = pc,
+          .statement = statement,
+          .args = args,
+          .temps = temps,
+        };
+        expr = &callee->body;
+        args = sp;
+        temps = sp + callee->nargs;
+        goto enter;
+      }
+      case BC_STORE:
+      case BC_COUNT:
+        assert(0 && "unreachable");
+    }
+resume:;
+  }
+  assert(sp == base + 1 && "lowering leaves exactly one value per statement");
+  if (depth == 0) return MERR_OK;
+  // return from the user function, its value replaces the arguments on the caller's stack
+  if (base > args) memcpy(VEC(args), VEC(base), n * sizeof(double));
+  sp = args + 1;
+  --depth;
+  expr = frames[depth].expr;
+  pc = frames[depth].pc;
+  statement = frames[depth].statement;
+  args = frames[depth].args;
+  temps = frames[depth].temps;
+  base = temps + expr->ntemps;
+  goto resume;
+}
+
+// Runs the last statement of `expr` on int64_t for `n` rows starting at `row`, the result is left in the vector
+// right above the temporaries.
+// Returns false if any operation overflowed, the block must then run on doubles.
+static bool math_batch_run_integer(const MathBatchJob *job, size_t row, size_t n, int64_t *stack)
+{
+  const MathExpr *expr = job->expr;
+  size_t count = arrlenu(expr->statements);
+  size_t sp = expr->ntemps;
+  bool overflowed = false;
+  for (size_t pc = count > 1 ? expr->statements[count - 2].end : 0; pc < expr->statements[count - 1].end; ++pc)
+  {
+    const MathInstr instr = expr->code[pc];
+    int64_t *dst = VEC(sp);
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST:
+        for (size_t i = 0; i < n; ++i) dst[i] = expr->integers[instr.arg];
+        ++sp;
+        break;
+      case BC_LOAD: {
+        const MathBatchColumn *column = math_batch_find_column(job->columns, job->ncolumns, instr.arg);
+        if (column) memcpy(dst, column->integers + row, n * sizeof(int64_t));
+        else for (size_t i = 0; i < n; ++i) dst[i] = job->parser->integers[instr.arg];
+        ++sp;
+      } break;
+      case BC_SAVE:
+        memcpy(VEC(instr.arg), VEC(sp - 1), n * sizeof(int64_t));
+        break;
+      case BC_TEMP:
+        memcpy(VEC(sp++), VEC(instr.arg), n * sizeof(int64_t));
+        break;
+      case BC_NEG: {
+        int64_t *a = VEC(sp - 1);
+        for (size_t i = 0; i < n; ++i) overflowed |= __builtin_sub_overflow((int64_t) 0, a[i], &a[i]);
+      } break;
+#define BINARY(_op, _builtin)                                  \
+      case _op: {                                              \
+        int64_t *left = VEC(sp - 2);                           \
+        const int64_t *right = VEC(sp - 1);                    \
+        for (size_t i = 0; i < n; ++i)                         \
+        {                                                      \
+          overflowed |= _builtin(left[i], right[i], &left[i]); \
+        }                                                      \
+        --sp;                                                  \
+      } break;
+      BINARY(BC_ADD, __builtin_add_overflow)
+      BINARY(BC_SUB, __builtin_sub_overflow)
+      BINARY(BC_MUL, __builtin_mul_overflow)
+#undef BINARY
+      case BC_POWI: {
+        int64_t *a = VEC(sp - 1);
+        for (size_t i = 0; i < n; ++i) overflowed |= math_powi_overflow(a[i], (int32_t) instr.arg, &a[i]);
+      } break;
+      case BC_FMA: {
+        int64_t *a = VEC(sp - 3);
+        const int64_t *b = VEC(sp - 2);
+        const int64_t *c = VEC(sp - 1);
+        for (size_t i = 0; i < n; ++i)
+        {
+          int64_t product;
+          if (instr.arg == 1) overflowed |= __builtin_mul_overflow(b[i], c[i], &product) | __builtin_add_overflow(product, a[i], &a[i]);
+          else overflowed |= __builtin_mul_overflow(a[i], b[i], &product) | __builtin_add_overflow(product, c[i], &a[i]);
+        }
+        sp -= 2;
+      } break;
+      case BC_POLY: {
+        int64_t *a = VEC(sp - 1);
+        for (size_t i = 0; i < n; ++i) overflowed |= math_poly_overflow(expr->integers + instr.arg, instr.nargs, a[i], &a[i]);
+      } break;
+      default:
+        assert(0 && "not an integer statement");
+    }
+  }
+  assert(sp == expr->ntemps + 1 && "lowering leaves exactly one value per statement");
+  return !overflowed;
+}
+
+// Runs rows [from, to) in blocks and writes their results to `out`.
+// Integer statements run on int64_t, blocks where an operation overflows run again on doubles.
+static MathParserError math_batch_range(MathBatchJob *job, double *stack, size_t from, size_t to)
+{
+  for (size_t row = from; row < to; row += MATH_EXPR_BATCH_BLOCK)
+  {
+    size_t n = to - row < MATH_EXPR_BATCH_BLOCK ? to - row : MATH_EXPR_BATCH_BLOCK;
+    if (job->integer)
+    {
+      // NOTE: the stack is malloc'd, so it may hold int64_t as well
+      const int64_t *integers = (const int64_t *) VEC(job->expr->ntemps);
+      if (math_batch_run_integer(job, row, n, (int64_t *) stack))
+      {
+        if (job->integers) memcpy(job->integers + row, integers, n * sizeof(int64_t));
+        for (size_t i = 0; i < n; ++i) job->out[row + i] = (double) integers[i];
+        continue;
+      }
+      atomic_store_explicit(&job->promoted, true, memory_order_relaxed);
+    }
+    MathParserError err = math_batch_run(job->parser, job->expr, job->kernels, job->accuracy, job->columns, job->ncolumns, row, n, stack, job->capacity);
+    if (err != MERR_OK) return err;
+    memcpy(job->out + row, VEC(job->expr->ntemps), n * sizeof(double));
+  }
+  return MERR_OK;
+}
+
+// Worker of a threaded batch, takes chunks until all rows are done. Each worker has its own stack, kept by the pool,
+// and every chunk writes only its own rows of `out`, so the results do not depend on the scheduling.
+static void math_batch_worker(void *ctx, size_t worker)
+{
+  MathBatchJob *job = ctx;
+  double *stack = math_thread_pool_scratch(job->pool, worker, job->capacity * MATH_EXPR_BATCH_BLOCK * sizeof(double));
+  assert(stack != NULL);
+  for (;;)
+  {
+    size_t from = job->start + atomic_fetch_add(&job->next, 1) * job->chunk;
+    if (from >= job->rows || atomic_load(&job->err) != MERR_OK) break;
+    size_t to = job->rows - from < job->chunk ? job->rows : from + job->chunk;
+    MathParserError err = math_batch_range(job, stack, from, to);
+    if (err != MERR_OK)
+    {
+      MathParserError expected = MERR_OK;
+      atomic_compare_exchange_strong(&job->err, &expected, err);
+      break;
+    }
+  }
+}
+
+// Implementation
+
+MathParserError math_expr_eval_batch(MathParser *parser, const MathExpr *expr, const MathBatchColumn *columns, size_t ncolumns, size_t rows, double *out, const MathBatchOptions *options)
+{
+  assert(parser != NULL);
+  assert(expr != NULL);
+  assert(columns != NULL || ncolumns == 0);
+  assert(out != NULL || rows == 0);
+  MathParserError err = MERR_OK;
+  double *stack = NULL;
+  size_t size = arrlenu(expr->code);
+  if (options && options->exact) *options->exact = false;
+  if (arrlenu(expr->statements) == 0) return MERR_INPUT_EMPTY;
+  for (size_t pc = 0; pc < size; ++pc)
+  {
+    if (expr->code[pc].op != BC_STORE) continue;
+    const Diagnostic diags[] = {
+      { .code = DIAG_BATCH_ASSIGNMENT, .loc = expr->debug[pc].loc, .text = expr->debug[pc].text },
+      { .code = DIAG_NOTE_BATCH_READ_ONLY },
+    };
+    math_parser_report_all(parser, diags, sizeof(diags) / sizeof(diags[0]));
+    return MERR_UNEXPECTED_OPERATOR;
+  }
+  MATH_PARSER_TRY(math_batch_check_reads(parser, expr, columns, ncolumns));
+  MathBatchJob job = {
+    .parser = parser,
+    .expr = expr,
+    .kernels = math_kernels_best(),
+    .accuracy = options ? options->accuracy : MATH_ACCURACY_EXACT,
+    .columns = columns,
+    .ncolumns = ncolumns,
+    .rows = rows,
+    .out = out,
+    .integers = options ? options->integers : NULL,
+    .integer = math_batch_reads_integers(parser, expr, columns, ncolumns),
+    // leave the usual room for user functions
+    .capacity = expr->max_stack + MATH_EXPR_BATCH_STACK_SIZE,
+  };
+  atomic_init(&job.promoted, false);
+  stack = malloc(job.capacity * MATH_EXPR_BATCH_BLOCK * sizeof(double));
+  assert(stack != NULL);
+  MathThreadPool *pool = options ? options->pool : NULL;
+  if (pool == NULL || math_thread_pool_size(pool) == 1 || rows <= MATH_EXPR_BATCH_BLOCK)
+  {
+    MATH_PARSER_TRY(math_batch_range(&job, stack, 0, rows));
+    if (options && options->exact) *options->exact = job.integer && !atomic_load(&job.promoted);
+    RETURN(MERR_OK);
+  }
+  // errors do not depend on the row, the first block finds them before any worker could report them again
+  MATH_PARSER_TRY(math_batch_range(&job, stack, 0, MATH_EXPR_BATCH_BLOCK));
+  size_t chunk = MATH_EXPR_BATCH_CHUNK_BYTES / ((ncolumns + 1) * sizeof(double));
+  job.chunk = chunk > MATH_EXPR_BATCH_BLOCK ? chunk - chunk % MATH_EXPR_BATCH_BLOCK : MATH_EXPR_BATCH_BLOCK;
+  job.start = MATH_EXPR_BATCH_BLOCK;
+  job.pool = pool;
+  atomic_init(&job.next, 0);
+  atomic_init(&job.err, MERR_OK);
+  math_thread_pool_run(pool, math_batch_worker, &job);
+  err = atomic_load(&job.err);
+  if (err == MERR_OK && options && options->exact) *options->exact = job.integer && !atomic_load(&job.promoted);
+return_defer:
+  free(stack);
+  return err;
+}
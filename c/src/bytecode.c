@@ -0,0 +1,1163 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include "bytecode.h"
+#include "format.h"
+#include "rpn.h"
+#include "stb_ds.h"
+
+// Slots already in `reads` for the statement being lowered, stb_ds hash set
+typedef struct {
+  uint32_t key;
+  bool value;
+} MathSlotSet;
+
+// Node of the DAG built by `math_expr_share`
+typedef struct {
+  uint32_t uses; // by other nodes, and as the value of a statement
+  int32_t temp;  // temporary holding its value if shared, else -1
+  bool saved;    // already computed by an earlier instruction
+} MathNode;
+
+typedef struct {
+  uint64_t arg;         // the constant's bits or exact integer, the builtin's function, or the instruction's `arg`
+  uint32_t operands[3]; // operand nodes, UINT32_MAX if none
+  uint32_t scope;       // statement of an integer statement plus one, else 0
+  uint8_t op;
+  uint8_t nargs;
+} MathNodeKey;
+
+// stb_ds hash map from operation to node
+typedef struct {
+  MathNodeKey key;
+  uint32_t value;
+} MathNodeIndex;
+
+// Integers up to 2^53 are exact doubles
+#define MATH_EXPR_MAX_EXACT 9007199254740992.0
+
+// Value of an instruction as a polynomial in at most one variable, see `math_expr_polys`
+typedef struct {
+  bool valid;
+  bool sum;      // of several terms
+  bool monomial; // c * x^degree
+  MathInstr var; // the LOAD or ARG of the variable, a CONST while there is none
+  size_t degree;
+  double coefs[MATH_EXPR_POLY_LIMIT + 1]; // lowest degree first
+} MathPoly;
+
+// Copies code into an expression while inlining, see `math_expr_inline`
+typedef struct {
+  MathExpr *expr;
+  MathSlotSet **seen;                  // reads of the statement, NULL to not track them
+  size_t start;                        // first instruction of the statement, folding stops there
+  const MathOptimizeOptions *optimize; // NULL to copy the code as is
+  size_t depth;                        // values on the stack
+  const MathExpr *args;                // code of the arguments substituted for the parameters
+  const size_t *arg_starts;            // argument `i` is `args->code[arg_starts[i]..arg_starts[i + 1])`
+} MathInliner;
+
+// Private functions
+
+static uint32_t math_expr_add_const(MathExpr *expr, double value)
+{
+  arrput(expr->consts, value);
+  arrput(expr->integers, 0);
+  return arrlenu(expr->consts) - 1;
+}
+
+static uint32_t math_expr_add_integer(MathExpr *expr, int64_t value)
+{
+  arrput(expr->consts, (double) value);
+  arrput(expr->integers, value);
+  return arrlenu(expr->consts) - 1;
+}
+
+static uint32_t math_expr_add_symbol(MathExpr *expr, String_View name)
+{
+  arrput(expr->symbols, name);
+  return arrlenu(expr->symbols) - 1;
+}
+
+static uint32_t math_expr_add_builtin(MathExpr *expr, const MathBuiltinFunction *builtin)
+{
+  arrput(expr->builtins, *builtin);
+  return arrlenu(expr->builtins) - 1;
+}
+
+static void math_expr_emit(MathExpr *expr, MathOpcode op, uint8_t nargs, uint32_t arg, Token token)
+{
+  MathInstr instr = {
+    .op = op,
+    .nargs = nargs,
+    .arg = arg,
+  };
+  MathDebugInfo debug = {
+    .loc = token.loc,
+    .text = token.content,
+  };
+  arrput(expr->code, instr);
+  arrput(expr->debug, debug);
+}
+
+// Values `instr` takes from the stack, it always pushes one
+static size_t math_instr_operands(MathInstr instr)
+{
+  switch ((MathOpcode) instr.op) {
+    case BC_CONST:
+    case BC_LOAD:
+    case BC_ARG:
+    case BC_TEMP:
+      return 0;
+    case BC_NEG:
+    case BC_CALL1:
+    case BC_STORE:
+    case BC_SAVE:
+    case BC_POWI:
+    case BC_POLY:
+      return 1;
+    case BC_ADD:
+    case BC_SUB:
+    case BC_MUL:
+    case BC_DIV:
+    case BC_POW:
+    case BC_CALL2:
+      return 2;
+    case BC_FMA:
+      return 3;
+    case BC_CALL:
+    case BC_CALLU:
+      return instr.nargs;
+    case BC_COUNT:
+      break;
+  }
+  assert(0 && "unreachable");
+}
+
+static void math_expr_add_read(MathExpr *expr, MathSlotSet **seen, uint32_t slot)
+{
+  if (hmgeti(*seen, slot) >= 0) return;
+  hmput(*seen, slot, true);
+  arrput(expr->reads, slot);
+}
+
+// Replaces `instr` on the last `nargs` instructions (after `start`) by its result, if they are all constants.
+// Returns false if nothing could be folded and `instr` must still be emitted.
+static bool math_expr_fold(MathExpr *expr, size_t start, MathInstr instr, const MathBuiltinFunction *builtin, Token token)
+{
+  size_t len = arrlenu(expr->code), nargs = math_instr_operands(instr);
+  MathOpcode op = instr.op;
+  double args[3];
+  int64_t integers[3];
+  bool integer = true;
+  assert(nargs <= 3);
+  if (len - start < nargs) return false;
+  for (size_t i = 0; i < nargs; ++i)
+  {
+    const MathInstr operand = expr->code[len - nargs + i];
+    if (operand.op != BC_CONST) return false;
+    args[i] = expr->consts[operand.arg];
+    integers[i] = expr->integers[operand.arg];
+    integer = integer && operand.nargs == 1;
+  }
+  // integers stay exact unless they overflow, then they are folded as doubles like at runtime
+  int64_t exact = 0;
+  switch (integer ? op : BC_COUNT) {
+    case BC_NEG: integer = !__builtin_sub_overflow((int64_t) 0, integers[0], &exact); break;
+    case BC_ADD: integer = !__builtin_add_overflow(integers[0], integers[1], &exact); break;
+    case BC_SUB: integer = !__builtin_sub_overflow(integers[0], integers[1], &exact); break;
+    case BC_MUL: integer = !__builtin_mul_overflow(integers[0], integers[1], &exact); break;
+    case BC_POWI: integer = (int32_t) instr.arg >= 0 && !math_powi_overflow(integers[0], (int32_t) instr.arg, &exact); break;
+    case BC_FMA: {
+      int64_t product;
+      int64_t addend = integers[instr.arg == 1 ? 0 : 2];
+      integer = !__builtin_mul_overflow(integers[instr.arg == 1 ? 1 : 0], integers[instr.arg == 1 ? 2 : 1], &product);
+      integer = integer && !__builtin_add_overflow(product, addend, &exact);
+    } break;
+    default: integer = false; break;
+  }
+  double value;
+  switch (op) {
+    case BC_NEG: value = -args[0]; break;
+    case BC_ADD: value = args[0] + args[1]; break;
+    case BC_SUB: value = args[0] - args[1]; break;
+    case BC_MUL: value = args[0] * args[1]; break;
+    case BC_DIV: value = args[0] / args[1]; break;
+    case BC_POW: value = pow(args[0], args[1]); break;
+    case BC_POWI: value = math_powi(args[0], (int32_t) instr.arg); break;
+    case BC_FMA: value = instr.arg == 1 ? fma(args[1], args[2], args[0]) : fma(args[0], args[1], args[2]); break;
+    case BC_CALL1: value = builtin->as.unary(args[0]); break;
+    case BC_CALL2: value = builtin->as.binary(args[0], args[1]); break;
+    default: return false;
+  }
+  // every CONST adds its own entry, so the operands are the last ones in the pool
+  assert(expr->code[len - nargs].arg == arrlenu(expr->consts) - nargs);
+  arrsetlen(expr->consts, arrlenu(expr->consts) - nargs);
+  arrsetlen(expr->integers, arrlenu(expr->integers) - nargs);
+  arrsetlen(expr->code, len - nargs);
+  arrsetlen(expr->debug, len - nargs);
+  if (integer) math_expr_emit(expr, BC_CONST, 1, math_expr_add_integer(expr, exact), token);
+  else math_expr_emit(expr, BC_CONST, 0, math_expr_add_const(expr, value), token);
+  expr->folded += nargs;
+  return true;
+}
+
+// First instruction of the code computing the value that ends right before `end`
+static size_t math_expr_value_start(const MathExpr *expr, size_t end)
+{
+  size_t missing = 1;
+  while (missing > 0)
+  {
+    missing = missing + math_instr_operands(expr->code[--end]) - 1;
+  }
+  return end;
+}
+
+static void math_expr_emit_neg(MathExpr *expr, const MathOptimizeOptions *optimize, size_t start, Token token)
+{
+  const MathInstr neg = { .op = BC_NEG, .nargs = 1 };
+  if (!optimize->fold_constants || !math_expr_fold(expr, start, neg, NULL, token)) math_expr_emit(expr, BC_NEG, 1, 0, token);
+}
+
+// Rewrites binary `op` on the last two values into cheaper instructions, see `MathOptimizeOptions.reduce_strength`
+// and `MathOptimizeOptions.contract`. `depth` counts the values on the stack, both operands included.
+// Returns false if nothing was rewritten and `op` must still be emitted.
+static bool math_expr_reduce(MathExpr *expr, const MathOptimizeOptions *optimize, size_t start, MathOpcode op, size_t depth, Token token)
+{
+  size_t len = arrlenu(expr->code);
+  const MathInstr right = expr->code[len - 1]; // a constant is always a whole operand
+  double c = right.op == BC_CONST ? expr->consts[right.arg] : NAN;
+  int exponent;
+  if (optimize->reduce_strength && op == BC_POW && fabs(c) <= MATH_PARSER_POWI_LIMIT && c == trunc(c))
+  {
+    // every CONST adds its own entry, so the exponent is the last one in the pool
+    assert(right.arg == arrlenu(expr->consts) - 1);
+    arrsetlen(expr->consts, right.arg);
+    arrsetlen(expr->integers, right.arg);
+    arrsetlen(expr->code, len - 1);
+    arrsetlen(expr->debug, len - 1);
+    // pow(x, 1) is x for every x
+    if (c != 1) math_expr_emit(expr, BC_POWI, 1, (uint32_t) (int32_t) c, token);
+    return true;
+  }
+  if (optimize->reduce_strength && op == BC_DIV && isfinite(c) && fabs(frexp(c, &exponent)) == 0.5 && isnormal(1 / c))
+  {
+    // the reciprocal of a power of two is exact, both round the same quotient
+    expr->consts[right.arg] = 1 / c;
+    expr->integers[right.arg] = 0;
+    expr->code[len - 1].nargs = 0;
+    math_expr_emit(expr, BC_MUL, 2, 0, token);
+    return true;
+  }
+  if (!optimize->contract || (op != BC_ADD && op != BC_SUB)) return false;
+  if (right.op == BC_MUL)
+  {
+    // c + a * b and c - a * b = fma(a, -b, c), the factors are already on the stack above the addend
+    arrsetlen(expr->code, len - 1);
+    arrsetlen(expr->debug, len - 1);
+    if (op == BC_SUB) math_expr_emit_neg(expr, optimize, start, token);
+    math_expr_emit(expr, BC_FMA, 3, 1, token);
+    return true;
+  }
+  size_t split = math_expr_value_start(expr, len); // the right operand starts here
+  if (expr->code[split - 1].op == BC_MUL)
+  {
+    // a * b + c and a * b - c = fma(a, b, -c), the addend is computed on top of both factors instead of their product
+    size_t height = 0, peak = 0;
+    memmove(expr->code + split - 1, expr->code + split, (len - split) * sizeof(expr->code[0]));
+    memmove(expr->debug + split - 1, expr->debug + split, (len - split) * sizeof(expr->debug[0]));
+    arrsetlen(expr->code, len - 1);
+    arrsetlen(expr->debug, len - 1);
+    for (size_t pc = split - 1; pc < len - 1; ++pc)
+    {
+      height = height + 1 - math_instr_operands(expr->code[pc]);
+      if (height > peak) peak = height;
+    }
+    if (depth + peak > expr->max_stack) expr->max_stack = depth + peak;
+    if (op == BC_SUB) math_expr_emit_neg(expr, optimize, start, token);
+    math_expr_emit(expr, BC_FMA, 3, 0, token);
+    return true;
+  }
+  return false;
+}
+
+// Emits arithmetic `instr` on the last values on the stack, folded or rewritten as `optimize` allows.
+// `depth` counts the values on the stack, the operands included.
+static void math_expr_emit_arith(MathExpr *expr, const MathOptimizeOptions *optimize, size_t start, MathInstr instr, size_t depth, Token token)
+{
+  if (optimize->fold_constants && math_expr_fold(expr, start, instr, NULL, token)) return;
+  if (math_instr_operands(instr) == 2 && math_expr_reduce(expr, optimize, start, instr.op, depth, token)) return;
+  math_expr_emit(expr, instr.op, instr.nargs, instr.arg, token);
+}
+
+// Appends instructions [first, end) of `from` to the inliner's expression, with their operands moved to its pools.
+// With `substitute`, parameters are replaced by the code of their arguments. Folds constants as they come.
+static void math_inliner_copy(MathInliner *in, const MathExpr *from, size_t first, size_t end, bool substitute)
+{
+  MathExpr *expr = in->expr;
+  for (size_t pc = first; pc < end; ++pc)
+  {
+    const MathInstr instr = from->code[pc];
+    const Token token = { .loc = from->debug[pc].loc, .content = from->debug[pc].text };
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST: {
+        uint32_t arg = instr.nargs == 1 ? math_expr_add_integer(expr, from->integers[instr.arg]) : math_expr_add_const(expr, from->consts[instr.arg]);
+        math_expr_emit(expr, BC_CONST, instr.nargs, arg, token);
+        in->depth += 1;
+      } break;
+      case BC_LOAD:
+        math_expr_emit(expr, BC_LOAD, 0, instr.arg, token);
+        if (in->seen) math_expr_add_read(expr, in->seen, instr.arg);
+        in->depth += 1;
+        break;
+      case BC_ARG:
+        if (substitute)
+        {
+          math_inliner_copy(in, in->args, in->arg_starts[instr.arg], in->arg_starts[instr.arg + 1], false);
+          break;
+        }
+        math_expr_emit(expr, BC_ARG, 0, instr.arg, token);
+        in->depth += 1;
+        break;
+      case BC_NEG:
+      case BC_ADD:
+      case BC_SUB:
+      case BC_MUL:
+      case BC_DIV:
+      case BC_POW:
+      case BC_POWI:
+      case BC_FMA:
+        if (in->optimize) math_expr_emit_arith(expr, in->optimize, in->start, instr, in->depth, token);
+        else math_expr_emit(expr, instr.op, instr.nargs, instr.arg, token);
+        in->depth -= math_instr_operands(instr) - 1;
+        break;
+      case BC_CALL1:
+      case BC_CALL2: {
+        const MathBuiltinFunction builtin = from->builtins[instr.arg];
+        if (!in->optimize || !in->optimize->fold_constants || !math_expr_fold(expr, in->start, instr, &builtin, token))
+        {
+          math_expr_emit(expr, instr.op, instr.nargs, math_expr_add_builtin(expr, &builtin), token);
+        }
+        in->depth -= instr.nargs - 1;
+      } break;
+      case BC_POLY: {
+        const double *coefs = from->consts + instr.arg;
+        const int64_t *integers = from->integers + instr.arg;
+        size_t len = arrlenu(expr->code);
+        MathInstr *x = &expr->code[len - 1];
+        if (in->optimize && in->optimize->fold_constants && len > in->start && x->op == BC_CONST)
+        {
+          // the coefficients are not in the pool yet, so the operand can simply change its value
+          bool integer = x->nargs == 1;
+          for (size_t i = 0; integer && i <= instr.nargs; ++i) integer = (double) integers[i] == coefs[i];
+          integer = integer && !math_poly_overflow(integers, instr.nargs, expr->integers[x->arg], &expr->integers[x->arg]);
+          if (integer) expr->consts[x->arg] = (double) expr->integers[x->arg];
+          else expr->consts[x->arg] = math_poly(coefs, instr.nargs, expr->consts[x->arg]);
+          if (!integer) expr->integers[x->arg] = 0;
+          x->nargs = integer;
+          expr->folded += 1;
+          break;
+        }
+        uint32_t arg = arrlenu(expr->consts);
+        for (size_t i = 0; i <= instr.nargs; ++i)
+        {
+          arrput(expr->consts, coefs[i]);
+          arrput(expr->integers, integers[i]);
+        }
+        math_expr_emit(expr, BC_POLY, instr.nargs, arg, token);
+      } break;
+      case BC_CALL:
+        math_expr_emit(expr, BC_CALL, instr.nargs, math_expr_add_symbol(expr, from->symbols[instr.arg]), token);
+        in->depth = in->depth - instr.nargs + 1;
+        break;
+      case BC_CALLU:
+        math_expr_emit(expr, BC_CALLU, instr.nargs, instr.arg, token);
+        in->depth = in->depth - instr.nargs + 1;
+        break;
+      case BC_STORE:
+      case BC_COUNT:
+      case BC_SAVE:
+      case BC_TEMP:
+        assert(0 && "not inlined");
+    }
+    if (in->depth > expr->max_stack) expr->max_stack = in->depth;
+  }
+}
+
+// Whether instructions [from, to) of `expr` always compute a value without side effects: constants, defined variables
+// and operators. Arguments the body never uses are dropped, anything else must still run for its errors or assignments.
+static bool math_expr_is_pure(const MathParser *parser, const MathExpr *expr, size_t from, size_t to)
+{
+  for (size_t pc = from; pc < to; ++pc)
+  {
+    const MathInstr instr = expr->code[pc];
+    switch ((MathOpcode) instr.op) {
+      case BC_LOAD:
+        if (!parser->variables[instr.arg].defined) return false;
+        break;
+      case BC_CALL:
+      case BC_CALLU:
+      case BC_STORE:
+        return false;
+      case BC_CONST:
+      case BC_ARG:
+      case BC_NEG:
+      case BC_ADD:
+      case BC_SUB:
+      case BC_MUL:
+      case BC_DIV:
+      case BC_POW:
+      case BC_CALL1:
+      case BC_CALL2:
+      case BC_SAVE:
+      case BC_TEMP:
+      case BC_POWI:
+      case BC_FMA:
+      case BC_POLY:
+        break;
+      case BC_COUNT:
+        assert(0 && "unreachable");
+    }
+  }
+  return true;
+}
+
+// Replaces the call of `callee` by its body, with each parameter substituted by the code of its argument.
+// The arguments are the last `callee->nargs` values of the `depth` on the stack, `args[i]` is where the code of each starts.
+// Arguments used several times are copied, so the size limit counts them at every use, and unused ones are dropped
+// if they are pure (see `math_expr_is_pure`).
+// Returns false without changing `expr` if the call is not inlined.
+static bool math_expr_inline(MathParser *parser, MathExpr *expr, size_t start, const MathUserFunction *callee, const size_t *args, size_t depth, MathSlotSet **seen)
+{
+  const MathExpr *body = &callee->body;
+  size_t len = arrlenu(expr->code), nargs = callee->nargs;
+  size_t from = nargs > 0 ? args[0] : len;
+  size_t size = 0;
+  if (arrlenu(body->statements) != 1) return false;
+  for (size_t pc = 0; pc < arrlenu(body->code); ++pc)
+  {
+    const MathInstr instr = body->code[pc];
+    if (instr.op == BC_STORE) return false;
+    if (instr.op != BC_ARG) size += 1;
+    else size += (instr.arg + 1 < nargs ? args[instr.arg + 1] : len) - args[instr.arg];
+  }
+  if (size > parser->optimize.inline_limit) return false;
+  for (size_t i = 0; i < nargs; ++i)
+  {
+    bool used = false;
+    for (size_t pc = 0; !used && pc < arrlenu(body->code); ++pc) used = body->code[pc].op == BC_ARG && body->code[pc].arg == i;
+    if (!used && !math_expr_is_pure(parser, expr, args[i], i + 1 < nargs ? args[i + 1] : len)) return false;
+  }
+
+  // move the arguments out of the way, with their own pools
+  MathExpr saved = {0};
+  size_t arg_starts[UINT8_MAX + 2];
+  assert(nargs <= UINT8_MAX);
+  for (size_t i = 0; i < nargs; ++i) arg_starts[i] = args[i] - from;
+  arg_starts[nargs] = len - from;
+  MathInliner in = { .expr = &saved };
+  math_inliner_copy(&in, expr, from, len, false);
+  size_t consts = arrlenu(expr->consts);
+  for (size_t pc = from; pc < len; ++pc)
+  {
+    // every CONST and POLY adds its own entries, so those of the arguments are the last ones in the pool
+    if ((expr->code[pc].op == BC_CONST || expr->code[pc].op == BC_POLY) && expr->code[pc].arg < consts) consts = expr->code[pc].arg;
+  }
+  arrsetlen(expr->consts, consts);
+  arrsetlen(expr->integers, consts);
+  arrsetlen(expr->code, from);
+  arrsetlen(expr->debug, from);
+
+  in = (MathInliner) {
+    .expr = expr,
+    .seen = seen,
+    .start = start,
+    .optimize = &parser->optimize,
+    .depth = depth - nargs,
+    .args = &saved,
+    .arg_starts = arg_starts,
+  };
+  math_inliner_copy(&in, body, 0, arrlenu(body->code), true);
+  assert(in.depth == depth - nargs + 1 && "a body leaves one value");
+  expr->inlined += 1;
+  arrfree(saved.code);
+  arrfree(saved.debug);
+  arrfree(saved.consts);
+  arrfree(saved.integers);
+  arrfree(saved.builtins);
+  arrfree(saved.symbols);
+  return true;
+}
+
+// Whether the statement starting at `start` qualifies for the integer tier, see `MathStatement.integer`.
+// Assignments must come last, so an overflow is always detected before anything is stored.
+static bool math_expr_is_integer(const MathExpr *expr, size_t start)
+{
+  size_t size = arrlenu(expr->code);
+  bool stored = false;
+  for (size_t pc = start; pc < size; ++pc)
+  {
+    const MathInstr instr = expr->code[pc];
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST:
+        if (instr.nargs != 1 || stored) return false;
+        break;
+      case BC_POWI:
+        if ((int32_t) instr.arg < 0 || stored) return false;
+        break;
+      case BC_POLY:
+        for (size_t k = 0; k <= instr.nargs; ++k)
+        {
+          if ((double) expr->integers[instr.arg + k] != expr->consts[instr.arg + k]) return false;
+        }
+        if (stored) return false;
+        break;
+      case BC_LOAD:
+      case BC_NEG:
+      case BC_ADD:
+      case BC_SUB:
+      case BC_MUL:
+      case BC_FMA:
+        if (stored) return false;
+        break;
+      case BC_STORE:
+        stored = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool math_poly_same_var(const MathPoly *left, const MathPoly *right)
+{
+  return left->var.op == BC_CONST || right->var.op == BC_CONST || (left->var.op == right->var.op && left->var.arg == right->var.arg);
+}
+
+// *sum = a + b, false if it was rounded (two-sum error) or overflowed
+static bool math_exact_add(double a, double b, double *sum)
+{
+  *sum = a + b;
+  double b_part = *sum - a;
+  return isfinite(*sum) && (a - (*sum - b_part)) + (b - b_part) == 0;
+}
+
+// *product = a * b, false if it was rounded. Subnormal products may have lost bits fma does not show.
+static bool math_exact_mul(double a, double b, double *product)
+{
+  *product = a * b;
+  if (*product == 0) return a == 0 || b == 0;
+  return isnormal(*product) && fma(a, b, -*product) == 0;
+}
+
+// left = left + sign * right. Terms of the same degree only merge if their coefficients add up exactly and do not
+// cancel, a term that is gone would not take part in inf - inf.
+static void math_poly_add(MathPoly *left, const MathPoly *right, double sign)
+{
+  left->valid = left->valid && right->valid && math_poly_same_var(left, right);
+  if (!left->valid) return;
+  for (size_t i = left->degree + 1; i <= right->degree; ++i) left->coefs[i] = 0;
+  for (size_t i = 0; left->valid && i <= right->degree; ++i)
+  {
+    double a = left->coefs[i], b = sign * right->coefs[i];
+    left->valid = math_exact_add(a, b, &left->coefs[i]) && (left->coefs[i] != 0 || a == 0 || b == 0);
+  }
+  if (right->degree > left->degree) left->degree = right->degree;
+  if (left->var.op == BC_CONST) left->var = right->var;
+  left->sum = true;
+  left->monomial = false;
+}
+
+// left = left * right, only terms are multiplied: expanding products of sums could lose precision.
+// So could products of coefficients, they must be exact.
+static void math_poly_mul(MathPoly *left, const MathPoly *right)
+{
+  left->valid = left->valid && right->valid && math_poly_same_var(left, right)
+    && (left->degree == 0 || right->degree == 0 || (left->monomial && right->monomial))
+    && left->degree + right->degree <= MATH_EXPR_POLY_LIMIT;
+  if (!left->valid) return;
+  double coefs[MATH_EXPR_POLY_LIMIT + 1] = {0};
+  for (size_t i = 0; left->valid && i <= left->degree; ++i)
+  {
+    for (size_t j = 0; left->valid && j <= right->degree; ++j)
+    {
+      double product;
+      left->valid = math_exact_mul(left->coefs[i], right->coefs[j], &product) && math_exact_add(coefs[i + j], product, &coefs[i + j]);
+    }
+  }
+  left->degree += right->degree;
+  memcpy(left->coefs, coefs, (left->degree + 1) * sizeof(double));
+  if (left->var.op == BC_CONST) left->var = right->var;
+  left->sum = left->sum || right->sum;
+  left->monomial = left->monomial && right->monomial;
+}
+
+// Runs `code`, which computes one value with the pools of `expr`, on polynomials and returns that value.
+// With `rewrite`, also marks the instructions whose value is worth evaluating as a BC_POLY:
+// a polynomial in a variable, of at least degree 2 and with several terms. In an `integer` statement,
+// the coefficients must also be exact integers.
+static MathPoly math_expr_poly(const MathExpr *expr, const MathInstr *code, size_t size, bool integer, bool *rewrite)
+{
+  MathPoly *stack = NULL;
+  for (size_t pc = 0; pc < size; ++pc)
+  {
+    const MathInstr instr = code[pc];
+    size_t nargs = math_instr_operands(instr);
+    MathPoly *operands = stack + arrlenu(stack) - nargs, *result = operands;
+    MathPoly value = { .valid = true, .monomial = true, .var = { .op = BC_CONST } };
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST:
+        value.coefs[0] = expr->consts[instr.arg];
+        arrput(stack, value);
+        result = &arrlast(stack);
+        break;
+      case BC_LOAD:
+      case BC_ARG:
+        value.var = instr;
+        value.degree = 1;
+        value.coefs[1] = 1;
+        arrput(stack, value);
+        result = &arrlast(stack);
+        break;
+      case BC_NEG:
+        for (size_t i = 0; i <= result->degree; ++i) result->coefs[i] = -result->coefs[i];
+        break;
+      case BC_ADD:
+      case BC_SUB:
+        math_poly_add(result, &operands[1], instr.op == BC_SUB ? -1 : 1);
+        break;
+      case BC_MUL:
+        math_poly_mul(result, &operands[1]);
+        break;
+      case BC_DIV: {
+        // only by powers of two, as in `math_expr_reduce`: their reciprocal is exact
+        int exponent;
+        double c = operands[1].coefs[0];
+        result->valid = result->valid && operands[1].valid && operands[1].degree == 0 && isfinite(c) && fabs(frexp(c, &exponent)) == 0.5 && isnormal(1 / c);
+        for (size_t i = 0; result->valid && i <= result->degree; ++i) result->valid = math_exact_mul(result->coefs[i], 1 / c, &result->coefs[i]);
+      } break;
+      case BC_POWI: {
+        int32_t n = (int32_t) instr.arg;
+        size_t degree = result->degree;
+        result->valid = result->valid && result->monomial && n >= 0 && degree * n <= MATH_EXPR_POLY_LIMIT;
+        if (!result->valid) break;
+        double coef = result->coefs[degree], power = 1;
+        for (int32_t k = 0; result->valid && k < n; ++k) result->valid = math_exact_mul(power, coef, &power);
+        memset(result->coefs, 0, sizeof(result->coefs));
+        result->degree = degree * n;
+        result->coefs[result->degree] = power;
+      } break;
+      case BC_FMA:
+        // a * b + c, or c + a * b
+        if (instr.arg == 1)
+        {
+          math_poly_mul(&operands[1], &operands[2]);
+          math_poly_add(result, &operands[1], 1);
+        }
+        else
+        {
+          math_poly_mul(result, &operands[1]);
+          math_poly_add(result, &operands[2], 1);
+        }
+        break;
+      default:
+        for (size_t i = 0; i < nargs; ++i) operands[i].valid = false;
+        if (nargs == 0)
+        {
+          arrput(stack, value);
+          result = &arrlast(stack);
+        }
+        result->valid = false;
+        break;
+    }
+    bool exact = true;
+    for (size_t i = 0; result->valid && i <= result->degree; ++i)
+    {
+      result->valid = isfinite(result->coefs[i]);
+      exact = exact && fabs(result->coefs[i]) <= MATH_EXPR_MAX_EXACT;
+    }
+    if (nargs > 1) arrsetlen(stack, arrlenu(stack) - nargs + 1);
+    if (rewrite) rewrite[pc] = result->valid && result->var.op != BC_CONST && result->degree >= 2 && result->sum && (exact || !integer);
+  }
+  assert(arrlenu(stack) == 1);
+  MathPoly value = stack[0];
+  arrfree(stack);
+  return value;
+}
+
+// Replaces the largest polynomials in a single variable of the statement starting at `start` by a BC_POLY of
+// that variable, see `MathOptimizeOptions.polynomials`. Only sums of terms c * x^k are taken, as they were written,
+// and only if their coefficients are computed exactly: divisions by powers of two, exact products and sums.
+// Polynomials of `integer` statements keep exact coefficients, so they still run on integers.
+static void math_expr_polys(MathExpr *expr, size_t start, bool integer)
+{
+  size_t size = arrlenu(expr->code) - start;
+  bool *rewrite = calloc(size, sizeof(rewrite[0]));
+  size_t *first = malloc(size * sizeof(first[0])); // first instruction of the code computing each value
+  size_t *roots = NULL;
+  assert(rewrite != NULL && first != NULL);
+  (void) math_expr_poly(expr, expr->code + start, size, integer, rewrite);
+  for (size_t i = 0; i < size; ++i)
+  {
+    first[i] = i;
+    for (size_t j = 0; j < math_instr_operands(expr->code[start + i]); ++j) first[i] = first[first[i] - 1];
+  }
+  // outer values come later, take the last ones first and skip what they contain
+  for (size_t i = size; i-- > 0;)
+  {
+    if (!rewrite[i]) continue;
+    arrput(roots, i);
+    i = first[i];
+  }
+  if (arrlenu(roots) > 0)
+  {
+    MathInstr *code = NULL;
+    MathDebugInfo *debug = NULL;
+    arrsetlen(code, size);
+    arrsetlen(debug, size);
+    memcpy(code, expr->code + start, size * sizeof(code[0]));
+    memcpy(debug, expr->debug + start, size * sizeof(debug[0]));
+    arrsetlen(expr->code, start);
+    arrsetlen(expr->debug, start);
+    for (size_t i = 0; i < size; ++i)
+    {
+      if (arrlenu(roots) == 0 || first[arrlast(roots)] != i)
+      {
+        arrput(expr->code, code[i]);
+        arrput(expr->debug, debug[i]);
+        continue;
+      }
+      // the constants of the replaced code stay unused in the pool
+      size_t root = arrpop(roots), var = i;
+      MathPoly poly = math_expr_poly(expr, code + i, root + 1 - i, integer, NULL);
+      while (code[var].op != poly.var.op || code[var].arg != poly.var.arg) ++var;
+      arrput(expr->code, poly.var);
+      arrput(expr->debug, debug[var]);
+      uint32_t arg = arrlenu(expr->consts);
+      for (size_t k = 0; k <= poly.degree; ++k)
+      {
+        if (integer) math_expr_add_integer(expr, (int64_t) poly.coefs[k]);
+        else math_expr_add_const(expr, poly.coefs[k]);
+      }
+      arrput(expr->code, ((MathInstr) { .op = BC_POLY, .nargs = poly.degree, .arg = arg }));
+      arrput(expr->debug, debug[root]);
+      i = root;
+    }
+    arrfree(code);
+    arrfree(debug);
+  }
+  arrfree(roots);
+  free(rewrite);
+  free(first);
+}
+
+// Implementation
+
+const char *math_opcode_name(MathOpcode op)
+{
+  switch (op) {
+    case BC_CONST: return "CONST";
+    case BC_LOAD: return "LOAD";
+    case BC_ARG: return "ARG";
+    case BC_NEG: return "NEG";
+    case BC_ADD: return "ADD";
+    case BC_SUB: return "SUB";
+    case BC_MUL: return "MUL";
+    case BC_DIV: return "DIV";
+    case BC_POW: return "POW";
+    case BC_CALL: return "CALL";
+    case BC_CALL1: return "CALL1";
+    case BC_CALL2: return "CALL2";
+    case BC_CALLU: return "CALLU";
+    case BC_STORE: return "STORE";
+    case BC_SAVE: return "SAVE";
+    case BC_TEMP: return "TEMP";
+    case BC_POWI: return "POWI";
+    case BC_FMA: return "FMA";
+    case BC_POLY: return "POLY";
+    case BC_COUNT: break;
+  }
+  assert(0 && "unreachable");
+}
+
+static ssize_t math_expr_find_argument(const MathUserFunction *fn, String_View name)
+{
+  size_t size = fn ? fn->nargs : 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    if (sv_eq_ignorecase(name, fn->argument_names[i])) return i;
+  }
+  return -1;
+}
+
+MathParserError math_expr_lower(MathParser *parser, const MathUserFunction *fn, MathExpr *expr, const MathOperator *queue, size_t size, bool *added)
+{
+  assert(parser != NULL);
+  assert(expr != NULL);
+  assert(added != NULL);
+  MathParserError err = MERR_OPERATOR_ERROR;
+  size_t start = arrlenu(expr->code);
+  size_t reads_start = arrlenu(expr->reads);
+  size_t depth = 0;
+  size_t folded = expr->folded;
+  size_t inlined = expr->inlined;
+  bool fold = parser->optimize.fold_constants;
+  MathSlotSet *seen = NULL;
+  size_t *starts = NULL; // where the code of each value on the stack starts
+  *added = false;
+  for (size_t i = 0; i < size; ++i)
+  {
+    const MathOperator op = queue[i];
+    const Token token = op.token;
+    if (op.assignment)
+    {
+      if (depth == 0) break; // nothing to assign, statement has no value
+      ssize_t slot = math_parser_bind_var(parser, token.content);
+      if (slot < 0)
+      {
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_ASSIGN_CONSTANT, .loc = token.loc, .text = token.content });
+        err = MERR_SYMBOL_ALREADY_SET;
+        goto error;
+      }
+      math_expr_emit(expr, BC_STORE, 0, slot, token);
+      continue;
+    }
+    switch (token.kind) {
+      case TK_INTEGER:
+        arrput(starts, arrlenu(expr->code));
+        math_expr_emit(expr, BC_CONST, 1, math_expr_add_integer(expr, token.as.integer.value), token);
+        if (++depth > expr->max_stack) expr->max_stack = depth;
+        continue;
+      case TK_REAL:
+        arrput(starts, arrlenu(expr->code));
+        math_expr_emit(expr, BC_CONST, 0, math_expr_add_const(expr, token.as.real.value), token);
+        if (++depth > expr->max_stack) expr->max_stack = depth;
+        continue;
+      case TK_SYMBOL: {
+        if (op.function) break;
+        arrput(starts, arrlenu(expr->code));
+        // arguments shadow globals
+        ssize_t slot = math_expr_find_argument(fn, token.content);
+        if (slot >= 0)
+        {
+          math_expr_emit(expr, BC_ARG, 0, slot, token);
+        }
+        else if ((slot = math_parser_bind_var(parser, token.content)) >= 0)
+        {
+          math_expr_emit(expr, BC_LOAD, 0, slot, token);
+          math_expr_add_read(expr, &seen, slot);
+        }
+        else
+        {
+          double value;
+          bool worked = math_parser_get_var(parser, token.content, &value);
+          assert(worked && "only builtin constants have no slot");
+          math_expr_emit(expr, BC_CONST, 0, math_expr_add_const(expr, value), token);
+        }
+        if (++depth > expr->max_stack) expr->max_stack = depth;
+        continue;
+      }
+      case TK_OP:
+        break;
+      case TK_OPEN_PAREN:
+      case TK_CLOSE_PAREN:
+      case TK_SEPARATOR:
+      case TK_ASSIGN:
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_EXPECTED_OPERATOR, .loc = token.loc, .text = token.content });
+        goto error;
+    }
+    if (depth < op.nargs)
+    {
+      math_parser_report(parser, (Diagnostic) { .code = DIAG_MISSING_OPERANDS, .loc = token.loc, .text = token.content });
+      goto error;
+    }
+    if (op.function)
+    {
+      assert(op.nargs <= UINT8_MAX && "too many arguments");
+      size_t value_start = op.nargs > 0 ? starts[depth - op.nargs] : arrlenu(expr->code);
+      ssize_t index;
+      if (op.builtin)
+      {
+        assert(op.builtin->nargs == op.nargs && (op.nargs == 1 || op.nargs == 2));
+        MathOpcode opcode = op.nargs == 1 ? BC_CALL1 : BC_CALL2;
+        if (!fold || !math_expr_fold(expr, start, (MathInstr) { .op = opcode, .nargs = op.nargs }, op.builtin, token))
+        {
+          math_expr_emit(expr, opcode, op.nargs, math_expr_add_builtin(expr, op.builtin), token);
+        }
+      }
+      else if ((index = math_parser_find_function(parser, token.content, op.nargs)) >= 0)
+      {
+        if (!math_expr_inline(parser, expr, start, &parser->functions[index], starts + depth - op.nargs, depth, &seen))
+        {
+          math_expr_emit(expr, BC_CALLU, op.nargs, index, token);
+        }
+      }
+      else
+      {
+        // not defined yet, bind late
+        math_expr_emit(expr, BC_CALL, op.nargs, math_expr_add_symbol(expr, token.content), token);
+      }
+      depth = depth - op.nargs + 1;
+      if (depth > expr->max_stack) expr->max_stack = depth;
+      arrsetlen(starts, depth - 1);
+      arrput(starts, value_start);
+    }
+    else if (op.nargs == 1)
+    {
+      assert((token.as.op == OP_ADD || token.as.op == OP_SUB) && "only + and - should be allowed as unary");
+      if (token.as.op == OP_SUB) math_expr_emit_neg(expr, &parser->optimize, start, token);
+    }
+    else if (op.nargs == 2)
+    {
+      MathOpcode opcode = BC_COUNT;
+      switch (token.as.op) {
+        case OP_ADD: opcode = BC_ADD; break;
+        case OP_SUB: opcode = BC_SUB; break;
+        case OP_MUL: opcode = BC_MUL; break;
+        case OP_DIV: opcode = BC_DIV; break;
+        case OP_EXP: opcode = BC_POW; break;
+      }
+      math_expr_emit_arith(expr, &parser->optimize, start, (MathInstr) { .op = opcode, .nargs = 2 }, depth, token);
+      depth -= 1;
+      arrsetlen(starts, depth);
+    }
+    else
+    {
+      assert(0 && "unexpected arity");
+    }
+  }
+  if (depth == 0)
+  {
+    err = MERR_OK;
+    goto error; // not an error, but nothing to keep
+  }
+  if (depth > 1)
+  {
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_UNCONSUMED_INPUT, .loc = queue[0].token.loc });
+    goto error;
+  }
+  bool integer = math_expr_is_integer(expr, start);
+  if (parser->optimize.polynomials) math_expr_polys(expr, start, integer);
+  MathStatement statement = {
+    .end = arrlenu(expr->code),
+    .reads_end = arrlenu(expr->reads),
+    .integer = integer,
+  };
+  arrput(expr->statements, statement);
+  hmfree(seen);
+  arrfree(starts);
+  *added = true;
+  return MERR_OK;
+
+error:
+  expr->folded = folded;
+  expr->inlined = inlined;
+  arrsetlen(expr->code, start);
+  arrsetlen(expr->debug, start);
+  arrsetlen(expr->reads, reads_start);
+  hmfree(seen);
+  arrfree(starts);
+  return err;
+}
+
+size_t math_expr_share(MathExpr *expr)
+{
+  assert(expr != NULL);
+  assert(expr->ntemps == 0 && "already shared");
+  size_t size = arrlenu(expr->code), count = arrlenu(expr->statements);
+  MathNodeIndex *index = NULL;
+  MathNode *nodes = NULL;
+  uint32_t *node = malloc(size * sizeof(node[0]));  // node computed by each instruction
+  size_t *first = malloc(size * sizeof(first[0])); // first instruction of the code computing it
+  size_t *out = malloc(size * sizeof(out[0]));     // where it was copied to
+  uint32_t *stack = NULL;
+  assert(node != NULL && first != NULL && out != NULL);
+
+  // build the DAG: identical pure operations on identical operands are the same node
+  for (size_t statement = 0, pc = 0; statement < count; ++statement)
+  {
+    // integer statements only share within themselves, their temporaries may hold int64_t
+    uint32_t scope = expr->statements[statement].integer ? statement + 1 : 0;
+    arrsetlen(stack, 0);
+    for (; pc < expr->statements[statement].end; ++pc)
+    {
+      const MathInstr instr = expr->code[pc];
+      size_t nargs = math_instr_operands(instr);
+      assert(arrlenu(stack) >= nargs);
+      uint32_t *operands = stack + arrlenu(stack) - nargs;
+      MathNodeKey key;
+      memset(&key, 0, sizeof(key)); // hashed bytewise, including padding
+      key.op = instr.op;
+      key.nargs = instr.nargs;
+      for (size_t i = 0; i < 3; ++i) key.operands[i] = i < nargs ? operands[i] : UINT32_MAX;
+      key.scope = scope;
+      switch ((MathOpcode) instr.op) {
+        case BC_CONST:
+          // integer literals may round to the same double, `nargs` in the key keeps them apart from doubles
+          if (instr.nargs == 1) key.arg = (uint64_t) expr->integers[instr.arg];
+          else memcpy(&key.arg, &expr->consts[instr.arg], sizeof(double));
+          break;
+        case BC_CALL1: key.arg = (uintptr_t) expr->builtins[instr.arg].as.unary; break;
+        case BC_CALL2: key.arg = (uintptr_t) expr->builtins[instr.arg].as.binary; break;
+        default: key.arg = instr.arg; break;
+      }
+      // the code of the operands is right before, the last one ends at `pc`
+      first[pc] = pc;
+      for (size_t i = 0; i < nargs; ++i) first[pc] = first[first[pc] - 1];
+      bool pure = instr.op != BC_CALL && instr.op != BC_CALLU && instr.op != BC_STORE;
+      ptrdiff_t found = pure ? hmgeti(index, key) : -1;
+      if (found >= 0)
+      {
+        node[pc] = index[found].value;
+      }
+      else
+      {
+        node[pc] = arrlenu(nodes);
+        arrput(nodes, ((MathNode) { .temp = -1 }));
+        if (pure) hmput(index, key, node[pc]);
+        for (size_t i = 0; i < nargs; ++i) nodes[operands[i]].uses += 1;
+      }
+      arrsetlen(stack, arrlenu(stack) - nargs);
+      arrput(stack, node[pc]);
+    }
+    assert(arrlenu(stack) == 1);
+    nodes[stack[0]].uses += 1; // the value of the statement
+  }
+
+  // nodes used more than once are computed once and saved, anything but a single load or constant is worth it
+  for (size_t pc = 0; pc < size; ++pc)
+  {
+    MathNode *n = &nodes[node[pc]];
+    MathOpcode op = expr->code[pc].op;
+    if (n->uses > 1 && n->temp < 0 && op != BC_CONST && op != BC_LOAD && op != BC_ARG) n->temp = expr->ntemps++;
+  }
+
+  // copy the code, replacing every computation of a saved node after the first by its temporary
+  size_t removed = 0;
+  if (expr->ntemps > 0)
+  {
+    MathInstr *code = expr->code;
+    MathDebugInfo *debug = expr->debug;
+    size_t depth = 0, max_stack = 0;
+    expr->code = NULL;
+    expr->debug = NULL;
+    arrsetlen(expr->reads, 0);
+    for (size_t statement = 0, pc = 0; statement < count; ++statement)
+    {
+      MathSlotSet *seen = NULL;
+      for (; pc < expr->statements[statement].end; ++pc)
+      {
+        MathInstr instr = code[pc];
+        MathNode *n = &nodes[node[pc]];
+        out[pc] = arrlenu(expr->code);
+        if (n->temp >= 0 && n->saved)
+        {
+          // drop the code computing it, it only contains saved nodes and nodes without temporaries
+          arrsetlen(expr->code, out[first[pc]]);
+          arrsetlen(expr->debug, out[first[pc]]);
+          instr = (MathInstr) { .op = BC_TEMP, .arg = n->temp };
+        }
+        arrput(expr->code, instr);
+        arrput(expr->debug, debug[pc]);
+        if (n->temp >= 0 && !n->saved)
+        {
+          arrput(expr->code, ((MathInstr) { .op = BC_SAVE, .arg = n->temp }));
+          arrput(expr->debug, debug[pc]);
+          n->saved = true;
+        }
+      }
+      size_t start = statement == 0 ? 0 : expr->statements[statement - 1].end;
+      expr->statements[statement].end = arrlenu(expr->code);
+      // reads of shared nodes were already checked by the statement computing them
+      depth = 0;
+      for (size_t i = start; i < arrlenu(expr->code); ++i)
+      {
+        const MathInstr instr = expr->code[i];
+        depth = depth - math_instr_operands(instr) + 1;
+        if (depth > max_stack) max_stack = depth;
+        if (instr.op == BC_LOAD) math_expr_add_read(expr, &seen, instr.arg);
+      }
+      expr->statements[statement].reads_end = arrlenu(expr->reads);
+      hmfree(seen);
+    }
+    removed = size - arrlenu(expr->code);
+    expr->max_stack = max_stack + expr->ntemps;
+    arrfree(code);
+    arrfree(debug);
+  }
+  expr->shared = removed;
+  hmfree(index);
+  arrfree(nodes);
+  arrfree(stack);
+  free(node);
+  free(first);
+  free(out);
+  return removed;
+}
+
+void math_expr_dump(const MathExpr *expr, FILE *stream)
+{
+  size_t size = arrlenu(expr->code), statement = 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    if (i == 0 || expr->statements[statement].end == i)
+    {
+      if (i > 0) ++statement;
+      fprintf(stream, "; statement %zu\n", statement + 1);
+    }
+    const MathInstr instr = expr->code[i];
+    fprintf(stream, "  %04zu %s", i, math_opcode_name(instr.op));
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST: {
+        char value[MATH_FORMAT_BUFFER_SIZE];
+        if (instr.nargs == 1) snprintf(value, sizeof(value), "%" PRId64, expr->integers[instr.arg]);
+        else math_format_double(expr->consts[instr.arg], value);
+        fprintf(stream, " %s", value);
+      } break;
+      case BC_LOAD:
+      case BC_ARG:
+      case BC_STORE:
+        fprintf(stream, " %u (" SV_Fmt ")", instr.arg, SV_Arg(expr->debug[i].text));
+        break;
+      case BC_CALL:
+        fprintf(stream, " " SV_Fmt "/%u", SV_Arg(expr->symbols[instr.arg]), instr.nargs);
+        break;
+      case BC_CALL1:
+      case BC_CALL2:
+        fprintf(stream, " " SV_Fmt "/%zu", SV_Arg(expr->builtins[instr.arg].name), expr->builtins[instr.arg].nargs);
+        break;
+      case BC_CALLU:
+        fprintf(stream, " %u (" SV_Fmt "/%u)", instr.arg, SV_Arg(expr->debug[i].text), instr.nargs);
+        break;
+      case BC_SAVE:
+      case BC_TEMP:
+        fprintf(stream, " %u", instr.arg);
+        break;
+      case BC_POWI:
+        fprintf(stream, " %" PRId32, (int32_t) instr.arg);
+        break;
+      case BC_FMA:
+        if (instr.arg == 1) fputs(" addend first", stream);
+        break;
+      case BC_POLY:
+        for (size_t k = instr.nargs + 1; k-- > 0;)
+        {
+          char value[MATH_FORMAT_BUFFER_SIZE];
+          math_format_double(expr->consts[instr.arg + k], value);
+          fprintf(stream, "%s%s", k == instr.nargs ? " " : ", ", value);
+        }
+        break;
+      case BC_NEG:
+      case BC_ADD:
+      case BC_SUB:
+      case BC_MUL:
+      case BC_DIV:
+      case BC_POW:
+      case BC_COUNT:
+        break;
+    }
+    fputc('\n', stream);
+  }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "lexer.h"
+
+typedef enum {
+  BC_CONST, // push consts[arg], exact integers[arg] if `nargs` is 1
+  BC_LOAD,  // push value of global variable in slot `arg`
+  BC_ARG,   // push argument `arg` of the running user function
+  BC_NEG,
+  BC_ADD,
+  BC_SUB,
+  BC_MUL,
+  BC_DIV,
+  BC_POW,
+  BC_CALL,  // call user function symbols[arg] with `nargs` arguments from the stack, looked up by name
+  BC_CALL1, // call unary builtins[arg]
+  BC_CALL2, // call binary builtins[arg]
+  BC_CALLU, // call user function `arg` of the parser with `nargs` arguments from the stack
+  BC_STORE, // define global variable in slot `arg` with top of stack, does not pop
+  BC_SAVE,  // copy top of stack to temporary `arg`, does not pop
+  BC_TEMP,  // push temporary `arg`, a subexpression shared by several statements or operands
+  BC_POWI,  // raise top of stack to the integer power `(int32_t) arg` by squaring, see `math_powi`
+  BC_FMA,   // fma(a, b, c) of the top three values a b c, or of c a b if `arg` is 1
+  BC_POLY,  // polynomial of degree `nargs` in the top of stack, its `nargs` + 1 coefficients are consts[arg] on,
+            // lowest degree first, and integers[arg] on in integer statements
+  BC_COUNT,
+} MathOpcode;
+
+// One instruction, 8 bytes. Operands live in the pools of the owning expression.
+typedef struct {
+  uint8_t op; // MathOpcode
+  uint8_t nargs;
+  uint32_t arg;
+} MathInstr;
+_Static_assert(sizeof(MathInstr) == 8, "instructions should stay dense");
+
+// Cold per-instruction information, only used to report errors.
+typedef struct {
+  Location loc;
+  String_View text;
+} MathDebugInfo;
+
+const char *math_opcode_name(MathOpcode op);
+
+// x^n by repeated squaring, the exact order of operations BC_POWI uses everywhere
+static inline double math_powi(double x, int32_t n)
+{
+  uint32_t m = n < 0 ? -(uint32_t) n : (uint32_t) n;
+  double result = 1.0;
+  while (m > 0)
+  {
+    if (m & 1) result *= x;
+    m >>= 1;
+    if (m > 0) x *= x;
+  }
+  return n < 0 ? 1.0 / result : result;
+}
+
+// Highest degree of a BC_POLY
+#define MATH_EXPR_POLY_LIMIT 16
+
+// Estrin's scheme for the polynomial of `degree` with `coefs` lowest first, the order BC_POLY uses everywhere.
+// Each step pairs up the coefficients into those of a polynomial in x^2, until one is left. Unlike Horner's scheme,
+// the operations of a step do not depend on each other. Parts whose coefficients are all 0 are skipped rather than
+// multiplied, like the terms missing from the written polynomial: 0 * inf would turn x^2 + 1 into NaN for x = inf.
+static inline double math_poly(const double *coefs, size_t degree, double x)
+{
+  double b[MATH_EXPR_POLY_LIMIT / 2 + 1];
+  bool zero[MATH_EXPR_POLY_LIMIT / 2 + 1];
+  size_t count = 0;
+  assert(degree <= MATH_EXPR_POLY_LIMIT);
+  if (degree == 0) return coefs[0];
+  for (size_t i = 0; i < degree; i += 2, ++count)
+  {
+    b[count] = coefs[i + 1] == 0 ? coefs[i] : coefs[i] + coefs[i + 1] * x;
+    zero[count] = coefs[i] == 0 && coefs[i + 1] == 0;
+  }
+  if (degree % 2 == 0)
+  {
+    b[count] = coefs[degree];
+    zero[count++] = coefs[degree] == 0;
+  }
+  while (count > 1)
+  {
+    size_t m = 0;
+    x *= x;
+    for (size_t i = 0; i + 1 < count; i += 2, ++m)
+    {
+      b[m] = zero[i + 1] ? b[i] : b[i] + b[i + 1] * x;
+      zero[m] = zero[i] && zero[i + 1];
+    }
+    if (count % 2 == 1)
+    {
+      b[m] = b[count - 1];
+      zero[m++] = zero[count - 1];
+    }
+    count = m;
+  }
+  return b[0];
+}
+
+// Exact x^n for n >= 0, returns true if it overflowed
+static inline bool math_powi_overflow(int64_t x, int32_t n, int64_t *result)
+{
+  bool overflowed = false;
+  assert(n >= 0);
+  *result = 1;
+  while (n > 0)
+  {
+    if (n & 1) overflowed |= __builtin_mul_overflow(*result, x, result);
+    n >>= 1;
+    if (n > 0) overflowed |= __builtin_mul_overflow(x, x, &x);
+  }
+  return overflowed;
+}
+
+// Exact `math_poly` for integer coefficients in Horner's scheme, returns true if it overflowed
+static inline bool math_poly_overflow(const int64_t *coefs, size_t degree, int64_t x, int64_t *result)
+{
+  bool overflowed = false;
+  *result = coefs[degree];
+  for (size_t i = degree; i-- > 0;)
+  {
+    overflowed |= __builtin_mul_overflow(*result, x, result);
+    overflowed |= __builtin_add_overflow(*result, coefs[i], result);
+  }
+  return overflowed;
+}
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "diag.h"
+#include "format.h"
+#include "lexer.h"
+
+bool diag_is_note(DiagCode code)
+{
+  return code >= DIAG_NOTE_PRECEDED_BY;
+}
+
+int diag_message(const Diagnostic *diag, char *buf, size_t size)
+{
+  assert(diag != NULL);
+  const String_View text = diag->text;
+  switch (diag->code) {
+    case DIAG_INVALID_LITERAL: return snprintf(buf, size, "Invalid number literal " SV_Fmt, SV_Arg(text));
+    case DIAG_LITERAL_OVERFLOW: return snprintf(buf, size, "Overflow caused by conversion of literal " SV_Fmt, SV_Arg(text));
+    case DIAG_LITERAL_UNDERFLOW: return snprintf(buf, size, "Underflow caused by conversion of literal " SV_Fmt, SV_Arg(text));
+    case DIAG_LITERAL_CONVERSION: return snprintf(buf, size, "(internal) Conversion of " SV_Fmt " did not consume the whole literal", SV_Arg(text));
+    case DIAG_UNRECOGNIZED_TOKEN: return snprintf(buf, size, "Unrecognized token starts with " SV_Fmt, SV_Arg(text));
+    case DIAG_UNEXPECTED_OPERATOR: return snprintf(buf, size, "Unexpected operator " SV_Fmt ", expected expression", SV_Arg(text));
+    case DIAG_UNEXPECTED_TOKEN: return snprintf(buf, size, "Unexpected " SV_Fmt ", expected expression", SV_Arg(text));
+    case DIAG_UNEXPECTED_END: return snprintf(buf, size, "Unexpected end of input, expected expression");
+    case DIAG_UNEXPECTED_ASSIGNMENT: return snprintf(buf, size, "Unexpected assignment inside expression");
+    case DIAG_SEPARATOR_OUTSIDE_CALL: return snprintf(buf, size, "Got separator without function call in parenthesis");
+    case DIAG_UNBALANCED_CLOSE: return snprintf(buf, size, "Unbalanced parenthesis, got ) without prior (");
+    case DIAG_UNBALANCED_OPEN: return snprintf(buf, size, "Unbalanced parenthesis, this ( was not closed");
+    case DIAG_INVALID_ARGUMENT_LIST: return snprintf(buf, size, "Token %s not valid in function definition, expected a list of arguments, got " SV_Fmt, lexer_strtokenkind(diag->value.integer), SV_Arg(text));
+    case DIAG_FUNCTION_DEFINED: return snprintf(buf, size, "Function " SV_Fmt " already defined", SV_Arg(text));
+    case DIAG_ASSIGN_CONSTANT: return snprintf(buf, size, "Cannot assign to builtin constant " SV_Fmt, SV_Arg(text));
+    case DIAG_EXPECTED_OPERATOR: return snprintf(buf, size, "Expected operator, got " SV_Fmt, SV_Arg(text));
+    case DIAG_MISSING_OPERANDS: return snprintf(buf, size, "Not enough operands for operator " SV_Fmt, SV_Arg(text));
+    case DIAG_UNCONSUMED_INPUT: return snprintf(buf, size, "Unconsumed input on stack");
+    case DIAG_INPUT_EMPTY: return snprintf(buf, size, "Input empty");
+    case DIAG_UNRECOGNIZED_VARIABLE: return snprintf(buf, size, "Unrecognized variable " SV_Fmt, SV_Arg(text));
+    case DIAG_UNRECOGNIZED_FUNCTION: return snprintf(buf, size, "Unrecognized function " SV_Fmt " with %zu argument(s)", SV_Arg(text), diag->value.count);
+    case DIAG_VARIABLE_SET: return snprintf(buf, size, "Variable with name " SV_Fmt " already set", SV_Arg(text));
+    case DIAG_STACK_OVERFLOW: return snprintf(buf, size, "Stack overflow calling function " SV_Fmt, SV_Arg(text));
+    case DIAG_BATCH_ASSIGNMENT: return snprintf(buf, size, "Assignment to " SV_Fmt " in batch evaluation", SV_Arg(text));
+    case DIAG_NOTE_PRECEDED_BY: return snprintf(buf, size, "Preceded by " SV_Fmt, SV_Arg(text));
+    case DIAG_NOTE_PRECEDED_BY_OPERATOR: return snprintf(buf, size, "Preceded by this operator " SV_Fmt, SV_Arg(text));
+    case DIAG_NOTE_ASSIGNMENT_POSITION: return snprintf(buf, size, "Assignment is only legal at the beginning of an expression, immediately following a variable, or in a chain of assignments.");
+    case DIAG_NOTE_FUNCTION_ARITY: return snprintf(buf, size, "This function exists with %zu argument(s)", diag->value.count);
+    case DIAG_NOTE_VARIABLE_VALUE: {
+      char value[MATH_FORMAT_BUFFER_SIZE];
+      math_format_double(diag->value.real, value);
+      return snprintf(buf, size, "It has this value: %s", value);
+    }
+    case DIAG_NOTE_CALL_DEPTH: return snprintf(buf, size, "Functions may only be nested %zu levels deep", diag->value.count);
+    case DIAG_NOTE_BATCH_READ_ONLY: return snprintf(buf, size, "Rows are evaluated independently, variables can only be read");
+  }
+  assert(0 && "unreachable");
+}
+
+void diag_print(const Diagnostic *diag, FILE *stream)
+{
+  assert(diag != NULL);
+  char buf[256];
+  char *message = buf;
+  int len = diag_message(diag, buf, sizeof(buf));
+  if (len >= (int) sizeof(buf))
+  {
+    message = malloc(len + 1);
+    assert(message != NULL);
+    diag_message(diag, message, len + 1);
+  }
+  const char *severity = diag_is_note(diag->code) ? "NOTE" : "ERROR";
+  // keep the line in one piece when several threads report errors
+  flockfile(stream);
+  if (diag->loc.file) fprintf(stream, LOC_FMT ": %s: %s\n", LOC_ARG(diag->loc), severity, message);
+  else fprintf(stream, "%s: %s\n", severity, message);
+  funlockfile(stream);
+  if (message != buf) free(message);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdio.h>
+#include "sv.h"
+
+typedef struct {
+  const char *file; // 0-terminated
+  size_t line;
+  size_t col;
+} Location;
+#define LOC_FMT "%s:%zu:%zu"
+#define LOC_ARG(loc) (loc).file, (loc).line, (loc).col
+
+typedef enum {
+  // lexer
+  DIAG_INVALID_LITERAL,     // text: the literal
+  DIAG_LITERAL_OVERFLOW,    // text: the literal
+  DIAG_LITERAL_UNDERFLOW,   // text: the literal
+  DIAG_LITERAL_CONVERSION,  // text: the literal, could not be converted as a whole
+  DIAG_UNRECOGNIZED_TOKEN,  // text: start of the input
+  // parser
+  DIAG_UNEXPECTED_OPERATOR, // text: the operator
+  DIAG_UNEXPECTED_TOKEN,    // text: the token
+  DIAG_UNEXPECTED_END,
+  DIAG_UNEXPECTED_ASSIGNMENT,
+  DIAG_SEPARATOR_OUTSIDE_CALL,
+  DIAG_UNBALANCED_CLOSE,
+  DIAG_UNBALANCED_OPEN,
+  DIAG_INVALID_ARGUMENT_LIST, // text: the token, value.integer: its TokenKind
+  DIAG_FUNCTION_DEFINED,      // text: the function
+  DIAG_ASSIGN_CONSTANT,       // text: the constant
+  DIAG_EXPECTED_OPERATOR,     // text: the token
+  DIAG_MISSING_OPERANDS,      // text: the operator
+  DIAG_UNCONSUMED_INPUT,
+  DIAG_INPUT_EMPTY,
+  // evaluation
+  DIAG_UNRECOGNIZED_VARIABLE, // text: the variable
+  DIAG_UNRECOGNIZED_FUNCTION, // text: the function, value.count: number of arguments of the call
+  DIAG_VARIABLE_SET,          // text: the variable
+  DIAG_STACK_OVERFLOW,        // text: the function called
+  DIAG_BATCH_ASSIGNMENT,      // text: the variable
+  // notes, they follow the error they belong to
+  DIAG_NOTE_PRECEDED_BY,          // text: the preceding token
+  DIAG_NOTE_PRECEDED_BY_OPERATOR, // text: the preceding operator
+  DIAG_NOTE_ASSIGNMENT_POSITION,
+  DIAG_NOTE_FUNCTION_ARITY,       // value.count: number of arguments of an existing overload
+  DIAG_NOTE_VARIABLE_VALUE,       // value.real: the current value
+  DIAG_NOTE_CALL_DEPTH,           // value.count: the maximum depth
+  DIAG_NOTE_BATCH_READ_ONLY,
+} DiagCode;
+
+// A structured error or note. The message is only formatted on request with `diag_message` or `diag_print`.
+// `text` points into the input, it stays valid as long as the input does.
+typedef struct {
+  DiagCode code;
+  Location loc; // `file` is NULL if there is no location
+  String_View text;
+  union {
+    long long integer;
+    double real;
+    size_t count;
+  } value;
+} Diagnostic;
+
+bool diag_is_note(DiagCode code);
+// Formats the message of `diag` (without location and severity) like snprintf
+int diag_message(const Diagnostic *diag, char *buf, size_t size);
+// Prints `diag` as one line, `<location>: ERROR: <message>` or `NOTE` for notes
+void diag_print(const Diagnostic *diag, FILE *stream);
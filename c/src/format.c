@@ -0,0 +1,321 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "format.h"
+#include "format_table.h"
+
+// Shortest round-trip formatting with Ryu (Ulf Adams, PLDI 2018): computes the shortest decimal in the interval of
+// reals that round to the double, with 128-bit multiplications by precomputed powers of 5 (format_table.h).
+
+#define MANTISSA_BITS 52
+#define EXPONENT_BITS 11
+#define BIAS 1023
+
+__extension__ typedef unsigned __int128 MathUint128;
+
+typedef struct {
+  uint64_t mantissa;
+  int32_t exponent; // value = mantissa * 10^exponent
+} MathDecimal;
+
+// Private functions
+
+// ceil(log2(5^e)) for e in [1, 3528], 1 for e = 0
+static inline int32_t math_pow5_bits(int32_t e)
+{
+  return (int32_t) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)) for e in [0, 1650]
+static inline uint32_t math_log10_pow2(int32_t e)
+{
+  return ((uint32_t) e * 78913) >> 18;
+}
+
+// floor(log10(5^e)) for e in [0, 2620]
+static inline uint32_t math_log10_pow5(int32_t e)
+{
+  return ((uint32_t) e * 732923) >> 20;
+}
+
+static inline uint32_t math_pow5_factor(uint64_t value)
+{
+  uint32_t count = 0;
+  while (value % 5 == 0)
+  {
+    value /= 5;
+    ++count;
+  }
+  return count;
+}
+
+static inline bool math_multiple_of_pow5(uint64_t value, uint32_t p)
+{
+  return math_pow5_factor(value) >= p;
+}
+
+static inline bool math_multiple_of_pow2(uint64_t value, uint32_t p)
+{
+  return (value & ((1ull << p) - 1)) == 0;
+}
+
+// (m * mul) >> j, where mul is a 128-bit table entry and j >= 64
+static inline uint64_t math_mul_shift(uint64_t m, const uint64_t *mul, int32_t j)
+{
+  const MathUint128 low = (MathUint128) m * mul[0];
+  const MathUint128 high = (MathUint128) m * mul[1];
+  return (uint64_t) (((low >> 64) + high) >> (j - 64));
+}
+
+// Integers in [1, 2^53) need no search, their digits are exact
+static inline bool math_decimal_small_int(uint64_t ieee_mantissa, uint32_t ieee_exponent, MathDecimal *decimal)
+{
+  const uint64_t m2 = (1ull << MANTISSA_BITS) | ieee_mantissa;
+  const int32_t e2 = (int32_t) ieee_exponent - BIAS - MANTISSA_BITS;
+  if (e2 > 0 || e2 < -52) return false;
+  if ((m2 & ((1ull << -e2) - 1)) != 0) return false;
+  decimal->mantissa = m2 >> -e2;
+  decimal->exponent = 0;
+  while (decimal->mantissa % 10 == 0)
+  {
+    decimal->mantissa /= 10;
+    ++decimal->exponent;
+  }
+  return true;
+}
+
+static MathDecimal math_decimal_shortest(uint64_t ieee_mantissa, uint32_t ieee_exponent)
+{
+  int32_t e2;
+  uint64_t m2;
+  if (ieee_exponent == 0)
+  {
+    // subtract 2 so that the bounds computation has 2 additional bits
+    e2 = 1 - BIAS - MANTISSA_BITS - 2;
+    m2 = ieee_mantissa;
+  }
+  else
+  {
+    e2 = (int32_t) ieee_exponent - BIAS - MANTISSA_BITS - 2;
+    m2 = (1ull << MANTISSA_BITS) | ieee_mantissa;
+  }
+  const bool accept_bounds = (m2 & 1) == 0; // round to even includes the halfway points
+
+  // the interval of reals rounding to the double is [mv - mm, mv + 2] * 2^e2 in units of a quarter ulp
+  const uint64_t mv = 4 * m2;
+  const uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1; // the lower gap is halved at powers of two
+
+  // scale by a power of 10 so the bounds vm, vr, vp are integers of at most 17 digits
+  uint64_t vr, vp, vm;
+  int32_t e10;
+  bool vm_trailing_zeros = false, vr_trailing_zeros = false;
+  if (e2 >= 0)
+  {
+    const uint32_t q = math_log10_pow2(e2) - (e2 > 3);
+    e10 = (int32_t) q;
+    const int32_t k = MATH_FORMAT_POW5_INV_BITCOUNT + math_pow5_bits((int32_t) q) - 1;
+    const int32_t i = -e2 + (int32_t) q + k;
+    vr = math_mul_shift(4 * m2, MATH_FORMAT_POW5_INV_SPLIT[q], i);
+    vp = math_mul_shift(4 * m2 + 2, MATH_FORMAT_POW5_INV_SPLIT[q], i);
+    vm = math_mul_shift(4 * m2 - 1 - mm_shift, MATH_FORMAT_POW5_INV_SPLIT[q], i);
+    if (q <= 21)
+    {
+      // only one of mp, mv, mm can be a multiple of 5
+      if (mv % 5 == 0) vr_trailing_zeros = math_multiple_of_pow5(mv, q);
+      else if (accept_bounds) vm_trailing_zeros = math_multiple_of_pow5(mv - 1 - mm_shift, q);
+      else vp -= math_multiple_of_pow5(mv + 2, q);
+    }
+  }
+  else
+  {
+    const uint32_t q = math_log10_pow5(-e2) - (-e2 > 1);
+    e10 = (int32_t) q + e2;
+    const int32_t i = -e2 - (int32_t) q;
+    const int32_t k = math_pow5_bits(i) - MATH_FORMAT_POW5_BITCOUNT;
+    const int32_t j = (int32_t) q - k;
+    vr = math_mul_shift(4 * m2, MATH_FORMAT_POW5_SPLIT[i], j);
+    vp = math_mul_shift(4 * m2 + 2, MATH_FORMAT_POW5_SPLIT[i], j);
+    vm = math_mul_shift(4 * m2 - 1 - mm_shift, MATH_FORMAT_POW5_SPLIT[i], j);
+    if (q <= 1)
+    {
+      // mv has at least q trailing zero bits, mm and mp only if q is 0
+      vr_trailing_zeros = true;
+      if (accept_bounds) vm_trailing_zeros = mm_shift == 1;
+      else --vp;
+    }
+    else if (q < 63)
+    {
+      vr_trailing_zeros = math_multiple_of_pow2(mv, q);
+    }
+  }
+
+  // remove digits while the interval still contains a number with fewer digits
+  int32_t removed = 0;
+  uint8_t last_removed = 0;
+  uint64_t output;
+  if (vm_trailing_zeros || vr_trailing_zeros)
+  {
+    // rare, the exact halfway and bound cases need to be tracked
+    while (vp / 10 > vm / 10)
+    {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed == 0;
+      last_removed = (uint8_t) (vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    if (vm_trailing_zeros)
+    {
+      while (vm % 10 == 0)
+      {
+        vr_trailing_zeros &= last_removed == 0;
+        last_removed = (uint8_t) (vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        ++removed;
+      }
+    }
+    if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) last_removed = 4; // exactly halfway, round to even
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+  }
+  else
+  {
+    bool round_up = false;
+    if (vp / 100 > vm / 100)
+    {
+      round_up = vr % 100 >= 50;
+      vr /= 100;
+      vp /= 100;
+      vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10)
+    {
+      round_up = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    output = vr + (vr == vm || round_up);
+  }
+  return (MathDecimal) {
+    .mantissa = output,
+    .exponent = e10 + removed,
+  };
+}
+
+static const char MATH_FORMAT_DIGIT_PAIRS[200] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// Writes the digits of `value` to `buf`, returns their count
+static size_t math_format_digits(uint64_t value, char *buf)
+{
+  char tmp[20];
+  size_t i = sizeof(tmp);
+  while (value >= 100)
+  {
+    i -= 2;
+    memcpy(tmp + i, MATH_FORMAT_DIGIT_PAIRS + (value % 100) * 2, 2);
+    value /= 100;
+  }
+  if (value >= 10)
+  {
+    i -= 2;
+    memcpy(tmp + i, MATH_FORMAT_DIGIT_PAIRS + value * 2, 2);
+  }
+  else
+  {
+    tmp[--i] = '0' + value;
+  }
+  memcpy(buf, tmp + i, sizeof(tmp) - i);
+  return sizeof(tmp) - i;
+}
+
+// Implementation
+
+size_t math_format_double(double value, char *buf)
+{
+  assert(buf != NULL);
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const bool sign = bits >> (MANTISSA_BITS + EXPONENT_BITS);
+  const uint64_t ieee_mantissa = bits & ((1ull << MANTISSA_BITS) - 1);
+  const uint32_t ieee_exponent = (bits >> MANTISSA_BITS) & ((1u << EXPONENT_BITS) - 1);
+  size_t len = 0;
+  if (ieee_exponent == (1u << EXPONENT_BITS) - 1 && ieee_mantissa != 0)
+  {
+    memcpy(buf, "nan", 4);
+    return 3;
+  }
+  if (sign) buf[len++] = '-';
+  if (ieee_exponent == (1u << EXPONENT_BITS) - 1)
+  {
+    memcpy(buf + len, "inf", 4);
+    return len + 3;
+  }
+  if (ieee_exponent == 0 && ieee_mantissa == 0)
+  {
+    memcpy(buf + len, "0", 2);
+    return len + 1;
+  }
+  MathDecimal decimal;
+  if (!math_decimal_small_int(ieee_mantissa, ieee_exponent, &decimal))
+  {
+    decimal = math_decimal_shortest(ieee_mantissa, ieee_exponent);
+  }
+
+  char digits[20];
+  const int32_t ndigits = (int32_t) math_format_digits(decimal.mantissa, digits);
+  const int32_t exp10 = decimal.exponent + ndigits - 1; // of the first digit
+  if (exp10 >= -6 && exp10 < 21)
+  {
+    if (decimal.exponent >= 0)
+    {
+      // integer, pad with zeros
+      memcpy(buf + len, digits, ndigits);
+      len += ndigits;
+      memset(buf + len, '0', decimal.exponent);
+      len += decimal.exponent;
+    }
+    else if (exp10 >= 0)
+    {
+      memcpy(buf + len, digits, exp10 + 1);
+      len += exp10 + 1;
+      buf[len++] = '.';
+      memcpy(buf + len, digits + exp10 + 1, ndigits - exp10 - 1);
+      len += ndigits - exp10 - 1;
+    }
+    else
+    {
+      buf[len++] = '0';
+      buf[len++] = '.';
+      memset(buf + len, '0', -exp10 - 1);
+      len += -exp10 - 1;
+      memcpy(buf + len, digits, ndigits);
+      len += ndigits;
+    }
+  }
+  else
+  {
+    buf[len++] = digits[0];
+    if (ndigits > 1)
+    {
+      buf[len++] = '.';
+      memcpy(buf + len, digits + 1, ndigits - 1);
+      len += ndigits - 1;
+    }
+    buf[len++] = 'e';
+    buf[len++] = exp10 < 0 ? '-' : '+';
+    len += math_format_digits(exp10 < 0 ? -exp10 : exp10, buf + len);
+  }
+  assert(len < MATH_FORMAT_BUFFER_SIZE);
+  buf[len] = '\0';
+  return len;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+// Enough for every double, including the sign, exponent and terminating 0
+#define MATH_FORMAT_BUFFER_SIZE 32
+
+// Writes the shortest decimal representation of `value` that reads back as exactly `value` into `buf`,
+// which must hold at least MATH_FORMAT_BUFFER_SIZE bytes. Returns the length, without the terminating 0.
+// Uses plain notation for decimal exponents in [-6, 21), e.g. `0.1` or `123`, and `1.5e+300` otherwise.
+// Special values are written as `nan`, `inf` and `-inf`. Does not depend on the locale.
+size_t math_format_double(double value, char *buf);
@@ -0,0 +1,377 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "jit.h"
+#include "rpn.h"
+#include "stb_ds.h"
+
+#if MATH_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Code is generated for SSE2, which every x86-64 has. Operations are done one at a time in the same order as
+// the interpreter, pow, fma and builtins call the same libm functions, polynomials repeat the steps of
+// `math_poly`, and integer powers multiply in the order of `math_powi`, so results are bit-identical.
+// The top of the operand stack is kept in xmm0, the rest in memory at rbx (the `stack` argument).
+// Global variables are read from r12 (the `values` argument).
+
+// Upper bound of code generated for one instruction
+#define MATH_JIT_MAX_INSTR_SIZE 64
+// Upper bound of code generated for each coefficient of a polynomial
+#define MATH_JIT_POLY_COEF_SIZE 32
+
+typedef struct {
+  uint8_t *code;
+  size_t size;
+} MathJitBuffer;
+
+static void math_jit_bytes(MathJitBuffer *buf, const uint8_t *bytes, size_t count)
+{
+  memcpy(buf->code + buf->size, bytes, count);
+  buf->size += count;
+}
+#define EMIT(buf, ...) do {                           \
+  const uint8_t _bytes[] = { __VA_ARGS__ };           \
+  math_jit_bytes((buf), _bytes, sizeof(_bytes));      \
+} while (0)
+
+static void math_jit_u32(MathJitBuffer *buf, uint32_t value)
+{
+  math_jit_bytes(buf, (const uint8_t *) &value, sizeof(value));
+}
+
+static void math_jit_u64(MathJitBuffer *buf, uint64_t value)
+{
+  math_jit_bytes(buf, (const uint8_t *) &value, sizeof(value));
+}
+
+// rax = value
+static void math_jit_mov_rax(MathJitBuffer *buf, uint64_t value)
+{
+  EMIT(buf, 0x48, 0xB8); // movabs rax, imm64
+  math_jit_u64(buf, value);
+}
+
+// Stack slot `index` is at [rbx + 8 * index]
+static void math_jit_spill(MathJitBuffer *buf, size_t index)
+{
+  EMIT(buf, 0xF2, 0x0F, 0x11, 0x83); // movsd [rbx + disp32], xmm0
+  math_jit_u32(buf, index * sizeof(double));
+}
+
+static void math_jit_reload(MathJitBuffer *buf, size_t index, uint8_t xmm)
+{
+  assert(xmm < 8);
+  EMIT(buf, 0xF2, 0x0F, 0x10, 0x83 | xmm << 3); // movsd xmmN, [rbx + disp32]
+  math_jit_u32(buf, index * sizeof(double));
+}
+
+static void math_jit_call(MathJitBuffer *buf, uintptr_t fn)
+{
+  math_jit_mov_rax(buf, fn);
+  EMIT(buf, 0xFF, 0xD0); // call rax
+}
+
+// Scalar SSE2 instruction `prefix 0F opcode` on registers, any of xmm0-xmm15
+static void math_jit_sse(MathJitBuffer *buf, uint8_t prefix, uint8_t opcode, uint8_t dst, uint8_t src)
+{
+  uint8_t rex = 0x40 | (dst >> 3) << 2 | src >> 3;
+  assert(dst < 16 && src < 16);
+  EMIT(buf, prefix);
+  if (rex != 0x40) EMIT(buf, rex);
+  EMIT(buf, 0x0F, opcode, 0xC0 | (dst & 7) << 3 | (src & 7));
+}
+#define MOVAPD 0x66, 0x28
+#define ADDSD 0xF2, 0x58
+#define MULSD 0xF2, 0x59
+
+// xmmN = value
+static void math_jit_const(MathJitBuffer *buf, double value, uint8_t xmm)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  math_jit_mov_rax(buf, bits);
+  EMIT(buf, 0x66, 0x48 | (xmm >> 3) << 2, 0x0F, 0x6E, 0xC0 | (xmm & 7) << 3); // movq xmmN, rax
+}
+
+// xmm0 = math_poly(coefs, degree, xmm0), the same operations in registers: x and its squares in xmm15,
+// the coefficients of each step of Estrin's scheme in xmm1 on. Parts that are all 0 are skipped the same way.
+static void math_jit_poly(MathJitBuffer *buf, const double *coefs, size_t degree)
+{
+  const uint8_t x = 15, tmp = 14;
+  bool zero[MATH_EXPR_POLY_LIMIT / 2 + 1];
+  size_t count = 0;
+  assert(degree <= MATH_EXPR_POLY_LIMIT && 1 + MATH_EXPR_POLY_LIMIT / 2 < tmp);
+  math_jit_sse(buf, MOVAPD, x, 0);
+  for (size_t i = 0; i < degree; i += 2, ++count)
+  {
+    zero[count] = coefs[i] == 0 && coefs[i + 1] == 0;
+    if (coefs[i + 1] == 0)
+    {
+      math_jit_const(buf, coefs[i], 1 + count);
+      continue;
+    }
+    math_jit_const(buf, coefs[i + 1], 1 + count);
+    math_jit_sse(buf, MULSD, 1 + count, x);
+    math_jit_const(buf, coefs[i], tmp);
+    math_jit_sse(buf, ADDSD, 1 + count, tmp);
+  }
+  if (degree % 2 == 0)
+  {
+    zero[count] = coefs[degree] == 0;
+    math_jit_const(buf, coefs[degree], 1 + count++);
+  }
+  while (count > 1)
+  {
+    size_t m = 0;
+    math_jit_sse(buf, MULSD, x, x);
+    for (size_t i = 0; i + 1 < count; i += 2, ++m)
+    {
+      if (!zero[i + 1])
+      {
+        math_jit_sse(buf, MULSD, 1 + i + 1, x);
+        math_jit_sse(buf, ADDSD, 1 + i, 1 + i + 1);
+      }
+      if (m != i) math_jit_sse(buf, MOVAPD, 1 + m, 1 + i);
+      zero[m] = zero[i] && zero[i + 1];
+    }
+    if (count % 2 == 1)
+    {
+      zero[m] = zero[count - 1];
+      math_jit_sse(buf, MOVAPD, 1 + m++, count);
+    }
+    count = m;
+  }
+  math_jit_sse(buf, MOVAPD, 0, 1);
+}
+
+// xmm0 = xmm0^n, the same multiplications as `math_powi`: xmm1 holds the squares, xmm2 the result
+static void math_jit_powi(MathJitBuffer *buf, int32_t n)
+{
+  uint32_t m = n < 0 ? -(uint32_t) n : (uint32_t) n;
+  bool one = true; // the result is still 1, multiplying by it is a copy
+  EMIT(buf, 0x66, 0x0F, 0x28, 0xC8); // movapd xmm1, xmm0
+  while (m > 0)
+  {
+    if ((m & 1) && one) EMIT(buf, 0x66, 0x0F, 0x28, 0xD1); // movapd xmm2, xmm1
+    else if (m & 1) EMIT(buf, 0xF2, 0x0F, 0x59, 0xD1);     // mulsd xmm2, xmm1
+    one = one && !(m & 1);
+    m >>= 1;
+    if (m > 0) EMIT(buf, 0xF2, 0x0F, 0x59, 0xC9); // mulsd xmm1, xmm1
+  }
+  if (one || n < 0)
+  {
+    uint64_t bits;
+    double value = 1.0;
+    memcpy(&bits, &value, sizeof(bits));
+    math_jit_mov_rax(buf, bits);
+  }
+  if (one) EMIT(buf, 0x66, 0x48, 0x0F, 0x6E, 0xD0); // movq xmm2, rax
+  if (n < 0)
+  {
+    EMIT(buf, 0x66, 0x48, 0x0F, 0x6E, 0xC0); // movq xmm0, rax
+    EMIT(buf, 0xF2, 0x0F, 0x5E, 0xC2);       // divsd xmm0, xmm2
+  }
+  else
+  {
+    EMIT(buf, 0x66, 0x0F, 0x28, 0xC2); // movapd xmm0, xmm2
+  }
+}
+
+// Only straight-line arithmetic is compiled, anything with effects stays in the interpreter.
+// Shared subexpressions are supported as long as the last statement saves them itself.
+static bool math_jit_supported(const MathExpr *expr)
+{
+  size_t size = arrlenu(expr->code), count = arrlenu(expr->statements);
+  size_t first = count > 1 ? expr->statements[count - 2].end : 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    switch ((MathOpcode) expr->code[i].op) {
+      case BC_TEMP: {
+        if (i < first) break;
+        size_t pc = i;
+        while (pc > first && (expr->code[pc - 1].op != BC_SAVE || expr->code[pc - 1].arg != expr->code[i].arg)) --pc;
+        if (pc == first) return false;
+      } break;
+      case BC_SAVE:
+      case BC_CONST:
+      case BC_LOAD:
+      case BC_NEG:
+      case BC_ADD:
+      case BC_SUB:
+      case BC_MUL:
+      case BC_DIV:
+      case BC_POW:
+      case BC_CALL1:
+      case BC_CALL2:
+      case BC_POWI:
+      case BC_FMA:
+      case BC_POLY:
+        continue;
+      case BC_ARG:
+      case BC_CALL:
+      case BC_CALLU:
+      case BC_STORE:
+      case BC_COUNT:
+        return false;
+    }
+  }
+  return arrlenu(expr->statements) > 0 && expr->max_stack <= UINT32_MAX / sizeof(double);
+}
+
+static void math_jit_emit(MathJitBuffer *buf, const MathExpr *expr, size_t first, size_t last)
+{
+  size_t depth = 0; // values on the stack, the top one is in xmm0
+  size_t temps = expr->max_stack - expr->ntemps; // temporaries are kept above the deepest value
+  // push rbx; push r12; sub rsp, 8 (align for calls); mov rbx, rsi; mov r12, rdi
+  EMIT(buf, 0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x08, 0x48, 0x89, 0xF3, 0x49, 0x89, 0xFC);
+  for (size_t pc = first; pc < last; ++pc)
+  {
+    const MathInstr instr = expr->code[pc];
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST: {
+        uint64_t bits;
+        memcpy(&bits, &expr->consts[instr.arg], sizeof(bits));
+        if (depth > 0) math_jit_spill(buf, depth - 1);
+        math_jit_mov_rax(buf, bits);
+        EMIT(buf, 0x66, 0x48, 0x0F, 0x6E, 0xC0); // movq xmm0, rax
+        ++depth;
+      } break;
+      case BC_LOAD:
+        if (depth > 0) math_jit_spill(buf, depth - 1);
+        assert(instr.arg <= UINT32_MAX / sizeof(double));
+        EMIT(buf, 0xF2, 0x41, 0x0F, 0x10, 0x84, 0x24); // movsd xmm0, [r12 + disp32]
+        math_jit_u32(buf, instr.arg * sizeof(double));
+        ++depth;
+        break;
+      case BC_NEG:
+        math_jit_mov_rax(buf, 0x8000000000000000u);
+        EMIT(buf, 0x66, 0x48, 0x0F, 0x6E, 0xC8); // movq xmm1, rax
+        EMIT(buf, 0x66, 0x0F, 0x57, 0xC1);       // xorpd xmm0, xmm1
+        break;
+      case BC_ADD:
+      case BC_SUB:
+      case BC_MUL:
+      case BC_DIV: {
+        static const uint8_t opcodes[] = {
+          [BC_ADD] = 0x58,
+          [BC_SUB] = 0x5C,
+          [BC_MUL] = 0x59,
+          [BC_DIV] = 0x5E,
+        };
+        // keep the operand order: xmm1 = left op right
+        math_jit_reload(buf, depth - 2, 1);
+        EMIT(buf, 0xF2, 0x0F, opcodes[instr.op], 0xC8); // opsd xmm1, xmm0
+        EMIT(buf, 0x66, 0x0F, 0x28, 0xC1);              // movapd xmm0, xmm1
+        --depth;
+      } break;
+      case BC_POW:
+      case BC_CALL2:
+        EMIT(buf, 0x66, 0x0F, 0x28, 0xC8); // movapd xmm1, xmm0
+        math_jit_reload(buf, depth - 2, 0);
+        math_jit_call(buf, instr.op == BC_POW ? (uintptr_t) pow : (uintptr_t) expr->builtins[instr.arg].as.binary);
+        --depth;
+        break;
+      case BC_CALL1:
+        math_jit_call(buf, (uintptr_t) expr->builtins[instr.arg].as.unary);
+        break;
+      case BC_POWI:
+        math_jit_powi(buf, (int32_t) instr.arg);
+        break;
+      case BC_POLY:
+        math_jit_poly(buf, expr->consts + instr.arg, instr.nargs);
+        break;
+      case BC_FMA:
+        // fma(xmm0, xmm1, xmm2), the addend is either the top or the bottom of the three values
+        if (instr.arg == 1)
+        {
+          EMIT(buf, 0x66, 0x0F, 0x28, 0xC8); // movapd xmm1, xmm0
+          math_jit_reload(buf, depth - 2, 0);
+          math_jit_reload(buf, depth - 3, 2);
+        }
+        else
+        {
+          EMIT(buf, 0x66, 0x0F, 0x28, 0xD0); // movapd xmm2, xmm0
+          math_jit_reload(buf, depth - 2, 1);
+          math_jit_reload(buf, depth - 3, 0);
+        }
+        math_jit_call(buf, (uintptr_t) fma);
+        depth -= 2;
+        break;
+      case BC_SAVE:
+        math_jit_spill(buf, temps + instr.arg);
+        break;
+      case BC_TEMP:
+        if (depth > 0) math_jit_spill(buf, depth - 1);
+        math_jit_reload(buf, temps + instr.arg, 0);
+        ++depth;
+        break;
+      case BC_ARG:
+      case BC_CALL:
+      case BC_CALLU:
+      case BC_STORE:
+      case BC_COUNT:
+        assert(0 && "unsupported instruction");
+    }
+  }
+  assert(depth == 1);
+  // add rsp, 8; pop r12; pop rbx; ret
+  EMIT(buf, 0x48, 0x83, 0xC4, 0x08, 0x41, 0x5C, 0x5B, 0xC3);
+}
+
+bool math_jit_compile(MathExpr *expr)
+{
+  assert(expr != NULL);
+  assert(expr->jit.fn == NULL && "already compiled");
+  if (!math_jit_supported(expr)) return false;
+  size_t count = arrlenu(expr->statements);
+  size_t first = count > 1 ? expr->statements[count - 2].end : 0;
+  size_t last = expr->statements[count - 1].end;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (last - first + 2) * MATH_JIT_MAX_INSTR_SIZE;
+  for (size_t pc = first; pc < last; ++pc)
+  {
+    if (expr->code[pc].op == BC_POLY) size += (expr->code[pc].nargs + 1) * MATH_JIT_POLY_COEF_SIZE;
+  }
+  size = (size + page - 1) / page * page;
+  void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) return false;
+  MathJitBuffer buf = {
+    .code = code,
+  };
+  math_jit_emit(&buf, expr, first, last);
+  assert(buf.size <= size);
+  if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(code, size);
+    return false;
+  }
+  expr->jit = (MathJitCode) {
+    .fn = (MathJitFunction) (uintptr_t) code,
+    .code = code,
+    .size = size,
+  };
+  return true;
+}
+
+void math_jit_free(MathJitCode *jit)
+{
+  assert(jit != NULL);
+  if (jit->code) munmap(jit->code, jit->size);
+  *jit = (MathJitCode) {0};
+}
+
+#else
+
+bool math_jit_compile(MathExpr *expr)
+{
+  (void) expr;
+  return false;
+}
+
+void math_jit_free(MathJitCode *jit)
+{
+  (void) jit;
+}
+
+#endif // MATH_JIT_SUPPORTED
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Native code for the last statement of an expression.
+// Reads global variables from `values` (indexed by slot) and keeps operands in `stack`, which needs `max_stack` slots.
+typedef double (*MathJitFunction)(const double *values, double *stack);
+
+typedef struct {
+  MathJitFunction fn; // NULL if the expression is not compiled
+  void *code;
+  size_t size;
+} MathJitCode;
+
+// The JIT is only available on x86-64 with the System V calling convention, elsewhere nothing is compiled.
+#if defined(__x86_64__) && defined(__unix__)
+#define MATH_JIT_SUPPORTED 1
+#else
+#define MATH_JIT_SUPPORTED 0
+#endif
@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MATH_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define MATH_KERNELS_X86 0
+#endif
+
+// Private functions
+
+static void math_kernel_neg_scalar(double *a, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) a[i] = -a[i];
+}
+
+#define BINARY(_name, _op)                                                        \
+  static void math_kernel_ ## _name ## _scalar(double *left, const double *right, size_t n) \
+  {                                                                               \
+    for (size_t i = 0; i < n; ++i) left[i] = left[i] _op right[i];                \
+  }
+BINARY(add, +)
+BINARY(sub, -)
+BINARY(mul, *)
+BINARY(div, /)
+#undef BINARY
+
+static const MathKernels MATH_KERNELS_SCALAR_IMPL = {
+  .name = "scalar",
+  .neg = math_kernel_neg_scalar,
+  .add = math_kernel_add_scalar,
+  .sub = math_kernel_sub_scalar,
+  .mul = math_kernel_mul_scalar,
+  .div = math_kernel_div_scalar,
+};
+
+#if MATH_KERNELS_X86
+// The wide loops leave the remaining n % width values to the scalar kernels
+
+__attribute__((target("avx2")))
+static void math_kernel_neg_avx2(double *a, size_t n)
+{
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) _mm256_storeu_pd(a + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+  math_kernel_neg_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void math_kernel_neg_avx512(double *a, size_t n)
+{
+  const __m512i sign = _mm512_set1_epi64(INT64_MIN);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m512i bits = _mm512_castpd_si512(_mm512_loadu_pd(a + i));
+    _mm512_storeu_pd(a + i, _mm512_castsi512_pd(_mm512_xor_si512(bits, sign)));
+  }
+  math_kernel_neg_scalar(a + i, n - i);
+}
+
+#define BINARY(_name)                                                                   \
+  __attribute__((target("avx2")))                                                       \
+  static void math_kernel_ ## _name ## _avx2(double *left, const double *right, size_t n) \
+  {                                                                                     \
+    size_t i = 0;                                                                       \
+    for (; i + 4 <= n; i += 4)                                                          \
+    {                                                                                   \
+      _mm256_storeu_pd(left + i, _mm256_ ## _name ## _pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i))); \
+    }                                                                                   \
+    math_kernel_ ## _name ## _scalar(left + i, right + i, n - i);                      \
+  }                                                                                     \
+  __attribute__((target("avx512f")))                                                    \
+  static void math_kernel_ ## _name ## _avx512(double *left, const double *right, size_t n) \
+  {                                                                                     \
+    size_t i = 0;                                                                       \
+    for (; i + 8 <= n; i += 8)                                                          \
+    {                                                                                   \
+      _mm512_storeu_pd(left + i, _mm512_ ## _name ## _pd(_mm512_loadu_pd(left + i), _mm512_loadu_pd(right + i))); \
+    }                                                                                   \
+    math_kernel_ ## _name ## _scalar(left + i, right + i, n - i);                      \
+  }
+BINARY(add)
+BINARY(sub)
+BINARY(mul)
+BINARY(div)
+#undef BINARY
+
+static const MathKernels MATH_KERNELS_AVX2_IMPL = {
+  .name = "avx2",
+  .neg = math_kernel_neg_avx2,
+  .add = math_kernel_add_avx2,
+  .sub = math_kernel_sub_avx2,
+  .mul = math_kernel_mul_avx2,
+  .div = math_kernel_div_avx2,
+};
+
+static const MathKernels MATH_KERNELS_AVX512_IMPL = {
+  .name = "avx512",
+  .neg = math_kernel_neg_avx512,
+  .add = math_kernel_add_avx512,
+  .sub = math_kernel_sub_avx512,
+  .mul = math_kernel_mul_avx512,
+  .div = math_kernel_div_avx512,
+};
+#endif // MATH_KERNELS_X86
+
+// Implementation
+
+const MathKernels *math_kernels_get(MathKernelLevel level)
+{
+  switch (level) {
+    case MATH_KERNELS_SCALAR:
+      return &MATH_KERNELS_SCALAR_IMPL;
+#if MATH_KERNELS_X86
+    case MATH_KERNELS_AVX2:
+      return __builtin_cpu_supports("avx2") ? &MATH_KERNELS_AVX2_IMPL : NULL;
+    case MATH_KERNELS_AVX512:
+      return __builtin_cpu_supports("avx512f") ? &MATH_KERNELS_AVX512_IMPL : NULL;
+#else
+    case MATH_KERNELS_AVX2:
+    case MATH_KERNELS_AVX512:
+      return NULL;
+#endif
+    case MATH_KERNELS_COUNT:
+      break;
+  }
+  assert(0 && "unreachable");
+}
+
+const MathKernels *math_kernels_best(void)
+{
+  for (int level = MATH_KERNELS_COUNT - 1; level > MATH_KERNELS_SCALAR; --level)
+  {
+    const MathKernels *kernels = math_kernels_get(level);
+    if (kernels) return kernels;
+  }
+  return math_kernels_get(MATH_KERNELS_SCALAR);
+}
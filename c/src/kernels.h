@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+// Kernels of the arithmetic opcodes over vectors of `n` values, used by batch evaluation.
+// All levels compute the same IEEE operations, so results do not depend on the level used.
+typedef void (*MathKernelUnary)(double *a, size_t n);
+typedef void (*MathKernelBinary)(double *left, const double *right, size_t n); // left = left op right
+
+typedef struct {
+  const char *name;
+  MathKernelUnary neg;
+  MathKernelBinary add;
+  MathKernelBinary sub;
+  MathKernelBinary mul;
+  MathKernelBinary div;
+} MathKernels;
+
+typedef enum {
+  MATH_KERNELS_SCALAR,
+  MATH_KERNELS_AVX2,
+  MATH_KERNELS_AVX512,
+  MATH_KERNELS_COUNT,
+} MathKernelLevel;
+
+// Returns the kernels of `level`, or NULL if they are not supported by the CPU (checked with CPUID).
+const MathKernels *math_kernels_get(MathKernelLevel level);
+// Returns the widest kernels supported by the CPU.
+const MathKernels *math_kernels_best(void);
@@ -1,129 +1,235 @@
 #include <assert.h>
 #include <inttypes.h>
-#include <math.h>
 #include <stdio.h>
 #include <stdint.h>
-#include <stdio.h>
-#include <limits.h>
-#include <ctype.h>
-#include <stdarg.h>
-#include <errno.h>
 
 #include "lexer.h"
+#include "number.h"
 #define SV_IMPLEMENTATION
 #include "sv.h"
 
-// Helpers
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LEXER_NO_SIMD)
+#define LEXER_SSE2 1
+#include <emmintrin.h>
+#else
+#define LEXER_SSE2 0
+#endif
 
-static bool isspace_except_newline(char c)
-{
-  return c != '\n' && isspace(c);
-}
+// Character classes, a character may be in several
+enum {
+  LEXER_SPACE = 1,    // whitespace except newline
+  LEXER_NEWLINE = 2,
+  LEXER_DIGIT = 4,
+  LEXER_ALPHA = 8,
+  LEXER_IDENT = 16,   // letters, digits and _
+  LEXER_HEX = 32,     // 0-9 a-f A-F
+};
+
+#define S LEXER_SPACE
+#define N LEXER_NEWLINE
+#define D (LEXER_DIGIT | LEXER_IDENT | LEXER_HEX)
+#define A (LEXER_ALPHA | LEXER_IDENT)
+#define H (LEXER_ALPHA | LEXER_IDENT | LEXER_HEX)
+#define U LEXER_IDENT
+// Classes of each character as in the "C" locale of <ctype.h>, characters from 128 up are in none
+static const uint8_t LEXER_CLASSES[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, S, N, S, S, S, 0, 0, // \t \n \v \f \r
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // space
+  D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0, // 0-9
+  0, H, H, H, H, H, H, A, A, A, A, A, A, A, A, A, // A-O
+  A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, U, // P-Z _
+  0, H, H, H, H, H, H, A, A, A, A, A, A, A, A, A, // a-o
+  A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, 0, // p-z
+};
+#undef S
+#undef N
+#undef D
+#undef A
+#undef H
+#undef U
+
+// Helpers
 
-static bool isdigit_(char c)
+static inline bool lexer_is(char c, uint8_t class)
 {
-  return isdigit(c);
+  return LEXER_CLASSES[(unsigned char) c] & class;
 }
 
 static bool not_isspace(char c)
 {
-  return !isspace(c);
+  return !lexer_is(c, LEXER_SPACE | LEXER_NEWLINE);
 }
 
-static bool isident(char c)
+#if LEXER_SSE2
+// Bytes of `c` in lo..lo+n-1, compared unsigned
+static inline __m128i lexer_in_range(__m128i c, char lo, char n)
 {
-  return isalnum(c) || c == '_';
+  __m128i d = _mm_sub_epi8(c, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(n - 1)), d);
 }
 
-static LexerError sv_parse_double(Location loc, String_View sv, double *result)
+// Bit i is set if character i of the 16 at `s` is in `class`.
+// Inlined with a constant `class`, so only the comparisons it needs remain.
+static inline __attribute__((always_inline)) unsigned lexer_mask16(const char *s, uint8_t class)
 {
-  char *end;
-  errno = 0;
-  *result = strtod(sv.data, &end);
-  if (end > sv.data + sv.count)
+  const __m128i c = _mm_loadu_si128((const __m128i *) s);
+  __m128i in = _mm_setzero_si128();
+  if (class & LEXER_SPACE)
   {
-    lexer_dump_err(loc, stderr, "(internal) Conversion of " SV_Fmt " consumed more tokens than expected, result is %lf", SV_Arg(sv), *result);
-    return LERR_INVALID_LITERAL;
+    // \t \v \f \r are 9 and 11 to 13
+    __m128i control = _mm_andnot_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), lexer_in_range(c, '\t', 5));
+    in = _mm_or_si128(in, _mm_or_si128(control, _mm_cmpeq_epi8(c, _mm_set1_epi8(' '))));
   }
-  if ((*result == HUGE_VAL || *result == -HUGE_VAL) && errno == ERANGE)
-  {
-    lexer_dump_err(loc, stderr, "Overflow caused by conversion of literal " SV_Fmt, SV_Arg(sv));
-    return LERR_INVALID_LITERAL;
-  }
-  if (errno == ERANGE)
-  {
-    lexer_dump_err(loc, stderr, "Underflow caused by conversion of literal " SV_Fmt, SV_Arg(sv));
-    return LERR_INVALID_LITERAL;
-  }
-  if (end < sv.data + sv.count)
+  if (class & LEXER_NEWLINE) in = _mm_or_si128(in, _mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+  if (class & (LEXER_DIGIT | LEXER_IDENT | LEXER_HEX)) in = _mm_or_si128(in, lexer_in_range(c, '0', 10));
+  if (class & (LEXER_ALPHA | LEXER_IDENT)) in = _mm_or_si128(in, lexer_in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 26));
+  else if (class & LEXER_HEX) in = _mm_or_si128(in, lexer_in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 6));
+  if (class & LEXER_IDENT) in = _mm_or_si128(in, _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+  return _mm_movemask_epi8(in);
+}
+#endif
+
+// Most runs are short, their first characters are looked up one by one before scanning 16 at a time
+#define LEXER_SHORT_RUN 4
+
+// Length of the run of characters in `class` at the start of `sv`
+static inline __attribute__((always_inline)) size_t lexer_span(String_View sv, uint8_t class)
+{
+  size_t i = 0;
+  while (i < LEXER_SHORT_RUN && i < sv.count && lexer_is(sv.data[i], class)) ++i;
+  if (i < LEXER_SHORT_RUN) return i;
+#if LEXER_SSE2
+  // whole blocks only, the content does not have to be terminated
+  for (; i + 16 <= sv.count; i += 16)
   {
-    lexer_dump_err(loc, stderr, "(internal) Conversion of " SV_Fmt " consumed less tokens than expected, result is %lf", SV_Arg(sv), *result);
-    return LERR_INVALID_LITERAL;
+    unsigned mask = lexer_mask16(sv.data + i, class);
+    if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
   }
-  return LERR_OK;
+#endif
+  while (i < sv.count && lexer_is(sv.data[i], class)) ++i;
+  return i;
 }
 
-static LexerError sv_parse_longlong(Location loc, String_View sv, int base, long long *result)
+// Skips whitespace from `i` up to `end`, counting the newlines
+static inline size_t lexer_skip_space(String_View sv, size_t i, size_t end, size_t *newlines, size_t *last_newline)
 {
-  char *end;
-  errno = 0;
-  *result = strtoll(sv.data, &end, base);
-  if (end > sv.data + sv.count)
+  for (; i < end && lexer_is(sv.data[i], LEXER_SPACE | LEXER_NEWLINE); ++i)
   {
-    lexer_dump_err(loc, stderr, "(internal) Conversion of " SV_Fmt " consumed more tokens than expected, result is %lld", SV_Arg(sv), *result);
-    return LERR_INVALID_LITERAL;
+    if (sv.data[i] != '\n') continue;
+    *newlines += 1;
+    *last_newline = i;
   }
-  if (*result == LLONG_MAX && errno == ERANGE)
+  return i;
+}
+
+// Records the details of an error for the caller, see `Lexer.error`
+static LexerError lexer_error(Lexer *lexer, LexerError err, DiagCode code, String_View text)
+{
+  lexer->error = (Diagnostic) {
+    .code = code,
+    .loc = lexer->loc,
+    .text = text,
+  };
+  return err;
+}
+
+// Private functions
+
+// Skips whitespace and newlines, the line of `loc` advances by the newlines skipped
+static void lexer_remove_whitespace(Lexer *lexer)
+{
+  const String_View sv = lexer->content;
+  size_t newlines = 0, last_newline = 0;
+  size_t i = lexer_skip_space(sv, 0, sv.count < LEXER_SHORT_RUN ? sv.count : LEXER_SHORT_RUN, &newlines, &last_newline);
+  if (i == LEXER_SHORT_RUN)
   {
-    lexer_dump_err(loc, stderr, "Overflow caused by conversion of literal " SV_Fmt, SV_Arg(sv));
-    return LERR_INVALID_LITERAL;
+#if LEXER_SSE2
+    for (; i + 16 <= sv.count; i += 16)
+    {
+      unsigned space = lexer_mask16(sv.data + i, LEXER_SPACE | LEXER_NEWLINE);
+      unsigned run = space == 0xFFFF ? 16 : __builtin_ctz(~space);
+      unsigned nl = lexer_mask16(sv.data + i, LEXER_NEWLINE) & ((1u << run) - 1);
+      if (nl != 0)
+      {
+        newlines += __builtin_popcount(nl);
+        last_newline = i + 31 - __builtin_clz(nl);
+      }
+      if (run < 16)
+      {
+        i += run;
+        goto done;
+      }
+    }
+#endif
+    i = lexer_skip_space(sv, i, sv.count, &newlines, &last_newline);
   }
-  if (*result == LLONG_MIN && errno == ERANGE)
+#if LEXER_SSE2
+done:
+#endif
+  if (newlines > 0)
   {
-    lexer_dump_err(loc, stderr, "Underflow caused by conversion of literal " SV_Fmt, SV_Arg(sv));
-    return LERR_INVALID_LITERAL;
+    lexer->loc.line += newlines;
+    lexer->loc.col = i - last_newline - 1;
   }
-  if (end < sv.data + sv.count)
+  else
   {
-    lexer_dump_err(loc, stderr, "(internal) Conversion of " SV_Fmt " consumed less tokens than expected, result is %lld", SV_Arg(sv), *result);
-    return LERR_INVALID_LITERAL;
+    lexer->loc.col += i;
   }
-  return LERR_OK;
+  sv_chop_left(&lexer->content, i);
 }
 
-// Private functions
-
-static void lexer_remove_whitespace(Lexer *lexer)
+// Length of the number literal at the start of `sv`, see number.h. An `e` not followed by exponent digits is left
+// for the next token, `2e` is 2 times e.
+static size_t lexer_literal_length(String_View sv, bool *real)
 {
-  String_View removed;
-  do {
-    removed = sv_chop_left_while(&lexer->content, isspace_except_newline);
-    lexer->loc.col += removed.count;
-    if (lexer->content.count > 0 && lexer->content.data[0] == '\n')
+  const char *s = sv.data;
+  if (sv.count > 2 && s[0] == '0' && (s[1] | 0x20) == 'x' && lexer_is(s[2], LEXER_HEX))
+  {
+    *real = false;
+    return 2 + lexer_span(sv_from_parts(s + 2, sv.count - 2), LEXER_HEX);
+  }
+  size_t len = lexer_span(sv, LEXER_DIGIT);
+  *real = len < sv.count && s[len] == '.';
+  if (*real) len += 1 + lexer_span(sv_from_parts(s + len + 1, sv.count - len - 1), LEXER_DIGIT);
+  if (len == 1 && *real) return len; // . only
+  if (len + 1 < sv.count && (s[len] | 0x20) == 'e')
+  {
+    size_t digits = len + 1 + (s[len + 1] == '+' || s[len + 1] == '-');
+    if (digits < sv.count && lexer_is(s[digits], LEXER_DIGIT))
     {
-      removed = sv_chop_left(&lexer->content, 1);
-      lexer->loc.line += 1;
-      lexer->loc.col = 0;
+      *real = true;
+      len = digits + lexer_span(sv_from_parts(s + digits, sv.count - digits), LEXER_DIGIT);
     }
-  } while (removed.count > 0);
+  }
+  return len;
 }
 
-// TODO: other literal bases (hex, oct?), scientific notation
 static LexerError lexer_consume_digit(Lexer *lexer, Token *token)
 {
-  String_View dig = sv_chop_left_while(&lexer->content, isdigit_);
-  if (lexer->content.count > 0 && lexer->content.data[0] == '.')
+  bool real;
+  String_View dig = sv_chop_left(&lexer->content, lexer_literal_length(lexer->content, &real));
+  if (dig.count == 1 && dig.data[0] == '.') // . only
+  {
+    return lexer_error(lexer, LERR_INVALID_LITERAL, DIAG_INVALID_LITERAL, dig);
+  }
+  int64_t integer = 0;
+  if (!real)
+  {
+    MathNumberError err = math_number_parse_int64(dig.data, dig.count, &integer);
+    // too large for an integer, keep it as a real like any result that overflows
+    if (err == MATH_NUMBER_OVERFLOW) real = true;
+    else if (err != MATH_NUMBER_OK) return lexer_error(lexer, LERR_INVALID_LITERAL, DIAG_LITERAL_CONVERSION, dig);
+  }
+  if (real)
   {
-    sv_chop_left(&lexer->content, 1);
-    dig.count += 1;
-    dig.count += sv_chop_left_while(&lexer->content, isdigit_).count;
-    if (dig.count == 1) // . only
-    {
-      lexer_dump_err(lexer->loc, stderr, "Invalid number literal " SV_Fmt, SV_Arg(dig));
-      return LERR_INVALID_LITERAL;
-    }
     double value;
-    LEXER_TRY(sv_parse_double(lexer->loc, dig, &value));
+    switch (math_number_parse_double(dig.data, dig.count, &value)) {
+      case MATH_NUMBER_OK: break;
+      case MATH_NUMBER_OVERFLOW: return lexer_error(lexer, LERR_INVALID_LITERAL, DIAG_LITERAL_OVERFLOW, dig);
+      case MATH_NUMBER_UNDERFLOW: return lexer_error(lexer, LERR_INVALID_LITERAL, DIAG_LITERAL_UNDERFLOW, dig);
+      default: return lexer_error(lexer, LERR_INVALID_LITERAL, DIAG_LITERAL_CONVERSION, dig);
+    }
     *token = (Token) {
       .loc = lexer->loc,
       .content = dig,
@@ -137,15 +243,13 @@ static LexerError lexer_consume_digit(Lexer *lexer, Token *token)
   }
   else
   {
-    long long value;
-    LEXER_TRY(sv_parse_longlong(lexer->loc, dig, 10, &value));
     *token = (Token) {
       .loc = lexer->loc,
       .content = dig,
       .kind = TK_INTEGER,
       .as = {
         .integer = {
-          .value = value,
+          .value = integer,
         }
       }
     };
@@ -191,8 +295,8 @@ LexerError lexer_next_token(Lexer *lexer, Token *token)
   if (lexer->content.count == 0) return LERR_EOF;
 
   char c = lexer->content.data[0];
-  assert(!isspace(c) && "lexer_remove_whitespace did not do its job");
-  if (isdigit(c) || c == '.') // allow .5
+  assert(not_isspace(c) && "lexer_remove_whitespace did not do its job");
+  if (lexer_is(c, LEXER_DIGIT) || c == '.') // allow .5
   {
     return lexer_consume_digit(lexer, token);
   }
@@ -235,9 +339,9 @@ LexerError lexer_next_token(Lexer *lexer, Token *token)
   MAP(';', TK_SEPARATOR)
   MAP('=', TK_ASSIGN)
 #undef MAP
-  else if (isalpha(c))
+  else if (lexer_is(c, LEXER_ALPHA))
   {
-    String_View symb = sv_chop_left_while(&lexer->content, isident);
+    String_View symb = sv_chop_left(&lexer->content, lexer_span(lexer->content, LEXER_IDENT));
     assert(symb.count > 0 && "how did we get here");
     *token = (Token) {
       .loc = lexer->loc,
@@ -251,17 +355,7 @@ LexerError lexer_next_token(Lexer *lexer, Token *token)
   String_View preview = lexer->content;
   preview = sv_chop_left_while(&preview, not_isspace);
   if (preview.count > 10) preview.count = 10;
-  lexer_dump_err(lexer->loc, stderr, "Unrecognized token starts with " SV_Fmt, SV_Arg(preview));
-  return LERR_UNRECOGNIZED_TOKEN;
-}
-
-void lexer_dump_err(Location loc, FILE *stream, char *fmt, ...) {
-  fprintf(stream, LOC_FMT ": ERROR: ", LOC_ARG(loc));
-  va_list args;
-  va_start(args, fmt);
-  vfprintf(stream, fmt, args);
-  va_end(args);
-  fputc('\n', stream);
+  return lexer_error(lexer, LERR_UNRECOGNIZED_TOKEN, DIAG_UNRECOGNIZED_TOKEN, preview);
 }
 
 const char *lexer_strtokenkind(TokenKind kind)
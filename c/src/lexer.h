@@ -4,14 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "sv.h"
-
-typedef struct {
-  const char *file; // 0-terminated
-  size_t line;
-  size_t col;
-} Location;
-#define LOC_FMT "%s:%zu:%zu"
-#define LOC_ARG(loc) (loc).file, (loc).line, (loc).col
+#include "diag.h"
 
 typedef enum {
   TK_INTEGER,
@@ -50,6 +43,7 @@ typedef struct {
   String_View content;
   String_View start;
   Location loc;
+  Diagnostic error; // details of the last error returned, nothing is printed by the lexer
 } Lexer;
 
 typedef enum {
@@ -69,8 +63,6 @@ typedef enum {
 Lexer lexer_init(char *file, String_View content);
 LexerError lexer_peek(Lexer *lexer, Token *token);
 LexerError lexer_next_token(Lexer *lexer, Token *token);
-__attribute__((format(printf,3,4)))
-void lexer_dump_err(Location, FILE*, char *fmt, ...);
 const char *lexer_strtokenkind(TokenKind);
 void lexer_dump_token(Token);
 const char *lexer_strerr(LexerError);
@@ -14,6 +14,9 @@ int main(int argc, char *argv[])
       lexer_dump_token(token);
     }
     if (err != LERR_EOF)
+    {
+      diag_print(&lex.error, stderr);
       fprintf(stderr, "Lexer stopped abnormally with error %d (%s)\n", err, lexer_strerr(err));
+    }
   }
 }
@@ -1,5 +1,11 @@
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include "format.h"
 #include "lexer.h"
 #include "rpn.h"
 #include "stb_ds.h"
@@ -12,28 +18,190 @@
   }                   \
 } while(0)
 
+// Bytes read from a stream at once, and size of the output buffer for its results
+#define STREAM_CHUNK (1 << 20)
+#define STREAM_OUTPUT_BUFFER (1 << 20)
+
+// With `stats`, compiles the input first to report the size of the bytecode
+static MathParserError evaluate(MathParser *parser, Lexer lex, bool stats, MathValue *result)
+{
+  if (!stats) return math_parser_evaluate_input_value(parser, lex, result);
+  MathExpr expr;
+  MathParserError err = math_parser_compile(parser, lex, &expr);
+  if (err == MERR_OK)
+  {
+    printf("Instructions: %zu (%zu removed by constant folding, %zu calls inlined, %zu removed by sharing subexpressions)\n", arrlenu(expr.code), expr.folded, expr.inlined, expr.shared);
+    err = math_expr_eval_value(parser, &expr, result);
+  }
+  math_expr_free(&expr);
+  return err;
+}
+
+// Integer results are printed exactly, they may be beyond what a double represents
+static size_t format_value(MathValue value, char buf[MATH_FORMAT_BUFFER_SIZE])
+{
+  if (!value.integer) return math_format_double(value.as.real, buf);
+  return snprintf(buf, MATH_FORMAT_BUFFER_SIZE, "%" PRId64, value.as.integer);
+}
+
+static void print_result(MathValue result)
+{
+  char buf[MATH_FORMAT_BUFFER_SIZE];
+  format_value(result, buf);
+  printf("Result: %s\n", buf);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool is_blank(String_View sv)
+{
+  for (size_t i = 0; i < sv.count; ++i)
+  {
+    if (!isspace((unsigned char) sv.data[i])) return false;
+  }
+  return true;
+}
+
+// Evaluates one statement of a stream and prints its result, or `error` to keep the output aligned with the input
+static bool stream_statement(MathParser *parser, const char *name, String_View statement, Location loc, bool stats)
+{
+  Lexer lex = lexer_init((char *) name, statement);
+  lex.loc = loc;
+  MathValue result = { .integer = true }; // statements without a value, e.g. function definitions, print 0
+  MathParserError err = evaluate(parser, lex, stats, &result);
+  if (err != MERR_OK)
+  {
+    math_parser_clear(parser);
+    fputs("error\n", stdout);
+    return false;
+  }
+  char buf[MATH_FORMAT_BUFFER_SIZE + 1];
+  size_t len = format_value(result, buf);
+  buf[len++] = '\n';
+  fwrite(buf, 1, len, stdout);
+  return true;
+}
+
+// Evaluates every statement in `in`, one result per line. Statements end at `;` outside of parentheses, and at every
+// newline, so an unbalanced line fails on its own and the results stay aligned with the lines.
+// Variables and functions carry over to later statements. Returns the number of failed statements.
+static size_t stream(MathParser *parser, FILE *in, const char *name, bool stats)
+{
+  char *buf = malloc(STREAM_CHUNK);
+  size_t capacity = STREAM_CHUNK, len = 0, statements = 0, failed = 0, bytes = 0;
+  Location loc = { .file = name, .line = 1, .col = 0 };
+  assert(buf != NULL);
+  setvbuf(stdout, NULL, _IOFBF, STREAM_OUTPUT_BUFFER);
+  double start = now();
+  for (;;)
+  {
+    if (capacity - len < STREAM_CHUNK / 2)
+    {
+      capacity *= 2; // one statement longer than a chunk
+      buf = realloc(buf, capacity);
+      assert(buf != NULL);
+    }
+    size_t n = fread(buf + len, 1, capacity - len, in);
+    bool eof = n == 0;
+    len += n;
+    bytes += n;
+    // an unfinished statement waits for the next chunk
+    size_t begin = 0, depth = 0;
+    Location begin_loc = loc;
+    for (size_t i = 0; i < len || (eof && i == len); ++i)
+    {
+      char c = i < len ? buf[i] : '\n';
+      if (c == '(') ++depth;
+      else if (c == ')' && depth > 0) --depth;
+      if (i == len || c == '\n' || (depth == 0 && c == ';'))
+      {
+        String_View statement = sv_from_parts(buf + begin, i - begin);
+        if (!is_blank(statement))
+        {
+          ++statements;
+          if (!stream_statement(parser, name, statement, begin_loc, stats)) ++failed;
+        }
+        begin = i + 1;
+        begin_loc = loc;
+        begin_loc.col += 1;
+      }
+      if (c == '\n')
+      {
+        depth = 0;
+        loc.line += 1;
+        loc.col = 0;
+        if (begin == i + 1) begin_loc = loc;
+      }
+      else loc.col += 1;
+    }
+    if (eof) break;
+    // keep the unfinished statement for the next chunk, its location is scanned again
+    loc = begin_loc;
+    memmove(buf, buf + begin, len - begin);
+    len -= begin;
+  }
+  fflush(stdout);
+  double elapsed = now() - start;
+  fprintf(stderr, "%zu statements (%zu failed), %.1f MB in %.3f s: %.1f MB/s, %.0f statements/s\n",
+          statements, failed, bytes / 1e6, elapsed, bytes / 1e6 / elapsed, statements / elapsed);
+  free(buf);
+  return failed;
+}
+
 int main(int argc, char **argv)
 {
   MathParser parser = math_parser_init(EMPTY_LEXER);
-  if (argc <= 1)
+  bool stats = false;
+  const char *file = NULL;
+  size_t first = 1;
+  for (; first < argc; ++first)
+  {
+    // --stats: print instruction counts of each input
+    if (strcmp(argv[first], "--stats") == 0) stats = true;
+    // --contract: fuse multiplications and additions into fma, see `MathOptimizeOptions.contract`
+    else if (strcmp(argv[first], "--contract") == 0) parser.optimize.contract = true;
+    // -f FILE: evaluate all statements of FILE (- for stdin), see `stream`
+    else if (strcmp(argv[first], "-f") == 0 && first + 1 < argc) file = argv[++first];
+    else break;
+  }
+  if (file)
+  {
+    FILE *in = strcmp(file, "-") == 0 ? stdin : fopen(file, "rb");
+    if (in == NULL)
+    {
+      fprintf(stderr, "Could not open %s: %s\n", file, strerror(errno));
+      math_parser_free(&parser);
+      return 1;
+    }
+    size_t failed = stream(&parser, in, in == stdin ? "stdin" : file, stats);
+    if (in != stdin) fclose(in);
+    math_parser_free(&parser);
+    return failed > 0;
+  }
+  if (argc <= first)
   {
     int exitcode = 0;
     char *input = NULL;
     size_t size = 0;
-    double result;
+    MathValue result;
     printf("Enter equation: ");
     ssize_t len = getline(&input, &size, stdin);
     CHECK(len);
 
     while (!feof(stdin) && !ferror(stdin))
     {
-      result = 0;
+      result = (MathValue) { .integer = true };
       Lexer lex = lexer_init("stdin", sv_from_parts(input, len));
       if (input[len - 1] == '\n') lex.content.count -= 1;
-      MathParserError err = math_parser_evaluate_input(&parser, lex, &result);
+      MathParserError err = evaluate(&parser, lex, stats, &result);
       if (err == MERR_OK)
       {
-        printf("Result: %lf\n", result);
+        print_result(result);
       }
       else if (err == MERR_INPUT_EMPTY)
       {
@@ -52,8 +220,8 @@ ret:
   else
   {
     char *concat = NULL;
-    double result = 0;
-    for (size_t i = 1; i < argc; ++i)
+    MathValue result = { .integer = true };
+    for (size_t i = first; i < argc; ++i)
     {
       size_t len = strlen(argv[i]);
       char *insert = arraddnptr(concat, len + 1);
@@ -62,10 +230,10 @@ ret:
     }
     // -1 to account for extra space at end
     Lexer lex = lexer_init("args", sv_from_parts(concat, arrlenu(concat) - 1));
-    MathParserError err = math_parser_evaluate_input(&parser, lex, &result);
+    MathParserError err = evaluate(&parser, lex, stats, &result);
     if (err == MERR_OK)
     {
-      printf("Result: %lf\n", result);
+      print_result(result);
     }
     arrfree(concat);
     math_parser_free(&parser);
@@ -0,0 +1,461 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "number.h"
+#include "number_table.h"
+
+// Decimal literals take the first path that is exact for them: Clinger's fast path with a single floating point
+// operation, the Eisel-Lemire algorithm (Daniel Lemire, "Number Parsing at a Gigabyte per Second", 2021) with a
+// 128-bit multiplication by an approximated power of ten (number_table.h), and for the few literals it cannot
+// decide, exact decimal arithmetic on the digits (the "simple decimal conversion" of Go's strconv).
+
+#define MANTISSA_BITS 52
+#define EXPONENT_BITS 11
+#define BIAS 1023
+// More significant digits than any double needs to round correctly (767), the rest only matter as nonzero
+#define MATH_NUMBER_MAX_DIGITS 800
+// Exponents are clamped to this, far beyond the range of doubles
+#define MATH_NUMBER_MAX_EXPONENT 100000
+
+__extension__ typedef unsigned __int128 MathUint128;
+
+// A literal split into its parts, the digits point into the literal
+typedef struct {
+  const char *integer;
+  size_t integer_count;
+  const char *fraction;
+  size_t fraction_count;
+  int32_t exponent;
+  bool hex;
+  bool real; // has a point or an exponent
+} MathNumberLiteral;
+
+// Exact decimal, value = 0.d[0]d[1]...d[nd-1] * 10^dp without leading and trailing zeros
+typedef struct {
+  uint8_t d[MATH_NUMBER_MAX_DIGITS];
+  int32_t nd;
+  int32_t dp;
+  bool trunc; // nonzero digits past `d` were dropped
+} MathNumberDecimal;
+
+// Private functions
+
+static inline bool math_number_is_digit(char c)
+{
+  return (unsigned char) (c - '0') < 10;
+}
+
+// Value of a hexadecimal digit, -1 if it is none
+static inline int math_number_hex_digit(char c)
+{
+  if (math_number_is_digit(c)) return c - '0';
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+static double math_number_from_bits(uint64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Checks the syntax and splits the literal into its parts
+static bool math_number_split(const char *s, size_t n, MathNumberLiteral *lit)
+{
+  *lit = (MathNumberLiteral) {0};
+  size_t i = 0;
+  if (n > 2 && s[0] == '0' && (s[1] | 0x20) == 'x')
+  {
+    for (i = 2; i < n; ++i)
+    {
+      if (math_number_hex_digit(s[i]) < 0) return false;
+    }
+    lit->integer = s + 2;
+    lit->integer_count = n - 2;
+    lit->hex = true;
+    return true;
+  }
+  lit->integer = s;
+  while (i < n && math_number_is_digit(s[i])) ++i;
+  lit->integer_count = i;
+  if (i < n && s[i] == '.')
+  {
+    lit->fraction = s + ++i;
+    while (i < n && math_number_is_digit(s[i])) ++i;
+    lit->fraction_count = s + i - lit->fraction;
+    lit->real = true;
+  }
+  if (lit->integer_count + lit->fraction_count == 0) return false;
+  if (i < n && (s[i] | 0x20) == 'e')
+  {
+    bool negative = false;
+    if (++i < n && (s[i] == '+' || s[i] == '-')) negative = s[i++] == '-';
+    if (i == n) return false;
+    int32_t exponent = 0;
+    for (; i < n && math_number_is_digit(s[i]); ++i)
+    {
+      if (exponent < MATH_NUMBER_MAX_EXPONENT) exponent = exponent * 10 + (s[i] - '0');
+    }
+    if (exponent > MATH_NUMBER_MAX_EXPONENT) exponent = MATH_NUMBER_MAX_EXPONENT;
+    lit->exponent = negative ? -exponent : exponent;
+    lit->real = true;
+  }
+  return i == n;
+}
+
+// Eisel-Lemire: w * 10^q for w != 0 and q in the range of the table. False if it cannot decide, which is rare
+// and only near halfway points, and for subnormal and infinite results, which are left to the exact conversion.
+static bool math_number_eisel_lemire(uint64_t w, int32_t q, uint64_t *bits)
+{
+  const uint64_t *pow10 = MATH_NUMBER_POW10[q - MATH_NUMBER_POW10_MIN];
+  const int clz = __builtin_clzll(w);
+  w <<= clz;
+  // 217706 / 2^16 approximates log2(10)
+  uint64_t exponent = (uint64_t) (((217706 * (int64_t) q) >> 16) + 64 + BIAS - clz);
+  MathUint128 x = (MathUint128) w * pow10[1];
+  uint64_t x_hi = (uint64_t) (x >> 64), x_lo = (uint64_t) x;
+  if ((x_hi & 0x1FF) == 0x1FF && x_lo + w < w)
+  {
+    // the bits that decide the rounding may depend on the truncated half of the power
+    MathUint128 y = (MathUint128) w * pow10[0];
+    uint64_t y_hi = (uint64_t) (y >> 64), y_lo = (uint64_t) y;
+    uint64_t merged_hi = x_hi, merged_lo = x_lo + y_hi;
+    if (merged_lo < x_lo) ++merged_hi;
+    if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 && y_lo + w < w) return false;
+    x_hi = merged_hi;
+    x_lo = merged_lo;
+  }
+  const uint64_t msb = x_hi >> 63;
+  uint64_t mantissa = x_hi >> (msb + 9);
+  exponent -= 1 ^ msb;
+  // exactly halfway between two doubles cannot be told apart from slightly above
+  if (x_lo == 0 && (x_hi & 0x1FF) == 0 && (mantissa & 3) == 1) return false;
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >> (MANTISSA_BITS + 1) > 0)
+  {
+    mantissa >>= 1;
+    ++exponent;
+  }
+  if (exponent - 1 >= (1u << EXPONENT_BITS) - 2) return false;
+  *bits = exponent << MANTISSA_BITS | (mantissa & ((1ull << MANTISSA_BITS) - 1));
+  return true;
+}
+
+static void math_decimal_put(MathNumberDecimal *a, uint8_t digit)
+{
+  if (a->nd < MATH_NUMBER_MAX_DIGITS) a->d[a->nd++] = digit;
+  else if (digit != 0) a->trunc = true;
+}
+
+static void math_decimal_trim(MathNumberDecimal *a)
+{
+  while (a->nd > 0 && a->d[a->nd - 1] == 0) --a->nd;
+  if (a->nd == 0) a->dp = 0;
+}
+
+// Largest shift done at once, so the digits shifted in fit 64 bits
+#define MATH_DECIMAL_MAX_SHIFT 60
+
+// a /= 2^k
+static void math_decimal_right_shift(MathNumberDecimal *a, unsigned k)
+{
+  int32_t r = 0, w = 0;
+  uint64_t n = 0;
+  // the leading digits that are still 0 after the shift
+  for (; n >> k == 0; ++r)
+  {
+    if (r >= a->nd)
+    {
+      if (n == 0)
+      {
+        a->nd = 0;
+        return;
+      }
+      while (n >> k == 0)
+      {
+        n *= 10;
+        ++r;
+      }
+      break;
+    }
+    n = n * 10 + a->d[r];
+  }
+  a->dp -= r - 1;
+  const uint64_t mask = (1ull << k) - 1;
+  for (; r < a->nd; ++r)
+  {
+    uint64_t digit = n >> k;
+    n &= mask;
+    a->d[w++] = digit;
+    n = n * 10 + a->d[r];
+  }
+  while (n > 0)
+  {
+    uint64_t digit = n >> k;
+    n &= mask;
+    if (w < MATH_NUMBER_MAX_DIGITS) a->d[w++] = digit;
+    else if (digit > 0) a->trunc = true;
+    n *= 10;
+  }
+  a->nd = w;
+  math_decimal_trim(a);
+}
+
+// a *= 2^k
+static void math_decimal_left_shift(MathNumberDecimal *a, unsigned k)
+{
+  // the digits are written from the right, a shift by 60 adds at most 19 in front
+  uint8_t digits[MATH_NUMBER_MAX_DIGITS + 20];
+  int32_t w = sizeof(digits);
+  uint64_t n = 0;
+  for (int32_t r = a->nd - 1; r >= 0; --r)
+  {
+    n += (uint64_t) a->d[r] << k;
+    digits[--w] = n % 10;
+    n /= 10;
+  }
+  while (n > 0)
+  {
+    digits[--w] = n % 10;
+    n /= 10;
+  }
+  int32_t count = (int32_t) sizeof(digits) - w;
+  a->dp += count - a->nd;
+  if (count > MATH_NUMBER_MAX_DIGITS)
+  {
+    for (int32_t i = MATH_NUMBER_MAX_DIGITS; i < count; ++i)
+    {
+      if (digits[w + i] != 0) a->trunc = true;
+    }
+    count = MATH_NUMBER_MAX_DIGITS;
+  }
+  memcpy(a->d, digits + w, count);
+  a->nd = count;
+  math_decimal_trim(a);
+}
+
+// a *= 2^k for k of either sign
+static void math_decimal_shift(MathNumberDecimal *a, int32_t k)
+{
+  if (a->nd == 0) return;
+  for (; k > MATH_DECIMAL_MAX_SHIFT; k -= MATH_DECIMAL_MAX_SHIFT) math_decimal_left_shift(a, MATH_DECIMAL_MAX_SHIFT);
+  for (; k < -MATH_DECIMAL_MAX_SHIFT; k += MATH_DECIMAL_MAX_SHIFT) math_decimal_right_shift(a, MATH_DECIMAL_MAX_SHIFT);
+  if (k > 0) math_decimal_left_shift(a, k);
+  if (k < 0) math_decimal_right_shift(a, -k);
+}
+
+// Integer part of a, rounded to nearest, ties to even. Only called for a < 2^54.
+static uint64_t math_decimal_round(const MathNumberDecimal *a)
+{
+  uint64_t n = 0;
+  int32_t i = 0;
+  for (; i < a->dp && i < a->nd; ++i) n = n * 10 + a->d[i];
+  for (; i < a->dp; ++i) n *= 10;
+  bool up = false;
+  if (a->dp >= 0 && a->dp < a->nd)
+  {
+    // exactly half only if 5 is the last digit and nothing was dropped
+    if (a->d[a->dp] == 5 && a->dp + 1 == a->nd && !a->trunc) up = a->dp > 0 && (a->d[a->dp - 1] & 1);
+    else up = a->d[a->dp] >= 5;
+  }
+  return n + up;
+}
+
+// Exact conversion of the digits of a decimal literal
+static uint64_t math_number_exact_bits(const MathNumberLiteral *lit)
+{
+  MathNumberDecimal a;
+  a.nd = 0;
+  a.trunc = false;
+  int64_t dp = 0;
+  for (size_t i = 0; i < lit->integer_count; ++i)
+  {
+    uint8_t digit = lit->integer[i] - '0';
+    if (a.nd == 0 && digit == 0) continue;
+    math_decimal_put(&a, digit);
+    ++dp;
+  }
+  for (size_t i = 0; i < lit->fraction_count; ++i)
+  {
+    uint8_t digit = lit->fraction[i] - '0';
+    if (a.nd == 0 && digit == 0)
+    {
+      --dp;
+      continue;
+    }
+    math_decimal_put(&a, digit);
+  }
+  dp += lit->exponent;
+  const uint64_t inf = (uint64_t) ((1u << EXPONENT_BITS) - 1) << MANTISSA_BITS;
+  if (a.nd == 0) return 0;
+  if (dp > 310) return inf;
+  if (dp < -330) return 0;
+  a.dp = (int32_t) dp;
+  math_decimal_trim(&a);
+
+  // scale by powers of two to [0.5, 1), the shifts are as large as possible without changing the number of digits
+  static const int32_t powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+  const int32_t powtab_count = sizeof(powtab) / sizeof(powtab[0]);
+  int32_t exponent = 0;
+  while (a.dp > 0)
+  {
+    int32_t n = a.dp >= powtab_count ? 27 : powtab[a.dp];
+    math_decimal_shift(&a, -n);
+    exponent += n;
+  }
+  while (a.dp < 0 || (a.dp == 0 && a.d[0] < 5))
+  {
+    int32_t n = -a.dp >= powtab_count ? 27 : powtab[-a.dp];
+    math_decimal_shift(&a, n);
+    exponent -= n;
+  }
+  // [1, 2) is the range of the mantissa
+  --exponent;
+  const int32_t min_exponent = 1 - BIAS;
+  if (exponent < min_exponent)
+  {
+    // subnormal, less precision
+    math_decimal_shift(&a, exponent - min_exponent);
+    exponent = min_exponent;
+  }
+  if (exponent + BIAS >= (1 << EXPONENT_BITS) - 1) return inf;
+  math_decimal_shift(&a, 1 + MANTISSA_BITS);
+  uint64_t mantissa = math_decimal_round(&a);
+  if (mantissa == 2ull << MANTISSA_BITS)
+  {
+    mantissa >>= 1;
+    ++exponent;
+    if (exponent + BIAS >= (1 << EXPONENT_BITS) - 1) return inf;
+  }
+  uint64_t biased = (mantissa >> MANTISSA_BITS) & 1 ? (uint64_t) (exponent + BIAS) : 0;
+  return biased << MANTISSA_BITS | (mantissa & ((1ull << MANTISSA_BITS) - 1));
+}
+
+static uint64_t math_number_decimal_bits(const MathNumberLiteral *lit)
+{
+  // 19 significant digits always fit, the exponent counts the digits left out
+  uint64_t w = 0;
+  int32_t digits = 0, q = lit->exponent;
+  bool truncated = false;
+  for (size_t i = 0; i < lit->integer_count; ++i)
+  {
+    uint8_t digit = lit->integer[i] - '0';
+    if (digits < 19)
+    {
+      w = w * 10 + digit;
+      digits += w > 0;
+    }
+    else
+    {
+      ++q;
+      truncated |= digit != 0;
+    }
+  }
+  for (size_t i = 0; i < lit->fraction_count; ++i)
+  {
+    uint8_t digit = lit->fraction[i] - '0';
+    if (digits < 19)
+    {
+      w = w * 10 + digit;
+      digits += w > 0;
+      --q;
+    }
+    else
+    {
+      truncated |= digit != 0;
+    }
+  }
+  if (w == 0) return 0;
+  // (w + 1) * 10^q < 10^-324 rounds to 0, w * 10^q > 10^308 is too large
+  if (q < MATH_NUMBER_POW10_MIN) return 0;
+  if (q > MATH_NUMBER_POW10_MAX) return (uint64_t) ((1u << EXPONENT_BITS) - 1) << MANTISSA_BITS;
+
+  // Clinger: both are exact doubles, so is the one rounding of their product or quotient
+  static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  uint64_t bits;
+  if (!truncated && w <= 1ull << (MANTISSA_BITS + 1) && q >= -22 && q <= 22)
+  {
+    double value = q < 0 ? (double) w / exact_pow10[-q] : (double) w * exact_pow10[q];
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+  if (math_number_eisel_lemire(w, q, &bits))
+  {
+    // with digits left out the value is between w and w + 1, decided if both round the same
+    uint64_t upper;
+    if (!truncated || (math_number_eisel_lemire(w + 1, q, &upper) && upper == bits)) return bits;
+  }
+  return math_number_exact_bits(lit);
+}
+
+// Hexadecimal integers beyond 2^53 round like decimals, from their leading 64 bits and whether any below are set
+static double math_number_hex_value(const MathNumberLiteral *lit)
+{
+  uint64_t m = 0;
+  uint32_t dropped = 0;
+  bool sticky = false;
+  for (size_t i = 0; i < lit->integer_count; ++i)
+  {
+    int digit = math_number_hex_digit(lit->integer[i]);
+    if (m >> 60 == 0)
+    {
+      m = m << 4 | digit;
+    }
+    else
+    {
+      // 2^1024 is infinite already
+      if (dropped < 1024) dropped += 4;
+      sticky |= digit != 0;
+    }
+  }
+  // m has over 60 bits if any were dropped, the lowest is far below the rounding position
+  double value = (double) (m | sticky);
+  for (; dropped > 0; dropped -= 4) value *= 16;
+  return value;
+}
+
+// Implementation
+
+MathNumberError math_number_parse_double(const char *s, size_t n, double *result)
+{
+  MathNumberLiteral lit;
+  if (!math_number_split(s, n, &lit)) return MATH_NUMBER_INVALID;
+  if (lit.hex)
+  {
+    *result = math_number_hex_value(&lit);
+    return *result == INFINITY ? MATH_NUMBER_OVERFLOW : MATH_NUMBER_OK;
+  }
+  const uint64_t bits = math_number_decimal_bits(&lit);
+  *result = math_number_from_bits(bits);
+  if (bits == (uint64_t) ((1u << EXPONENT_BITS) - 1) << MANTISSA_BITS) return MATH_NUMBER_OVERFLOW;
+  if (bits == 0)
+  {
+    // underflow if any digit is not 0
+    for (size_t i = 0; i < lit.integer_count; ++i) if (lit.integer[i] != '0') return MATH_NUMBER_UNDERFLOW;
+    for (size_t i = 0; i < lit.fraction_count; ++i) if (lit.fraction[i] != '0') return MATH_NUMBER_UNDERFLOW;
+  }
+  return MATH_NUMBER_OK;
+}
+
+MathNumberError math_number_parse_int64(const char *s, size_t n, int64_t *result)
+{
+  MathNumberLiteral lit;
+  if (!math_number_split(s, n, &lit) || lit.real) return MATH_NUMBER_INVALID;
+  const int64_t base = lit.hex ? 16 : 10;
+  int64_t value = 0;
+  for (size_t i = 0; i < lit.integer_count; ++i)
+  {
+    const int64_t digit = math_number_hex_digit(lit.integer[i]);
+    if (__builtin_mul_overflow(value, base, &value) || __builtin_add_overflow(value, digit, &value)) return MATH_NUMBER_OVERFLOW;
+  }
+  *result = value;
+  return MATH_NUMBER_OK;
+}
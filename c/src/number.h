@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Conversion of number literals, the counterpart of format.h. Literals are either decimal, with an optional
+// fraction and exponent (`12`, `1.5`, `.5`, `2.`, `1e-3`, `6.02E+23`), or hexadecimal integers (`0x1F`).
+// The literal is exactly the `n` characters at `s`, nothing past them is read, so it does not need a terminating 0.
+// Does not depend on the locale.
+
+typedef enum {
+  MATH_NUMBER_OK,
+  MATH_NUMBER_INVALID,   // not a literal of the syntax above
+  MATH_NUMBER_OVERFLOW,  // integers: does not fit int64_t, reals: rounds to infinity (the result)
+  MATH_NUMBER_UNDERFLOW, // reals: not 0, but rounds to 0 (the result). Subnormal results are not an error.
+} MathNumberError;
+
+// Reads the value of the literal rounded to the nearest double, ties to even, bit for bit the same as strtod.
+// Uses the Eisel-Lemire algorithm, and exact decimal arithmetic for the rare literals it cannot decide.
+MathNumberError math_number_parse_double(const char *s, size_t n, double *result);
+// Reads an integer literal, decimal or hexadecimal, without fraction or exponent
+MathNumberError math_number_parse_int64(const char *s, size_t n, int64_t *result);
@@ -0,0 +1,156 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+typedef struct {
+  void *data;
+  size_t size;
+} MathScratch;
+
+struct MathThreadPool {
+  pthread_mutex_t run; // held for a whole run, one task at a time
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  pthread_t *threads; // workers [1, size)
+  MathScratch *scratch; // one per worker
+  size_t size;
+  MathThreadTask task;
+  void *ctx;
+  size_t generation; // bumped for every run, workers wait for it to change
+  size_t running;
+  bool stop;
+};
+
+typedef struct {
+  MathThreadPool *pool;
+  size_t index;
+} MathWorker;
+
+// Private functions
+
+static void *math_thread_pool_worker(void *arg)
+{
+  MathWorker worker = *(MathWorker *) arg;
+  MathThreadPool *pool = worker.pool;
+  free(arg);
+  pthread_mutex_lock(&pool->lock);
+  size_t seen = 0; // no run can start before the pool is created
+  for (;;)
+  {
+    while (pool->generation == seen && !pool->stop) pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->stop) break;
+    seen = pool->generation;
+    MathThreadTask task = pool->task;
+    void *ctx = pool->ctx;
+    pthread_mutex_unlock(&pool->lock);
+    task(ctx, worker.index);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// Implementation
+
+MathThreadPool *math_thread_pool_create(size_t threads)
+{
+  if (threads == 0)
+  {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (size_t) online : 1;
+  }
+  MathThreadPool *pool = calloc(1, sizeof(*pool));
+  if (pool == NULL) return NULL;
+  pool->threads = calloc(threads, sizeof(pthread_t));
+  pool->scratch = calloc(threads, sizeof(MathScratch));
+  if (pool->threads == NULL || pool->scratch == NULL)
+  {
+    free(pool->scratch);
+    free(pool->threads);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->run, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->size = 1;
+  for (size_t i = 1; i < threads; ++i)
+  {
+    MathWorker *worker = malloc(sizeof(*worker));
+    if (worker == NULL) goto error;
+    *worker = (MathWorker) { .pool = pool, .index = i };
+    if (pthread_create(&pool->threads[i], NULL, math_thread_pool_worker, worker) != 0)
+    {
+      free(worker);
+      goto error;
+    }
+    pool->size = i + 1;
+  }
+  return pool;
+
+error:
+  math_thread_pool_free(pool);
+  return NULL;
+}
+
+void math_thread_pool_free(MathThreadPool *pool)
+{
+  if (pool == NULL) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 1; i < pool->size; ++i) pthread_join(pool->threads[i], NULL);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->run);
+  for (size_t i = 0; i < pool->size; ++i) free(pool->scratch[i].data);
+  free(pool->scratch);
+  free(pool->threads);
+  free(pool);
+}
+
+size_t math_thread_pool_size(const MathThreadPool *pool)
+{
+  assert(pool != NULL);
+  return pool->size;
+}
+
+void math_thread_pool_run(MathThreadPool *pool, MathThreadTask task, void *ctx)
+{
+  assert(pool != NULL);
+  assert(task != NULL);
+  pthread_mutex_lock(&pool->run);
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->ctx = ctx;
+  pool->running = pool->size - 1;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  task(ctx, 0);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running > 0) pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->run);
+}
+
+void *math_thread_pool_scratch(MathThreadPool *pool, size_t worker, size_t size)
+{
+  assert(pool != NULL);
+  assert(worker < pool->size);
+  MathScratch *scratch = &pool->scratch[worker];
+  if (scratch->size >= size) return scratch->data;
+  // NOTE: the old contents are not needed, no point in copying them
+  free(scratch->data);
+  scratch->data = malloc(size);
+  scratch->size = scratch->data ? size : 0;
+  return scratch->data;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+// A fixed set of worker threads that run one task at a time, used to spread batches over cores.
+typedef struct MathThreadPool MathThreadPool;
+
+// Called once on every worker, `worker` is in [0, size) and 0 is the calling thread.
+typedef void (*MathThreadTask)(void *ctx, size_t worker);
+
+// Starts a pool of `threads` workers, the calling thread counts as one of them.
+// 0 uses one worker per online CPU. Returns NULL if the threads could not be started.
+MathThreadPool *math_thread_pool_create(size_t threads);
+// Stops and joins the workers.
+void math_thread_pool_free(MathThreadPool *pool);
+// Number of workers, including the calling thread
+size_t math_thread_pool_size(const MathThreadPool *pool);
+// Runs `task` on all workers and waits until every one has returned.
+// Runs from several threads on the same pool are serialized.
+void math_thread_pool_run(MathThreadPool *pool, MathThreadTask task, void *ctx);
+// Memory of at least `size` bytes for the task running as `worker`, kept across runs and freed with the pool.
+// Only the task running as `worker` may use it, and only during the run. Returns NULL if it could not be grown.
+void *math_thread_pool_scratch(MathThreadPool *pool, size_t worker, size_t size);
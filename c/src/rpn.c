@@ -1,5 +1,6 @@
 #include "rpn.h"
 #include "lexer.h"
+#include "vmath.h"
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -15,6 +16,7 @@ static double math_parser_log(double a, double b)
   return log(b) / log(a);
 }
 
+// NOTE: builtins must be pure, calls with constant arguments are folded at compile time
 static MathBuiltinFunction MATH_PARSER_BUILTIN_FUNCTIONS[] = {
 #define UNARY(fname)           \
   {                            \
@@ -23,6 +25,9 @@ static MathBuiltinFunction MATH_PARSER_BUILTIN_FUNCTIONS[] = {
     .as = {                    \
       .unary = fname,          \
     },                         \
+    .fast = {                  \
+      .unary = math_v ## fname, \
+    },                         \
   },
   UNARY(sin)
   UNARY(cos)
@@ -33,21 +38,28 @@ static MathBuiltinFunction MATH_PARSER_BUILTIN_FUNCTIONS[] = {
   UNARY(sqrt)
   UNARY(log2)
   UNARY(log10)
-  UNARY(log)
-#undef UNARY
   {
     .name = SV_STATIC("ln"),
     .nargs = 1,
     .as = {
       .unary = log,
     },
+    .fast = {
+      .unary = math_vlog,
+    },
   },
+  // NOTE: overloads must be next to each other
+  UNARY(log)
+#undef UNARY
   {
     .name = SV_STATIC("log"),
     .nargs = 2,
     .as = {
       .binary = math_parser_log,
     },
+    .fast = {
+      .binary = math_vlogb,
+    },
   },
 };
 
@@ -73,6 +85,39 @@ static MathVariable MATH_PARSER_BUILTIN_CONSTANTS[] = {
 #undef _VAL
 };
 
+// Perfect hashes of the case folded builtin names, found by trying seeds until no two names collide.
+// Entries are index + 1 into the tables above, 0 is empty. Lookups compare the name, so when adding
+// builtins a stale table only misses them, rerun the search and update both seed and table.
+#define MATH_PARSER_FUNCTION_SEED 462
+#define MATH_PARSER_CONSTANT_SEED 30
+#define MATH_PARSER_BUILTIN_HASH_BITS 4
+static const uint8_t MATH_PARSER_BUILTIN_FUNCTION_HASH[1 << MATH_PARSER_BUILTIN_HASH_BITS] = {
+  [15] = 1,  // sin
+  [7]  = 2,  // cos
+  [14] = 3,  // tan
+  [2]  = 4,  // asin
+  [3]  = 5,  // acos
+  [0]  = 6,  // atan
+  [11] = 7,  // sqrt
+  [6]  = 8,  // log2
+  [13] = 9,  // log10
+  [8]  = 10, // ln
+  [10] = 11, // log
+};
+static const uint8_t MATH_PARSER_BUILTIN_CONSTANT_HASH[1 << MATH_PARSER_BUILTIN_HASH_BITS] = {
+  [15] = 1,  // PI
+  [8]  = 2,  // PI_2
+  [6]  = 3,  // PI_4
+  [14] = 4,  // E
+  [5]  = 5,  // LOG2E
+  [2]  = 6,  // LOG10E
+  [4]  = 7,  // LN2
+  [1]  = 8,  // LN10
+  [10] = 11, // SQRT2
+};
+
+#define MATH_SYMBOL_KEY_SIZE 64
+
 // Private functions
 
 static String_View sv_dup(const String_View sv)
@@ -86,44 +131,154 @@ static String_View sv_dup(const String_View sv)
   };
 }
 
-static bool math_parser_has_function(const MathParser *const parser, String_View name, ssize_t nargs)
+static char math_symbol_fold(char c)
 {
-  for (size_t i = 0; i < ALEN(MATH_PARSER_BUILTIN_FUNCTIONS); ++i)
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// FNV-1a of the case folded name
+static uint32_t math_symbol_hash(String_View name)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < name.count; ++i)
   {
-    if (sv_eq_ignorecase(name, MATH_PARSER_BUILTIN_FUNCTIONS[i].name) && (nargs < 0 || nargs == MATH_PARSER_BUILTIN_FUNCTIONS[i].nargs))
-    {
-      return true;
-    }
+    hash ^= (unsigned char) math_symbol_fold(name.data[i]);
+    hash *= 16777619u;
   }
-  size_t size = arrlenu(parser->functions);
-  for (size_t i = 0; i < size; ++i)
+  return hash;
+}
+
+static size_t math_builtin_slot(String_View name, uint32_t seed)
+{
+  return ((math_symbol_hash(name) ^ seed) * 0x9E3779B1u) >> (32 - MATH_PARSER_BUILTIN_HASH_BITS);
+}
+
+// Case folds `name` into a 0-terminated key. Uses `buf` if it fits, otherwise the key must be free'd.
+static char *math_symbol_key(String_View name, char buf[MATH_SYMBOL_KEY_SIZE])
+{
+  char *key = buf;
+  if (name.count >= MATH_SYMBOL_KEY_SIZE)
   {
-    if (sv_eq_ignorecase(name, parser->functions[i].name) && (nargs < 0 || nargs == parser->functions[i].nargs))
-    {
-      return true;
-    }
+    key = malloc(name.count + 1);
+    assert(key != NULL);
   }
-  return false;
+  for (size_t i = 0; i < name.count; ++i)
+  {
+    key[i] = math_symbol_fold(name.data[i]);
+  }
+  key[name.count] = '\0';
+  return key;
 }
 
-static bool math_parser_has_variable(const MathParser *const parser, String_View name)
+// Returns the value stored for `name`, or -1. Does not modify the index, so it is safe to call from several threads.
+static ssize_t math_symbol_index_get(MathSymbolIndex *index, String_View name)
+{
+  if (index == NULL) return -1;
+  char buf[MATH_SYMBOL_KEY_SIZE];
+  char *key = math_symbol_key(name, buf);
+  ptrdiff_t slot;
+  (void) stbds_hmget_key_ts(index, sizeof *index, key, sizeof index->key, &slot, STBDS_HM_STRING);
+  if (key != buf) free(key);
+  return slot < 0 ? -1 : (ssize_t) index[slot].value;
+}
+
+static void math_symbol_index_put(MathSymbolIndex **index, String_View name, size_t value)
+{
+  if (*index == NULL) sh_new_strdup(*index);
+  char buf[MATH_SYMBOL_KEY_SIZE];
+  char *key = math_symbol_key(name, buf);
+  shput(*index, key, value);
+  if (key != buf) free(key);
+}
+
+// `nargs` < 0 matches any number of arguments
+static ssize_t math_parser_find_builtin_function(String_View name, ssize_t nargs)
 {
-  for (size_t i = 0; i < ALEN(MATH_PARSER_BUILTIN_CONSTANTS); ++i)
+  uint8_t entry = MATH_PARSER_BUILTIN_FUNCTION_HASH[math_builtin_slot(name, MATH_PARSER_FUNCTION_SEED)];
+  if (entry == 0) return -1;
+  for (size_t i = entry - 1; i < ALEN(MATH_PARSER_BUILTIN_FUNCTIONS) && sv_eq_ignorecase(name, MATH_PARSER_BUILTIN_FUNCTIONS[i].name); ++i)
   {
-    if (sv_eq_ignorecase(name, MATH_PARSER_BUILTIN_CONSTANTS[i].name))
-    {
-      return true;
-    }
+    if (nargs < 0 || nargs == MATH_PARSER_BUILTIN_FUNCTIONS[i].nargs) return i;
   }
-  size_t size = arrlenu(parser->variables);
-  for (size_t i = 0; i < size; ++i)
+  return -1;
+}
+
+static ssize_t math_parser_find_builtin_constant(String_View name)
+{
+  uint8_t entry = MATH_PARSER_BUILTIN_CONSTANT_HASH[math_builtin_slot(name, MATH_PARSER_CONSTANT_SEED)];
+  if (entry == 0 || !sv_eq_ignorecase(name, MATH_PARSER_BUILTIN_CONSTANTS[entry - 1].name)) return -1;
+  return entry - 1;
+}
+
+ssize_t math_parser_find_function(const MathParser *const parser, String_View name, ssize_t nargs)
+{
+  ssize_t i = math_symbol_index_get(parser->function_index, name);
+  for (; i >= 0; i = parser->functions[i].next_overload)
   {
-    if (sv_eq_ignorecase(name, parser->variables[i].name))
-    {
-      return true;
-    }
+    if (nargs < 0 || nargs == parser->functions[i].nargs) return i;
   }
-  return false;
+  return -1;
+}
+
+static ssize_t math_parser_find_variable(const MathParser *const parser, String_View name)
+{
+  return math_symbol_index_get(parser->variable_index, name);
+}
+
+static void math_parser_add_function(MathParser *parser, MathUserFunction function)
+{
+  function.next_overload = math_symbol_index_get(parser->function_index, function.name);
+  arrput(parser->functions, function);
+  math_symbol_index_put(&parser->function_index, function.name, arrlenu(parser->functions) - 1);
+}
+
+static bool math_parser_has_function(const MathParser *const parser, String_View name, ssize_t nargs)
+{
+  return math_parser_find_builtin_function(name, nargs) >= 0 || math_parser_find_function(parser, name, nargs) >= 0;
+}
+
+static bool math_parser_has_variable(const MathParser *const parser, String_View name)
+{
+  if (math_parser_find_builtin_constant(name) >= 0) return true;
+  ssize_t slot = math_parser_find_variable(parser, name);
+  return slot >= 0 && parser->variables[slot].defined;
+}
+
+// Starts a token buffer for the rest of the parser's lexer
+static void math_parser_tokenize(MathParser *parser)
+{
+  arrsetlen(parser->tokens, 0);
+  parser->next_token = 0;
+  parser->tokens_at = parser->lexer.content;
+  parser->tokens_end = parser->lexer;
+  parser->tokens_err = LERR_OK;
+}
+
+// Token `i` of the buffer, or why there is none. Tokens are lexed when first needed, so each is lexed once.
+static LexerError math_parser_token(MathParser *parser, size_t i, Token *token)
+{
+  while (i >= arrlenu(parser->tokens))
+  {
+    if (parser->tokens_err != LERR_OK) return parser->tokens_err;
+    // lex right into the buffer, shrink it again if there was no token
+    parser->tokens_err = lexer_next_token(&parser->tokens_end, arraddnptr(parser->tokens, 1));
+    if (parser->tokens_err != LERR_OK) arrsetlen(parser->tokens, arrlenu(parser->tokens) - 1);
+  }
+  *token = parser->tokens[i];
+  return LERR_OK;
+}
+
+// Moves the parser's lexer behind the tokens parsed so far, where lexing them one by one would have left it
+static void math_parser_sync_lexer(MathParser *parser)
+{
+  if (parser->next_token == 0) return;
+  const Token last = parser->tokens[parser->next_token - 1];
+  const char *end = parser->tokens_end.content.data + parser->tokens_end.content.count;
+  parser->lexer.content.data = last.content.data + last.content.count;
+  parser->lexer.content.count = end - parser->lexer.content.data;
+  parser->lexer.loc = last.loc;
+  parser->lexer.loc.col += last.content.count;
+  parser->tokens_at = parser->lexer.content;
 }
 
 static MathOperator math_parser_last_op(const MathParser *const parser)
@@ -184,18 +339,17 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
     case TK_SYMBOL: {
       math_parser_check_implicit_mult(parser, token, lasttoken);
       Token peek;
-      Lexer peek_lexer = parser->lexer;
       bool function = false;
       if (math_parser_has_function(parser, token.content, -1)) function = true;
       else if (math_parser_has_variable(parser, token.content)) function = false;
-      else if (lexer_next_token(&peek_lexer, &peek) == LERR_OK && peek.kind == TK_OPEN_PAREN) function = true;
+      else if (math_parser_token(parser, parser->next_token, &peek) == LERR_OK && peek.kind == TK_OPEN_PAREN) function = true;
 
       if (function)
       {
         MathOperator fn = (MathOperator) {
           .token = token,
           .function = true,
-          .nargs = lexer_next_token(&peek_lexer, &peek) == LERR_OK && peek.kind != TK_CLOSE_PAREN ? 1 : 0,
+          .nargs = math_parser_token(parser, parser->next_token + 1, &peek) == LERR_OK && peek.kind != TK_CLOSE_PAREN ? 1 : 0,
         };
         arrput(parser->operator_stack, fn);
       }
@@ -213,14 +367,14 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
       }
       else if (lasttoken.kind == TK_OP)
       {
-        lexer_dump_err(token.loc, stderr, "Unexpected operator " SV_Fmt ", expected expression", SV_Arg(token.content));
-        fprintf(stderr, LOC_FMT ": NOTE: Preceded by this operator " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_OPERATOR, .loc = token.loc, .text = token.content });
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY_OPERATOR, .loc = lasttoken.loc, .text = lasttoken.content });
         return MERR_UNEXPECTED_OPERATOR;
       }
       else if (lasttoken.kind == TK_OPEN_PAREN || lasttoken.kind == TK_SEPARATOR)
       {
-        lexer_dump_err(token.loc, stderr, "Unexpected operator " SV_Fmt ", expected expression", SV_Arg(token.content));
-        fprintf(stderr, LOC_FMT ": NOTE: Preceded by this " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_OPERATOR, .loc = token.loc, .text = token.content });
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY, .loc = lasttoken.loc, .text = lasttoken.content });
         return MERR_UNEXPECTED_OPERATOR;
       }
       MathOperator op = (MathOperator) {
@@ -244,14 +398,14 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
     case TK_SEPARATOR: {
       if (lasttoken.kind == TK_OP)
       {
-        lexer_dump_err(token.loc, stderr, "Unexpected " SV_Fmt ", expected expression", SV_Arg(token.content));
-        fprintf(stderr, LOC_FMT ": NOTE: Preceded by this operator " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_TOKEN, .loc = token.loc, .text = token.content });
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY_OPERATOR, .loc = lasttoken.loc, .text = lasttoken.content });
         return MERR_UNEXPECTED_OPERATOR;
       }
       else if (lasttoken.kind == TK_OPEN_PAREN || lasttoken.kind == TK_SEPARATOR)
       {
-        lexer_dump_err(token.loc, stderr, "Unexpected " SV_Fmt ", expected expression", SV_Arg(token.content));
-        fprintf(stderr, LOC_FMT ": NOTE: Preceded by " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_TOKEN, .loc = token.loc, .text = token.content });
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY, .loc = lasttoken.loc, .text = lasttoken.content });
         return MERR_UNEXPECTED_OPERATOR;
       }
       MathOperator top_op;
@@ -266,7 +420,7 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
       assert(parser->operator_stack[len - 1].token.kind == TK_OPEN_PAREN);
       if (len == 1 || !parser->operator_stack[len - 2].function)
       {
-        lexer_dump_err(token.loc, stderr, "Got separator without function call in parenthesis");
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_SEPARATOR_OUTSIDE_CALL, .loc = token.loc });
         return MERR_UNBALANCED_PARENTHESIS;
       }
       parser->operator_stack[len - 2].nargs += 1;
@@ -283,14 +437,14 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
     case TK_CLOSE_PAREN: {
       if (lasttoken.kind == TK_OP)
       {
-        lexer_dump_err(token.loc, stderr, "Unexpected ), expected expression");
-        fprintf(stderr, LOC_FMT ": NOTE: Preceded by this operator " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_TOKEN, .loc = token.loc, .text = token.content });
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY_OPERATOR, .loc = lasttoken.loc, .text = lasttoken.content });
         return MERR_UNEXPECTED_OPERATOR;
       }
       else if (lasttoken.kind == TK_OPEN_PAREN || lasttoken.kind == TK_SEPARATOR)
       {
-        lexer_dump_err(token.loc, stderr, "Unexpected " SV_Fmt ", expected expression", SV_Arg(token.content));
-        fprintf(stderr, LOC_FMT ": NOTE: Preceded by " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_TOKEN, .loc = token.loc, .text = token.content });
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY, .loc = lasttoken.loc, .text = lasttoken.content });
         return MERR_UNEXPECTED_OPERATOR;
       }
       MathOperator top_op;
@@ -303,7 +457,7 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
       }
       if (len == 0)
       {
-        lexer_dump_err(token.loc, stderr, "Unbalanced parenthesis, got ) without prior (");
+        math_parser_report(parser, (Diagnostic) { .code = DIAG_UNBALANCED_CLOSE, .loc = token.loc });
         return MERR_UNBALANCED_PARENTHESIS;
       }
       assert(parser->operator_stack[len - 1].token.kind == TK_OPEN_PAREN);
@@ -314,12 +468,16 @@ static MathParserError math_parser_parse_one_token(MathParser *parser, const Tok
       len = arrlenu(parser->operator_stack);
       if (len > 0 && parser->operator_stack[len - 1].function)
       {
-        arrput(parser->output_queue, arrpop(parser->operator_stack));
+        // arguments are counted now, resolve builtins once instead of on every call
+        MathOperator fn = arrpop(parser->operator_stack);
+        ssize_t i = math_parser_find_builtin_function(fn.token.content, fn.nargs);
+        if (i >= 0) fn.builtin = &MATH_PARSER_BUILTIN_FUNCTIONS[i];
+        arrput(parser->output_queue, fn);
       }
     } break;
     case TK_ASSIGN: {
-      lexer_dump_err(token.loc, stderr, "Unexpected assignment inside expression");
-        fprintf(stderr, LOC_FMT ": NOTE: Assignment is only legal at the beginning of an expression, immediately following a variable, or in a chain of assignments.\n", LOC_ARG(token.loc));
+      math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_ASSIGNMENT, .loc = token.loc });
+      math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_ASSIGNMENT_POSITION, .loc = token.loc });
       return MERR_UNEXPECTED_OPERATOR;
     } break;
   }
@@ -330,44 +488,47 @@ static MathParserError math_parser_parse_function_def(MathParser *parser, MathUs
 {
   // NOTE: This function will always return OK if input is not faulty
   // To check if a function was actually parsed, check it's contents
-  LexerError lerr;
   MathParserError err = MERR_OK;
-  Lexer peek = parser->lexer;
+  size_t peek = parser->next_token;
   Token function_name, peek_token;
   Token error_token;
   String_View *arguments = NULL;
   size_t size;
   // doesn't start with a symbol -> give up immediately
-  if ((lerr = lexer_next_token(&peek, &function_name)) != LERR_OK || function_name.kind != TK_SYMBOL) return MERR_OK;
-  if ((lerr = lexer_next_token(&peek, &peek_token)) != LERR_OK || peek_token.kind != TK_OPEN_PAREN) return MERR_OK;
+  if (math_parser_token(parser, peek++, &function_name) != LERR_OK || function_name.kind != TK_SYMBOL) return MERR_OK;
+  if (math_parser_token(parser, peek++, &peek_token) != LERR_OK || peek_token.kind != TK_OPEN_PAREN) return MERR_OK;
   // now we get the parameters, first a symbol, then a closing bracket or comma
-  if ((lerr = lexer_peek(&peek, &peek_token)) == LERR_OK && peek_token.kind == TK_CLOSE_PAREN)
+  if (math_parser_token(parser, peek, &peek_token) == LERR_OK && peek_token.kind == TK_CLOSE_PAREN)
   {
-    lerr = lexer_next_token(&peek, &function_name);
-    assert(lerr == LERR_OK && "how, we just peeked fine");
+    if (math_parser_token(parser, peek + 1, &peek_token) != LERR_OK || peek_token.kind != TK_ASSIGN) return MERR_OK;
     assert(function_name.content.count > 0 && "how did we get here lexer");
+    if (math_parser_has_function(parser, function_name.content, 0))
+    {
+      math_parser_report(parser, (Diagnostic) { .code = DIAG_FUNCTION_DEFINED, .loc = function_name.loc, .text = function_name.content });
+      return MERR_SYMBOL_ALREADY_SET;
+    }
     *fn = (MathUserFunction) {
       .name = sv_dup(function_name.content),
       .nargs = 0,
     };
-    parser->lexer = peek; // make sure RPN starts from here
+    parser->next_token = peek + 2; // make sure RPN starts from here
     return MERR_OK;
   }
   for (;;)
   {
     Token argument_name;
-    if ((lerr = lexer_next_token(&peek, &argument_name)) != LERR_OK || argument_name.kind != TK_SYMBOL) goto check_is_fn;
+    if (math_parser_token(parser, peek++, &argument_name) != LERR_OK || argument_name.kind != TK_SYMBOL) goto check_is_fn;
     String_View name = sv_dup(argument_name.content);
     arrput(arguments, name);
-    if ((lerr = lexer_next_token(&peek, &peek_token)) != LERR_OK) RETURN(MERR_OK);
+    if (math_parser_token(parser, peek++, &peek_token) != LERR_OK) RETURN(MERR_OK);
     if (peek_token.kind == TK_SEPARATOR) continue; // next argument
     if (peek_token.kind == TK_CLOSE_PAREN) break; // done
     goto check_is_fn;
   }
-  if ((lerr = lexer_next_token(&peek, &peek_token)) != LERR_OK || peek_token.kind != TK_ASSIGN) RETURN(MERR_OK);
+  if (math_parser_token(parser, peek++, &peek_token) != LERR_OK || peek_token.kind != TK_ASSIGN) RETURN(MERR_OK);
   if (math_parser_has_function(parser, function_name.content, arrlenu(arguments)))
   {
-    lexer_dump_err(function_name.loc, stderr, "Function " SV_Fmt " already defined", SV_Arg(function_name.content));
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_FUNCTION_DEFINED, .loc = function_name.loc, .text = function_name.content });
     RETURN(MERR_SYMBOL_ALREADY_SET);
   }
   *fn = (MathUserFunction) {
@@ -376,7 +537,7 @@ static MathParserError math_parser_parse_function_def(MathParser *parser, MathUs
     .argument_names = arguments,
   };
   arguments = NULL;
-  parser->lexer = peek; // make sure RPN starts from here
+  parser->next_token = peek; // make sure RPN starts from here
 
 return_defer:
   size = arrlenu(arguments);
@@ -396,272 +557,14 @@ check_is_fn:
     if (peek_token.kind == TK_CLOSE_PAREN)
     {
       // got a ) followed by something that wasn't =, assume this is not a function definition and bail
-      if ((lerr = lexer_next_token(&peek, &peek_token)) != LERR_OK || peek_token.kind != TK_ASSIGN) return MERR_OK;
-      lexer_dump_err(error_token.loc, stderr, "Token %s not valid in function definition, expected a list of arguments, got " SV_Fmt, lexer_strtokenkind(error_token.kind), SV_Arg(error_token.content));
+      if (math_parser_token(parser, peek, &peek_token) != LERR_OK || peek_token.kind != TK_ASSIGN) RETURN(MERR_OK);
+      math_parser_report(parser, (Diagnostic) { .code = DIAG_INVALID_ARGUMENT_LIST, .loc = error_token.loc, .text = error_token.content, .value.integer = error_token.kind });
       RETURN(MERR_OPERATOR_ERROR);
     }
-  } while ((lerr = lexer_next_token(&peek, &peek_token)) == LERR_OK);
+  } while (math_parser_token(parser, peek++, &peek_token) == LERR_OK);
   goto return_defer;
 }
 
-static MathParserError math_parser_check_operand(const MathOperator operand, double *doubleval)
-{
-  if (operand.token.kind != TK_INTEGER && operand.token.kind != TK_REAL)
-  {
-    lexer_dump_err(operand.token.loc, stderr, "Expected a number, got " SV_Fmt, SV_Arg(operand.token.content));
-    return MERR_OPERATOR_ERROR;
-  }
-  if (doubleval)
-  {
-    *doubleval = operand.token.kind == TK_INTEGER ? (double) operand.token.as.integer.value : operand.token.as.real.value;
-  }
-  return MERR_OK;
-}
-
-static MathParserError math_parser_handle_binary(const MathOperator left, const MathOperator right, const MathOperator op, MathOperator *res)
-{
-  MathParserError err = MERR_OK;
-  double left_value, right_value;
-  MATH_PARSER_TRY(math_parser_check_operand(left, &left_value));
-  MATH_PARSER_TRY(math_parser_check_operand(right, &right_value));
-  assert(op.token.kind == TK_OP);
-  if (left.token.kind == TK_INTEGER && right.token.kind == TK_INTEGER && op.token.as.op != OP_DIV && op.token.as.op != OP_EXP)
-  {
-    int16_t result;
-    switch (op.token.as.op) {
-      case OP_ADD:
-        result = left.token.as.integer.value + right.token.as.integer.value;
-        break;
-      case OP_SUB:
-        result = left.token.as.integer.value - right.token.as.integer.value;
-        break;
-      case OP_MUL:
-        result = left.token.as.integer.value * right.token.as.integer.value;
-        break;
-      case OP_DIV:
-      case OP_EXP:
-        assert(0 && "unreachable");
-    }
-    *res = (MathOperator) {
-      .token = {
-        .kind = TK_INTEGER,
-        .loc = op.token.loc,
-        .as = {
-          .integer = {
-            .value = result,
-          }
-        }
-      }
-    };
-    return MERR_OK;
-  }
-  double result;
-  switch (op.token.as.op) {
-    case OP_ADD:
-      result = left_value + right_value;
-      break;
-    case OP_SUB:
-      result = left_value - right_value;
-      break;
-    case OP_MUL:
-      result = left_value * right_value;
-      break;
-    case OP_DIV:
-      result = left_value / right_value;
-      break;
-    case OP_EXP:
-      result = pow(left_value, right_value);
-      break;
-  }
-  *res = (MathOperator) {
-    .token = {
-      .kind = TK_REAL,
-      .loc = op.token.loc,
-      .as = {
-        .real = {
-          .value = result,
-        }
-      }
-    }
-  };
-return_defer:
-  return err;
-}
-
-static MathParserError math_parser_handle_unary(const MathOperator operand, const MathOperator op, MathOperator *res)
-{
-  MathParserError err = MERR_OK;
-  MATH_PARSER_TRY(math_parser_check_operand(operand, NULL));
-  if (op.token.as.op == OP_ADD)
-  {
-    *res = operand;
-    RETURN(MERR_OK);
-  }
-  assert(op.token.as.op == OP_SUB && "only + and - should be allowed as unary");
-  if (operand.token.kind == TK_INTEGER)
-  {
-    *res = (MathOperator) {
-      .token = {
-        .kind = TK_INTEGER,
-        .loc = op.token.loc,
-        .as = {
-          .integer = {
-            .value = -operand.token.as.integer.value,
-          }
-        }
-      }
-    };
-    RETURN(MERR_OK);
-  }
-  *res = (MathOperator) {
-    .token = {
-      .kind = TK_REAL,
-      .loc = op.token.loc,
-      .as = {
-        .real = {
-          .value = -operand.token.as.real.value,
-        }
-      }
-    }
-  };
-return_defer:
-  return err;
-}
-
-static MathParserError math_parser_eval_one(MathParser *parser, MathOperator *queue, size_t *queue_last, MathVariable *vars, double *result);
-static MathParserError math_parser_handle_function(MathParser *parser, const MathOperator *stack, const MathOperator op, MathOperator *res)
-{
-  MathParserError err;
-  double dvalue;
-  MathVariable *argument_list = NULL;
-  for (size_t i = 0; i < ALEN(MATH_PARSER_BUILTIN_FUNCTIONS); ++i)
-  {
-    if (sv_eq_ignorecase(op.token.content, MATH_PARSER_BUILTIN_FUNCTIONS[i].name) && op.nargs == MATH_PARSER_BUILTIN_FUNCTIONS[i].nargs)
-    {
-      const MathOperator arg = arrpop(stack);
-      MATH_PARSER_TRY(math_parser_check_operand(arg, &dvalue));
-      double result;
-      switch (MATH_PARSER_BUILTIN_FUNCTIONS[i].nargs) {
-        case 1: result = MATH_PARSER_BUILTIN_FUNCTIONS[i].as.unary(dvalue); break;
-        case 2: {
-          const MathOperator arg1 = arrpop(stack);
-          double dvalue1;
-          MATH_PARSER_TRY(math_parser_check_operand(arg1, &dvalue1));
-          result = MATH_PARSER_BUILTIN_FUNCTIONS[i].as.binary(dvalue1, dvalue);
-        } break;
-        default: assert(0 && "unreachable"); break;
-      }
-      *res = (MathOperator) {
-        .token = {
-          .kind = TK_REAL,
-          .loc = op.token.loc,
-          .as = {
-            .real = {
-              .value = result,
-            }
-          }
-        }
-      };
-      RETURN(MERR_OK);
-    }
-  }
-  size_t size = arrlenu(parser->functions);
-  for (size_t i = 0; i < size; ++i)
-  {
-    if (sv_eq_ignorecase(op.token.content, parser->functions[i].name) && op.nargs == parser->functions[i].nargs)
-    {
-      double result;
-      size_t nargs = arrlenu(parser->functions->argument_names);
-      assert(nargs == op.nargs);
-      arrsetcap(argument_list, nargs);
-      for (size_t j = 0; j < nargs; ++j)
-      {
-        // arguments are in reverse order
-        const MathOperator arg = arrpop(stack);
-        MATH_PARSER_TRY(math_parser_check_operand(arg, &dvalue));
-        MathVariable value = (MathVariable) {
-          .name = parser->functions[i].argument_names[nargs - j - 1],
-          .value = dvalue,
-        };
-        arrput(argument_list, value);
-      }
-      MATH_PARSER_TRY(math_parser_eval_one(parser, parser->functions[i].rpn, NULL, argument_list, &result));
-      *res = (MathOperator) {
-        .token = {
-          .kind = TK_REAL,
-          .loc = op.token.loc,
-          .as = {
-            .real = {
-              .value = result,
-            }
-          }
-        }
-      };
-      RETURN(MERR_OK);
-    }
-  }
-  lexer_dump_err(op.token.loc, stderr, "Unrecognized function " SV_Fmt " with %zu argument(s)", SV_Arg(op.token.content), op.nargs);
-  for (size_t i = 0; i < ALEN(MATH_PARSER_BUILTIN_FUNCTIONS); ++i)
-  {
-    if (sv_eq_ignorecase(op.token.content, MATH_PARSER_BUILTIN_FUNCTIONS[i].name))
-    {
-      fprintf(stderr, "NOTE: This function exists with %zu argument(s)\n", MATH_PARSER_BUILTIN_FUNCTIONS[i].nargs);
-    }
-  }
-  for (size_t i = 0; i < size; ++i)
-  {
-    if (sv_eq_ignorecase(op.token.content, parser->functions[i].name))
-    {
-      fprintf(stderr, "NOTE: This function exists with %zu argument(s)\n", parser->functions[i].nargs);
-    }
-  }
-  return MERR_UNRECOGNIZED_SYMBOL;
-return_defer:
-  arrfree(argument_list);
-  return err;
-}
-
-static MathParserError math_parser_handle_variable(MathParser *parser, const MathOperator var, const MathVariable *additional_vars, MathOperator *res)
-{
-  double value;
-  if (math_parser_get_var(parser, var.token.content, &value))
-  {
-    *res = (MathOperator) {
-      .token = {
-        .kind = TK_REAL,
-        .loc = var.token.loc,
-        .as = {
-          .real = {
-            .value = value,
-          }
-        }
-      }
-    };
-    return MERR_OK;
-  }
-  size_t size = arrlenu(additional_vars);
-  for (size_t i = 0; i < size; ++i)
-  {
-    if (sv_eq_ignorecase(var.token.content, additional_vars[i].name))
-    {
-      *res = (MathOperator) {
-        .token = {
-          .kind = TK_REAL,
-          .loc = var.token.loc,
-          .as = {
-            .real = {
-              .value = additional_vars[i].value,
-            }
-          }
-        }
-      };
-      return MERR_OK;
-    }
-  }
-  lexer_dump_err(var.token.loc, stderr, "Unrecognized variable " SV_Fmt, SV_Arg(var.token.content));
-  return MERR_UNRECOGNIZED_SYMBOL;
-}
-
 static void math_parser_output_dup(MathParser *parser, MathUserFunction *fn)
 {
   String_View new_full = sv_dup(parser->lexer.start);
@@ -699,6 +602,7 @@ static void math_parser_function_free(MathUserFunction function)
   arrfree(function.argument_names);
   free((char *)function.lexer_content.data);
   arrfree(function.rpn);
+  math_expr_free(&function.body);
 }
 
 // Implementation
@@ -709,6 +613,15 @@ MathParser math_parser_init(Lexer lexer)
     .lexer = lexer,
     .output_queue = NULL,
     .operator_stack = NULL,
+    .optimize = {
+      .fold_constants = true,
+      .inline_limit = MATH_PARSER_INLINE_LIMIT,
+      .share = true,
+      .reduce_strength = true,
+      .polynomials = true,
+    },
+    .diagnostics_mode = MATH_DIAGNOSTICS_PRINT,
+    .diagnostics_lock = ATOMIC_FLAG_INIT,
   };
 }
 
@@ -723,13 +636,21 @@ MathParserError math_parser_rpn(MathParser *parser)
   };
   MathUserFunction function = {0};
   parser->paren_depth = 0;
+  if (parser->tokens_at.data == NULL || parser->lexer.content.data != parser->tokens_at.data || parser->lexer.content.count != parser->tokens_at.count)
+  {
+    math_parser_tokenize(parser);
+  }
+  else
   {
-    Lexer peek = parser->lexer;
-    while ((lerr = lexer_next_token(&peek, &token)) == LERR_OK)
+    // only keep what the last statement looked ahead at
+    arrdeln(parser->tokens, 0, parser->next_token);
+    parser->next_token = 0;
+  }
+  {
+    Token peektoken;
+    while (math_parser_token(parser, parser->next_token, &token) == LERR_OK && token.kind == TK_SYMBOL &&
+           math_parser_token(parser, parser->next_token + 1, &peektoken) == LERR_OK && peektoken.kind == TK_ASSIGN)
     {
-      if (token.kind != TK_SYMBOL) break;
-      Token peektoken;
-      if (lexer_next_token(&peek, &peektoken) != LERR_OK || peektoken.kind != TK_ASSIGN) break;
       // got `<var> =`, push the var to the operator stack -> will be evaluated last
       // make sure to not include it in actual parsing
       MathOperator var = (MathOperator) {
@@ -738,7 +659,7 @@ MathParserError math_parser_rpn(MathParser *parser)
         .assignment = true,
       };
       arrput(parser->operator_stack, var);
-      parser->lexer = peek;
+      parser->next_token += 2;
     }
   }
   {
@@ -748,19 +669,30 @@ MathParserError math_parser_rpn(MathParser *parser)
       MATH_PARSER_TRY(math_parser_parse_function_def(parser, &function));
     }
   }
-  while ((lerr = lexer_next_token(&parser->lexer, &token)) == LERR_OK)
+  while ((lerr = math_parser_token(parser, parser->next_token, &token)) == LERR_OK)
   {
+    ++parser->next_token;
     // separate equations
     if (token.kind == TK_SEPARATOR && parser->paren_depth == 0) break;
     MATH_PARSER_TRY(math_parser_parse_one_token(parser, token, lasttoken));
     lasttoken = token;
   }
+  if (lerr == LERR_OK) math_parser_sync_lexer(parser);
+  else
+  {
+    // ran into the end of the tokens, the next input is tokenized again
+    parser->lexer = parser->tokens_end;
+    parser->tokens_at = (String_View) {0};
+  }
   if (lerr != LERR_EOF && lerr != LERR_OK)
+  {
+    math_parser_report(parser, parser->lexer.error);
     RETURN(MERR_LEXER_ERROR);
+  }
   if (lasttoken.kind == TK_OP)
   {
-    lexer_dump_err(parser->lexer.loc, stderr, "Unexpected end of input, expected expression");
-    fprintf(stderr, LOC_FMT ": NOTE: Preceded by this operator " SV_Fmt "\n", LOC_ARG(lasttoken.loc), SV_Arg(lasttoken.content));
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_UNEXPECTED_END, .loc = parser->lexer.loc });
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_NOTE_PRECEDED_BY_OPERATOR, .loc = lasttoken.loc, .text = lasttoken.content });
     RETURN(MERR_UNEXPECTED_OPERATOR);
   }
   MathOperator top_op;
@@ -769,7 +701,7 @@ MathParserError math_parser_rpn(MathParser *parser)
     top_op = math_parser_last_op(parser);
     if (top_op.token.kind != TK_OP && !top_op.assignment)
     {
-      lexer_dump_err(top_op.token.loc, stderr, "Unbalanced parenthesis, this ( was not closed");
+      math_parser_report(parser, (Diagnostic) { .code = DIAG_UNBALANCED_OPEN, .loc = top_op.token.loc });
       RETURN(MERR_UNBALANCED_PARENTHESIS);
     }
     arrput(parser->output_queue, arrpop(parser->operator_stack));
@@ -779,116 +711,521 @@ MathParserError math_parser_rpn(MathParser *parser)
   {
     // this moves the output_queue to the function
     math_parser_output_dup(parser, &function);
-    arrput(parser->functions, function);
+    bool added;
+    MATH_PARSER_TRY(math_expr_lower(parser, &function, &function.body, function.rpn, arrlenu(function.rpn), &added));
+    math_parser_add_function(parser, function);
     return err; // NOTE: make sure not to go to defer, since it frees us
   }
 return_defer:
+  if (err != MERR_OK && parser->tokens_at.data != NULL)
+  {
+    // stop behind the token with the error, the caller may continue with a different lexer
+    math_parser_sync_lexer(parser);
+    parser->tokens_at = (String_View) {0};
+  }
   math_parser_function_free(function);
   return err;
 }
 
-static MathParserError math_parser_eval_one(MathParser *parser, MathOperator *queue, size_t *queue_last, MathVariable *vars, double *result)
+// Looks up the late bound function of instruction `pc`, which was not defined at compile time
+static MathParserError math_parser_find_callee(MathParser *parser, const MathExpr *expr, size_t pc, const MathUserFunction **fn)
 {
-  MathOperator op, opresult;
-  MathOperator *stack = NULL;
-  MathParserError err = MERR_OK;
-  size_t size = arrlenu(queue), i = 0;
-  for (; i < size; ++i)
+  const MathInstr instr = expr->code[pc];
+  const String_View name = expr->symbols[instr.arg];
+  ssize_t i = math_parser_find_function(parser, name, instr.nargs);
+  if (i >= 0)
   {
-    op = queue[i];
-    if (op.assignment) break;
-    if (op.token.kind == TK_INTEGER || op.token.kind == TK_REAL)
-    {
-      arrput(stack, op);
-      continue;
-    }
-    else if (op.token.kind == TK_SYMBOL && !op.function)
-    {
-      MATH_PARSER_TRY(math_parser_handle_variable(parser, op, vars, &opresult));
-      arrput(stack, opresult);
-      continue;
-    }
-    else if (op.token.kind != TK_OP && op.token.kind != TK_SYMBOL)
-    {
-      lexer_dump_err(op.token.loc, stderr, "Expected operator, got " SV_Fmt, SV_Arg(op.token.content));
-      RETURN(MERR_OPERATOR_ERROR);
-    }
-    if (arrlenu(stack) < op.nargs)
-    {
-      lexer_dump_err(op.token.loc, stderr, "Not enough operands for operator " SV_Fmt, SV_Arg(op.token.content));
-      RETURN(MERR_OPERATOR_ERROR);
-    }
-    if (op.function)
-    {
-      MATH_PARSER_TRY(math_parser_handle_function(parser, stack, op, &opresult));
-    }
-    else if (op.nargs == 1)
-    {
-      MATH_PARSER_TRY(math_parser_handle_unary(arrpop(stack), op, &opresult));
+    *fn = &parser->functions[i];
+    return MERR_OK;
+  }
+  Diagnostic *diags = NULL;
+  arrput(diags, ((Diagnostic) { .code = DIAG_UNRECOGNIZED_FUNCTION, .loc = expr->debug[pc].loc, .text = name, .value.count = instr.nargs }));
+  for (i = math_parser_find_builtin_function(name, -1); i >= 0 && i < ALEN(MATH_PARSER_BUILTIN_FUNCTIONS) && sv_eq_ignorecase(name, MATH_PARSER_BUILTIN_FUNCTIONS[i].name); ++i)
+  {
+    arrput(diags, ((Diagnostic) { .code = DIAG_NOTE_FUNCTION_ARITY, .value.count = MATH_PARSER_BUILTIN_FUNCTIONS[i].nargs }));
+  }
+  for (i = math_parser_find_function(parser, name, -1); i >= 0; i = parser->functions[i].next_overload)
+  {
+    arrput(diags, ((Diagnostic) { .code = DIAG_NOTE_FUNCTION_ARITY, .value.count = parser->functions[i].nargs }));
+  }
+  math_parser_report_all(parser, diags, arrlenu(diags));
+  arrfree(diags);
+  return MERR_UNRECOGNIZED_SYMBOL;
+}
+
+static MathParserError math_parser_store_var(MathParser *parser, const MathExpr *expr, size_t pc, MathValue value)
+{
+  size_t slot = expr->code[pc].arg;
+  if (parser->variables[slot].defined)
+  {
+    const Diagnostic diags[] = {
+      { .code = DIAG_VARIABLE_SET, .loc = expr->debug[pc].loc, .text = expr->debug[pc].text },
+      { .code = DIAG_NOTE_VARIABLE_VALUE, .value.real = parser->values[slot] },
+    };
+    math_parser_report_all(parser, diags, ALEN(diags));
+    return MERR_SYMBOL_ALREADY_SET;
+  }
+  if (value.integer) math_parser_set_slot_int(parser, slot, value.as.integer);
+  else math_parser_set_slot(parser, slot, value.as.real);
+  return MERR_OK;
+}
+
+// Checks that all global variables read by statement `statement` are defined
+static MathParserError math_parser_check_reads(MathParser *parser, const MathExpr *expr, size_t statement)
+{
+  size_t first = statement == 0 ? 0 : expr->statements[statement - 1].reads_end;
+  for (size_t i = first; i < expr->statements[statement].reads_end; ++i)
+  {
+    if (parser->variables[expr->reads[i]].defined) continue;
+    // cold path, find where it is read for the error message, or report it at the statement
+    size_t start = statement == 0 ? 0 : expr->statements[statement - 1].end, pc = start;
+    while (pc < expr->statements[statement].end && (expr->code[pc].op != BC_LOAD || expr->code[pc].arg != expr->reads[i])) ++pc;
+    if (pc == expr->statements[statement].end) pc = start;
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_UNRECOGNIZED_VARIABLE, .loc = expr->debug[pc].loc, .text = parser->variables[expr->reads[i]].name });
+    return MERR_UNRECOGNIZED_SYMBOL;
+  }
+  return MERR_OK;
+}
+
+// Whether all global variables read by statement `statement` hold integers
+static bool math_parser_reads_integers(const MathParser *parser, const MathExpr *expr, size_t statement)
+{
+  size_t first = statement == 0 ? 0 : expr->statements[statement - 1].reads_end;
+  for (size_t i = first; i < expr->statements[statement].reads_end; ++i)
+  {
+    if (!parser->variables[expr->reads[i]].integer) return false;
+  }
+  return true;
+}
+
+// The integer tier shares the stack of the interpreter, its slots are accessed bitwise
+static inline int64_t math_stack_get_int(const double *slot)
+{
+  int64_t value;
+  memcpy(&value, slot, sizeof(value));
+  return value;
+}
+
+static inline void math_stack_set_int(double *slot, int64_t value)
+{
+  memcpy(slot, &value, sizeof(value));
+}
+
+// Runs integer statement `statement` (see `MathStatement.integer`) on int64_t, reading the exact values of the variables.
+// Overflows are collected and checked once before the assignments, if any operation overflowed nothing is stored,
+// `*overflow` is set and the statement must run on doubles instead. Its temporaries are only read by itself.
+static MathParserError math_expr_run_integer(MathParser *parser, const MathExpr *expr, size_t statement, double *temps, double *stack, bool *overflow, int64_t *result)
+{
+  size_t pc = statement == 0 ? 0 : expr->statements[statement - 1].end;
+  const size_t end = expr->statements[statement].end;
+  const int64_t *const values = parser->integers;
+  size_t sp = 0;
+  bool overflowed = false;
+  for (; pc < end; ++pc)
+  {
+    const MathInstr instr = expr->code[pc];
+    switch ((MathOpcode) instr.op) {
+      case BC_CONST:
+        math_stack_set_int(&stack[sp++], expr->integers[instr.arg]);
+        break;
+      case BC_LOAD:
+        math_stack_set_int(&stack[sp++], values[instr.arg]);
+        break;
+      case BC_SAVE:
+        memcpy(&temps[instr.arg], &stack[sp - 1], sizeof(double));
+        break;
+      case BC_TEMP:
+        memcpy(&stack[sp++], &temps[instr.arg], sizeof(double));
+        break;
+      case BC_NEG: {
+        int64_t value;
+        overflowed |= __builtin_sub_overflow((int64_t) 0, math_stack_get_int(&stack[sp - 1]), &value);
+        math_stack_set_int(&stack[sp - 1], value);
+      } break;
+#define BINARY(_op, _builtin)                               \
+      case _op: {                                           \
+        int64_t left = math_stack_get_int(&stack[sp - 2]);  \
+        int64_t right = math_stack_get_int(&stack[sp - 1]); \
+        int64_t value;                                      \
+        overflowed |= _builtin(left, right, &value);        \
+        math_stack_set_int(&stack[sp - 2], value);          \
+        --sp;                                               \
+      } break;
+      BINARY(BC_ADD, __builtin_add_overflow)
+      BINARY(BC_SUB, __builtin_sub_overflow)
+      BINARY(BC_MUL, __builtin_mul_overflow)
+#undef BINARY
+      case BC_POWI: {
+        int64_t value;
+        overflowed |= math_powi_overflow(math_stack_get_int(&stack[sp - 1]), (int32_t) instr.arg, &value);
+        math_stack_set_int(&stack[sp - 1], value);
+      } break;
+      case BC_FMA: {
+        int64_t a = math_stack_get_int(&stack[sp - 3]);
+        int64_t b = math_stack_get_int(&stack[sp - 2]);
+        int64_t c = math_stack_get_int(&stack[sp - 1]);
+        int64_t product, value;
+        if (instr.arg == 1) overflowed |= __builtin_mul_overflow(b, c, &product) | __builtin_add_overflow(product, a, &value);
+        else overflowed |= __builtin_mul_overflow(a, b, &product) | __builtin_add_overflow(product, c, &value);
+        math_stack_set_int(&stack[sp - 3], value);
+        sp -= 2;
+      } break;
+      case BC_POLY: {
+        int64_t value;
+        overflowed |= math_poly_overflow(expr->integers + instr.arg, instr.nargs, math_stack_get_int(&stack[sp - 1]), &value);
+        math_stack_set_int(&stack[sp - 1], value);
+      } break;
+      case BC_STORE: {
+        if (overflowed) break;
+        MathValue value = { .integer = true, .as.integer = math_stack_get_int(&stack[sp - 1]) };
+        MathParserError err = math_parser_store_var(parser, expr, pc, value);
+        if (err != MERR_OK) return err;
+      } break;
+      default:
+        assert(0 && "not an integer statement");
     }
-    else if (op.nargs == 2)
+  }
+  assert(sp == 1 && "lowering leaves exactly one value per statement");
+  *overflow = overflowed;
+  *result = math_stack_get_int(&stack[0]);
+  return MERR_OK;
+}
+
+// Use direct threaded dispatch with GCC's computed goto where available, define MATH_EXPR_NO_COMPUTED_GOTO to use a switch.
+#if defined(__GNUC__) && !defined(MATH_EXPR_NO_COMPUTED_GOTO)
+#define MATH_EXPR_THREADED 1
+#else
+#define MATH_EXPR_THREADED 0
+#endif
+
+#if MATH_EXPR_THREADED
+// NOTE: computed goto is a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+// Return address of a user function call, the state of the caller to resume when the callee returns
+typedef struct {
+  const MathExpr *expr;
+  size_t pc;        // the call instruction
+  size_t statement;
+  size_t last;
+  size_t args;      // first argument of the caller, if it is a user function
+  size_t base;      // first value of the caller's statements
+} MathCallFrame;
+
+// Runs statements [first, last) of `expr` and returns the value of the last one.
+// The values of the statements are computed on `stack`, which must have room for `expr->max_stack`,
+// right above the temporaries of shared subexpressions (see `math_expr_share`).
+// User functions run on the same stack without recursion: a call pushes a frame holding where to resume the caller,
+// and the callee's arguments are the values the caller left on top of the stack. The body computes its values
+// right above them, and returning replaces the arguments by the result.
+static MathParserError math_expr_run(MathParser *parser, const MathExpr *expr, size_t first, size_t last, double *stack, size_t capacity, MathValue *result)
+{
+  MathParserError err = MERR_OK;
+  MathCallFrame frames[MATH_EXPR_MAX_CALL_DEPTH];
+  size_t depth = 0;
+  size_t statement = first;
+  size_t args = 0; // arguments of the running user function start at `stack[args]`
+  size_t base = expr->ntemps; // values of the running statement start at `stack[base]`, right above the temporaries
+  size_t pc = first == 0 ? 0 : expr->statements[first - 1].end;
+  size_t sp, end;
+  const MathInstr *code = expr->code;
+  const double *consts = expr->consts;
+  const double *values;
+  const MathUserFunction *callee;
+  MathInstr instr;
+  MathValue value;
+  if (first == last) return MERR_INPUT_EMPTY;
+  assert(expr->max_stack <= capacity);
+  assert((first == 0 || expr->ntemps == 0) && "temporaries are saved by earlier statements");
+#if MATH_EXPR_THREADED
+  // NOTE: must list every opcode except BC_COUNT
+  static const void *const dispatch[BC_COUNT] = {
+    [BC_CONST] = &&op_BC_CONST,
+    [BC_LOAD] = &&op_BC_LOAD,
+    [BC_ARG] = &&op_BC_ARG,
+    [BC_NEG] = &&op_BC_NEG,
+    [BC_ADD] = &&op_BC_ADD,
+    [BC_SUB] = &&op_BC_SUB,
+    [BC_MUL] = &&op_BC_MUL,
+    [BC_DIV] = &&op_BC_DIV,
+    [BC_POW] = &&op_BC_POW,
+    [BC_CALL] = &&op_BC_CALL,
+    [BC_CALL1] = &&op_BC_CALL1,
+    [BC_CALL2] = &&op_BC_CALL2,
+    [BC_CALLU] = &&op_BC_CALLU,
+    [BC_STORE] = &&op_BC_STORE,
+    [BC_SAVE] = &&op_BC_SAVE,
+    [BC_TEMP] = &&op_BC_TEMP,
+    [BC_POWI] = &&op_BC_POWI,
+    [BC_FMA] = &&op_BC_FMA,
+    [BC_POLY] = &&op_BC_POLY,
+  };
+#define CASE(_op) op_ ## _op:
+#define DISPATCH() do {                 \
+          instr = code[pc];             \
+          goto *dispatch[instr.op];     \
+        } while (0)
+#define NEXT() do {                     \
+          if (++pc == end) goto done;   \
+          DISPATCH();                   \
+        } while (0)
+#else
+#define CASE(_op) case _op:
+#define NEXT() continue
+#endif
+begin: // runs statement `statement` of `expr`
+  MATH_PARSER_TRY(math_parser_check_reads(parser, expr, statement));
+  end = expr->statements[statement].end;
+  if (expr->statements[statement].integer && math_parser_reads_integers(parser, expr, statement))
+  {
+    bool overflow;
+    int64_t integer;
+    MATH_PARSER_TRY(math_expr_run_integer(parser, expr, statement, stack + base - expr->ntemps, stack + base, &overflow, &integer));
+    if (!overflow)
     {
-      MathOperator right = arrpop(stack);
-      MathOperator left  = arrpop(stack);
-      MATH_PARSER_TRY(math_parser_handle_binary(left, right, op, &opresult));
+      value = (MathValue) { .integer = true, .as.integer = integer };
+      pc = end;
+      goto finish;
     }
-    else
-    {
-      assert(0 && "unexpected arity");
+    // promoted, run again on doubles
+  }
+  // NOTE: only assignments change the binding table, and they do not add slots
+  values = parser->values;
+  sp = base;
+  assert(pc < end && "statements are never empty");
+#if MATH_EXPR_THREADED
+  DISPATCH();
+#else
+  for (; pc < end; ++pc)
+  {
+    instr = code[pc];
+    switch ((MathOpcode) instr.op) {
+#endif
+      CASE(BC_CONST)
+        stack[sp++] = consts[instr.arg];
+        NEXT();
+      CASE(BC_LOAD)
+        stack[sp++] = values[instr.arg];
+        NEXT();
+      CASE(BC_ARG)
+        stack[sp++] = stack[args + instr.arg];
+        NEXT();
+      CASE(BC_SAVE)
+        stack[base - expr->ntemps + instr.arg] = stack[sp - 1];
+        NEXT();
+      CASE(BC_TEMP)
+        stack[sp++] = stack[base - expr->ntemps + instr.arg];
+        NEXT();
+      CASE(BC_NEG)
+        stack[sp - 1] = -stack[sp - 1];
+        NEXT();
+#define BINARY(_op, _expr)              \
+      CASE(_op) {                       \
+        double left = stack[sp - 2];    \
+        double right = stack[sp - 1];   \
+        stack[sp - 2] = (_expr);        \
+        --sp;                           \
+      } NEXT();
+      BINARY(BC_ADD, left + right)
+      BINARY(BC_SUB, left - right)
+      BINARY(BC_MUL, left * right)
+      BINARY(BC_DIV, left / right)
+      BINARY(BC_POW, pow(left, right))
+#undef BINARY
+      CASE(BC_POWI)
+        stack[sp - 1] = math_powi(stack[sp - 1], (int32_t) instr.arg);
+        NEXT();
+      CASE(BC_FMA)
+        if (instr.arg == 1) stack[sp - 3] = fma(stack[sp - 2], stack[sp - 1], stack[sp - 3]);
+        else stack[sp - 3] = fma(stack[sp - 3], stack[sp - 2], stack[sp - 1]);
+        sp -= 2;
+        NEXT();
+      CASE(BC_POLY)
+        stack[sp - 1] = math_poly(consts + instr.arg, instr.nargs, stack[sp - 1]);
+        NEXT();
+      CASE(BC_CALL1)
+        stack[sp - 1] = expr->builtins[instr.arg].as.unary(stack[sp - 1]);
+        NEXT();
+      CASE(BC_CALL2)
+        stack[sp - 2] = expr->builtins[instr.arg].as.binary(stack[sp - 2], stack[sp - 1]);
+        --sp;
+        NEXT();
+      CASE(BC_CALLU)
+        callee = &parser->functions[instr.arg];
+        goto call;
+      CASE(BC_CALL)
+        MATH_PARSER_TRY(math_parser_find_callee(parser, expr, pc, &callee));
+        goto call;
+      CASE(BC_STORE)
+        MATH_PARSER_TRY(math_parser_store_var(parser, expr, pc, (MathValue) { .as.real = stack[sp - 1] }));
+        NEXT();
+#if !MATH_EXPR_THREADED
+      case BC_COUNT:
+        assert(0 && "unreachable");
     }
-    arrput(stack, opresult);
+resume:;
   }
-  size = arrlenu(stack);
-  if (size == 0)
+#endif
+#if MATH_EXPR_THREADED
+done:
+#endif
+  assert(sp == base + 1 && "lowering leaves exactly one value per statement");
+  value = (MathValue) { .as.real = stack[base] };
+finish:
+  if (++statement < last) goto begin;
+  if (depth == 0)
   {
-    RETURN(MERR_INPUT_EMPTY);
+    *result = value;
+    RETURN(MERR_OK);
   }
-  if (size > 1)
+  // return from the user function, its value replaces the arguments on the caller's stack
+  stack[args] = math_value_real(value);
+  sp = args + 1;
+  --depth;
+  expr = frames[depth].expr;
+  pc = frames[depth].pc;
+  statement = frames[depth].statement;
+  last = frames[depth].last;
+  args = frames[depth].args;
+  base = frames[depth].base;
+  code = expr->code;
+  consts = expr->consts;
+  values = parser->values;
+  end = expr->statements[statement].end;
+#if MATH_EXPR_THREADED
+  NEXT();
+#else
+  goto resume;
+#endif
+
+call: // calls `callee` from instruction `pc`, with the top `nargs` values of the stack as arguments
+  assert(arrlenu(callee->argument_names) == callee->nargs);
+  sp -= instr.nargs;
+  if (depth >= MATH_EXPR_MAX_CALL_DEPTH || sp + callee->nargs + callee->body.max_stack > capacity)
   {
-    lexer_dump_err(parser->lexer.loc, stderr, "Unconsumed input on stack");
-    RETURN(MERR_OPERATOR_ERROR);
+    const Diagnostic diags[] = {
+      { .code = DIAG_STACK_OVERFLOW, .loc = expr->debug[pc].loc, .text = callee->name },
+      { .code = DIAG_NOTE_CALL_DEPTH, .value.count = MATH_EXPR_MAX_CALL_DEPTH },
+    };
+    math_parser_report_all(parser, diags, depth >= MATH_EXPR_MAX_CALL_DEPTH ? 2 : 1);
+    RETURN(MERR_STACK_OVERFLOW);
   }
-  opresult = arrpop(stack);
-  MATH_PARSER_TRY(math_parser_check_operand(opresult, result));
-  if (queue_last) *queue_last = i;
+  if (arrlenu(callee->body.statements) == 0) RETURN(MERR_INPUT_EMPTY);
+  frames[depth++] = (MathCallFrame) {
+    .expr = expr,
+    .pc = pc,
+    .statement = statement,
+    .last = last,
+    .args = args,
+    .base = base,
+  };
+  expr = &callee->body;
+  code = expr->code;
+  consts = expr->consts;
+  statement = 0;
+  last = arrlenu(expr->statements);
+  pc = 0;
+  args = sp;
+  base = sp + callee->nargs + expr->ntemps;
+  goto begin;
+#undef CASE
+#undef NEXT
+#undef DISPATCH
 return_defer:
-  arrfree(stack);
+  return err;
+}
+#if MATH_EXPR_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+static MathParserError math_expr_eval_range(MathParser *parser, const MathExpr *expr, size_t first, size_t last, MathValue *result)
+{
+  double local[MATH_EXPR_STACK_SIZE];
+  if (expr->max_stack <= MATH_EXPR_STACK_SIZE)
+  {
+    return math_expr_run(parser, expr, first, last, local, MATH_EXPR_STACK_SIZE, result);
+  }
+  // leave the usual room for user functions
+  size_t capacity = expr->max_stack + MATH_EXPR_STACK_SIZE;
+  double *stack = malloc(capacity * sizeof(stack[0]));
+  assert(stack != NULL);
+  MathParserError err = math_expr_run(parser, expr, first, last, stack, capacity, result);
+  free(stack);
+  return err;
+}
+
+// Parses the next statement from the parser's lexer and appends it to `expr`.
+// Empty statements are skipped, `*added` tells whether anything was appended.
+static MathParserError math_expr_append_statement(MathParser *parser, MathExpr *expr, bool *added)
+{
+  MathParserError err = math_parser_rpn(parser);
+  *added = false;
+  if (err == MERR_OK)
+  {
+    err = math_expr_lower(parser, NULL, expr, parser->output_queue, arrlenu(parser->output_queue), added);
+  }
+  math_parser_clear(parser);
   return err;
 }
 
 MathParserError math_parser_eval(MathParser *parser, double *result)
 {
   assert(parser != NULL);
-  size_t i;
   MathParserError err = MERR_OK;
-  MathOperator op;
-  MATH_PARSER_TRY(math_parser_eval_one(parser, parser->output_queue, &i, NULL, result));
-  // handle assignments now
-  size_t size = arrlenu(parser->output_queue);
-  for (; i < size; ++i)
-  {
-    op = parser->output_queue[i];
-    assert(op.assignment && "Expected to only have assignments on the stack by now");
-    if (!math_parser_set_var(parser, op.token.content, *result))
-    {
-      lexer_dump_err(op.token.loc, stderr, "Variable with name " SV_Fmt " already set", SV_Arg(op.token.content));
-      double val;
-      bool worked = math_parser_get_var(parser, op.token.content, &val);
-      assert(worked && "We just got a fail...");
-      fprintf(stderr, "NOTE: It has this value: %lf\n", val);
-      RETURN(MERR_SYMBOL_ALREADY_SET);
-    }
-  }
+  MathExpr expr = {0};
+  MathValue value;
+  bool added;
+  MATH_PARSER_TRY(math_expr_lower(parser, NULL, &expr, parser->output_queue, arrlenu(parser->output_queue), &added));
+  MATH_PARSER_TRY(math_expr_eval_range(parser, &expr, 0, arrlenu(expr.statements), &value));
+  *result = math_value_real(value);
   // should be pop from front -> iterate, then clear
   // allows to reuse allocated memory for next run
   arrsetlen(parser->output_queue, 0);
 return_defer:
+  math_expr_free(&expr);
   return err;
 }
 
+void math_parser_report(MathParser *parser, Diagnostic diag)
+{
+  math_parser_report_all(parser, &diag, 1);
+}
+
+void math_parser_report_all(MathParser *parser, const Diagnostic *diags, size_t count)
+{
+  assert(parser != NULL);
+  if (parser->diagnostics_mode == MATH_DIAGNOSTICS_IGNORE) return;
+  // evaluations may run on several threads, errors are rare enough to spin
+  while (atomic_flag_test_and_set_explicit(&parser->diagnostics_lock, memory_order_acquire));
+  for (size_t i = 0; i < count; ++i)
+  {
+    switch (parser->diagnostics_mode) {
+      case MATH_DIAGNOSTICS_PRINT:
+        diag_print(&diags[i], stderr);
+        break;
+      case MATH_DIAGNOSTICS_COLLECT:
+        assert((diag_is_note(diags[i].code) <= (arrlenu(parser->diagnostics) > 0)) && "notes must follow an error");
+        arrput(parser->diagnostics, diags[i]);
+        break;
+      case MATH_DIAGNOSTICS_IGNORE:
+        break;
+    }
+  }
+  atomic_flag_clear_explicit(&parser->diagnostics_lock, memory_order_release);
+}
+
+void math_parser_clear_diagnostics(MathParser *parser)
+{
+  assert(parser != NULL);
+  arrsetlen(parser->diagnostics, 0);
+}
+
 void math_parser_free(MathParser *parser)
 {
   assert(parser != NULL);
+  arrfree(parser->diagnostics);
+  arrfree(parser->tokens);
   arrfree(parser->output_queue);
   arrfree(parser->operator_stack);
   size_t size = arrlenu(parser->variables);
@@ -897,6 +1234,8 @@ void math_parser_free(MathParser *parser)
     free((void *) parser->variables[i].name.data);
   }
   arrfree(parser->variables);
+  arrfree(parser->values);
+  arrfree(parser->integers);
   size = arrlenu(parser->functions);
   for (size_t i = 0; i < size; ++i)
   {
@@ -904,6 +1243,8 @@ void math_parser_free(MathParser *parser)
     math_parser_function_free(function);
   }
   arrfree(parser->functions);
+  shfree(parser->variable_index);
+  shfree(parser->function_index);
 }
 
 void math_parser_clear(MathParser *parser)
@@ -914,58 +1255,215 @@ void math_parser_clear(MathParser *parser)
 }
 
 MathParserError math_parser_evaluate_input(MathParser *parser, Lexer input, double *result)
+{
+  assert(result != NULL);
+  MathValue value;
+  MathParserError err = math_parser_evaluate_input_value(parser, input, &value);
+  if (err == MERR_OK) *result = math_value_real(value);
+  return err;
+}
+
+MathParserError math_parser_evaluate_input_value(MathParser *parser, Lexer input, MathValue *result)
 {
   assert(parser != NULL);
   assert(result != NULL);
   assert(arrlenu(parser->operator_stack) == 0 && "Unclean parser given");
   assert(arrlenu(parser->output_queue) == 0 && "Unclean parser given");
   parser->lexer = input;
+  parser->tokens_at = (String_View) {0}; // tokenize the new input, even if it is at the address of an old one
   MathParserError err = MERR_INPUT_EMPTY;
+  MathExpr expr = {0};
+  // NOTE: statements are evaluated one by one as they are parsed, later statements may depend on earlier assignments
   while (parser->lexer.content.count > 0)
   {
-    MATH_PARSER_TRY(math_parser_rpn(parser));
-    err = math_parser_eval(parser, result);
+    bool added;
+    MATH_PARSER_TRY(math_expr_append_statement(parser, &expr, &added));
+    if (!added) continue;
+    size_t count = arrlenu(expr.statements);
+    err = math_expr_eval_range(parser, &expr, count - 1, count, result);
     if (err == MERR_INPUT_EMPTY) continue;
     MATH_PARSER_TRY(err);
-    err = MERR_OK;
   }
 return_defer:
   if (err == MERR_INPUT_EMPTY)
   {
-    lexer_dump_err(parser->lexer.loc, stderr, "Input empty");
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_INPUT_EMPTY, .loc = parser->lexer.loc });
   }
+  math_expr_free(&expr);
   return err;
 }
 
-bool math_parser_set_var(MathParser *parser, String_View name, double value)
+MathParserError math_parser_compile(MathParser *parser, Lexer input, MathExpr *expr)
 {
-  if (math_parser_get_var(parser, name, NULL)) return false;
-  MathVariable var = (MathVariable) {
-    .name = sv_dup(name),
-    .value = value,
+  assert(parser != NULL);
+  assert(expr != NULL);
+  assert(arrlenu(parser->operator_stack) == 0 && "Unclean parser given");
+  assert(arrlenu(parser->output_queue) == 0 && "Unclean parser given");
+  MathParserError err = MERR_OK;
+  *expr = (MathExpr) {
+    .source = sv_dup(input.content),
   };
-  arrput(parser->variables, var);
+  // tokens point into the source, so parse our own copy
+  parser->lexer = input;
+  parser->lexer.content = expr->source;
+  parser->lexer.start = expr->source;
+  parser->tokens_at = (String_View) {0}; // tokenize the new input, even if it is at the address of an old one
+  while (parser->lexer.content.count > 0)
+  {
+    bool added;
+    MATH_PARSER_TRY(math_expr_append_statement(parser, expr, &added));
+  }
+  if (arrlenu(expr->statements) == 0)
+  {
+    math_parser_report(parser, (Diagnostic) { .code = DIAG_INPUT_EMPTY, .loc = parser->lexer.loc });
+    RETURN(MERR_INPUT_EMPTY);
+  }
+  if (parser->optimize.share) (void) math_expr_share(expr);
+  if (parser->optimize.jit) (void) math_jit_compile(expr); // interpreted if not supported
+return_defer:
+  parser->lexer = EMPTY_LEXER;
+  return err;
+}
+
+// The native code computes the last statement on doubles, integer statements on integers keep to the interpreter
+static bool math_expr_use_jit(const MathParser *parser, const MathExpr *expr)
+{
+  size_t last = arrlenu(expr->statements) - 1;
+  return expr->jit.fn && !(expr->statements[last].integer && math_parser_reads_integers(parser, expr, last));
+}
+
+// The native code computes the last statement, the others have no effects besides checking their reads
+static MathParserError math_expr_run_jit(MathParser *parser, const MathExpr *expr, double *stack, MathValue *result)
+{
+  size_t count = arrlenu(expr->statements);
+  for (size_t statement = 0; statement < count; ++statement)
+  {
+    MathParserError err = math_parser_check_reads(parser, expr, statement);
+    if (err != MERR_OK) return err;
+  }
+  *result = (MathValue) { .as.real = expr->jit.fn(parser->values, stack) };
+  return MERR_OK;
+}
+
+MathParserError math_expr_eval(MathParser *parser, const MathExpr *expr, double *result)
+{
+  assert(result != NULL);
+  MathValue value;
+  MathParserError err = math_expr_eval_value(parser, expr, &value);
+  if (err == MERR_OK) *result = math_value_real(value);
+  return err;
+}
+
+MathParserError math_expr_eval_value(MathParser *parser, const MathExpr *expr, MathValue *result)
+{
+  assert(parser != NULL);
+  assert(expr != NULL);
+  assert(result != NULL);
+  if (expr->max_stack <= MATH_EXPR_STACK_SIZE && math_expr_use_jit(parser, expr))
+  {
+    double stack[MATH_EXPR_STACK_SIZE];
+    return math_expr_run_jit(parser, expr, stack, result);
+  }
+  return math_expr_eval_range(parser, expr, 0, arrlenu(expr->statements), result);
+}
+
+MathParserError math_expr_eval_stack(MathParser *parser, const MathExpr *expr, double *stack, size_t capacity, double *result)
+{
+  assert(parser != NULL);
+  assert(expr != NULL);
+  assert(stack != NULL);
+  assert(result != NULL);
+  assert(capacity >= expr->max_stack && "stack too small for expression");
+  MathValue value;
+  MathParserError err = math_expr_use_jit(parser, expr)
+    ? math_expr_run_jit(parser, expr, stack, &value)
+    : math_expr_run(parser, expr, 0, arrlenu(expr->statements), stack, capacity, &value);
+  if (err == MERR_OK) *result = math_value_real(value);
+  return err;
+}
+
+void math_expr_free(MathExpr *expr)
+{
+  assert(expr != NULL);
+  free((char *)expr->source.data);
+  arrfree(expr->code);
+  arrfree(expr->consts);
+  arrfree(expr->integers);
+  arrfree(expr->symbols);
+  arrfree(expr->builtins);
+  arrfree(expr->statements);
+  arrfree(expr->reads);
+  arrfree(expr->debug);
+  math_jit_free(&expr->jit);
+  *expr = (MathExpr) {0};
+}
+
+bool math_parser_set_var(MathParser *parser, String_View name, double value)
+{
+  ssize_t slot = math_parser_bind_var(parser, name);
+  if (slot < 0 || parser->variables[slot].defined) return false;
+  math_parser_set_slot(parser, slot, value);
+  return true;
+}
+
+bool math_parser_set_int_var(MathParser *parser, String_View name, int64_t value)
+{
+  ssize_t slot = math_parser_bind_var(parser, name);
+  if (slot < 0 || parser->variables[slot].defined) return false;
+  math_parser_set_slot_int(parser, slot, value);
   return true;
 }
 
 bool math_parser_get_var(MathParser *parser, String_View name, double *value)
 {
-  for (size_t i = 0; i < ALEN(MATH_PARSER_BUILTIN_CONSTANTS); ++i)
+  ssize_t i = math_parser_find_builtin_constant(name);
+  if (i >= 0)
   {
-    if (sv_eq_ignorecase(name, MATH_PARSER_BUILTIN_CONSTANTS[i].name))
-    {
-      if (value) *value = MATH_PARSER_BUILTIN_CONSTANTS[i].value;
-      return true;
-    }
+    if (value) *value = MATH_PARSER_BUILTIN_CONSTANTS[i].value;
+    return true;
   }
-  size_t size = arrlenu(parser->variables);
-  for (size_t i = 0; i < size; ++i)
+  i = math_parser_find_variable(parser, name);
+  if (i >= 0 && parser->variables[i].defined)
   {
-    if (sv_eq_ignorecase(name, parser->variables[i].name))
-    {
-      if (value) *value = parser->variables[i].value;
-      return true;
-    }
+    if (value) *value = parser->values[i];
+    return true;
   }
   return false;
 }
+
+ssize_t math_parser_bind_var(MathParser *parser, String_View name)
+{
+  assert(parser != NULL);
+  if (math_parser_find_builtin_constant(name) >= 0) return -1;
+  ssize_t slot = math_parser_find_variable(parser, name);
+  if (slot >= 0) return slot;
+  MathBinding binding = (MathBinding) {
+    .name = sv_dup(name),
+    .defined = false,
+  };
+  arrput(parser->variables, binding);
+  arrput(parser->values, NAN);
+  arrput(parser->integers, 0);
+  slot = arrlen(parser->variables) - 1;
+  math_symbol_index_put(&parser->variable_index, binding.name, slot);
+  return slot;
+}
+
+void math_parser_set_slot(MathParser *parser, size_t slot, double value)
+{
+  assert(parser != NULL);
+  assert(slot < arrlenu(parser->variables));
+  parser->variables[slot].defined = true;
+  parser->variables[slot].integer = false;
+  parser->values[slot] = value;
+}
+
+void math_parser_set_slot_int(MathParser *parser, size_t slot, int64_t value)
+{
+  assert(parser != NULL);
+  assert(slot < arrlenu(parser->variables));
+  parser->variables[slot].defined = true;
+  parser->variables[slot].integer = true;
+  parser->values[slot] = (double) value;
+  parser->integers[slot] = value;
+}
@@ -1,7 +1,25 @@
 #pragma once
 
+#include <stdatomic.h>
 #include "lexer.h"
 #include "const.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "pool.h"
+
+typedef struct {
+  String_View name;
+  size_t nargs;
+  union {
+    double (*unary)(double);
+    double (*binary)(double, double);
+  } as;
+  // vectorized approximation for batches with MATH_ACCURACY_FAST, see vmath.h
+  union {
+    void (*unary)(double *a, size_t n);
+    void (*binary)(double *left, const double *right, size_t n);
+  } fast;
+} MathBuiltinFunction;
 
 typedef struct {
   Token token;
@@ -10,16 +28,83 @@ typedef struct {
   bool function;
   bool assignment;
   size_t nargs;
+  const MathBuiltinFunction *builtin; // callee of a builtin function call, resolved once its arguments are counted
 } MathOperator;
 
 typedef struct {
-  String_View name;
-  size_t nargs;
+  size_t end;       // end of the statement in `code` (exclusive)
+  size_t reads_end; // end of the statement's slots in `reads` (exclusive)
+  // only integer constants, variables, +, - and * followed by assignments: runs exactly on int64_t
+  // if all variables it reads hold integers, and is promoted to double if any operation overflows
+  bool integer;
+} MathStatement;
+
+// Result of an evaluation, exact if it was computed on integers
+typedef struct {
+  bool integer;
   union {
-    double (*unary)(double);
-    double (*binary)(double, double);
+    int64_t integer;
+    double real;
   } as;
-} MathBuiltinFunction;
+} MathValue;
+
+static inline double math_value_real(MathValue value)
+{
+  return value.integer ? (double) value.as.integer : value.as.real;
+}
+
+// A compiled expression, produced once by `math_parser_compile` and evaluated any number of times.
+// Owns a copy of the source text, the input does not need to outlive it.
+// Variables are bound to slots of the parser that compiled it, and may only be evaluated with that parser.
+// Builtin functions and defined user functions are resolved at compile time, only calls to functions
+// that are not yet defined are looked up in the parser at evaluation time. Small user functions are inlined.
+typedef struct {
+  MathInstr *code;
+  double *consts;
+  int64_t *integers;    // parallel to `consts`, exact values of CONSTs with `nargs` 1 (integer literals)
+  String_View *symbols;
+  MathBuiltinFunction *builtins;
+  MathStatement *statements;
+  uint32_t *reads;      // slots that must be defined before a statement runs
+  MathDebugInfo *debug; // parallel to `code`
+  String_View source;
+  size_t max_stack;     // stack slots needed, not counting calls to user functions
+  size_t folded;        // instructions removed by constant folding
+  size_t inlined;       // calls to user functions replaced by their body
+  size_t shared;        // instructions removed by common subexpression elimination
+  size_t ntemps;        // stack slots below the values of the statements, holding shared subexpressions
+  MathJitCode jit;      // used by `math_expr_eval` if compiled
+} MathExpr;
+
+// Stack slots `math_expr_eval` provides without allocating
+#define MATH_EXPR_STACK_SIZE 1024
+// Maximum nesting of user function calls during evaluation, each takes one call frame instead of recursing
+#define MATH_EXPR_MAX_CALL_DEPTH 256
+
+// Values of the global variable in `slot`, one per row of a batch.
+// Either `values` or `integers` is set, integer columns keep integer statements exact.
+typedef struct {
+  size_t slot;
+  const double *values;
+  const int64_t *integers;
+} MathBatchColumn;
+
+typedef enum {
+  MATH_ACCURACY_EXACT, // libm, the same results as `math_expr_eval`
+  MATH_ACCURACY_FAST,  // vectorized builtin functions, within a few ulp of libm (see vmath.h)
+} MathAccuracy;
+
+typedef struct {
+  MathAccuracy accuracy;
+  MathThreadPool *pool; // spreads the rows over the workers of the pool, NULL runs on the calling thread
+  int64_t *integers;    // if set, also receives the exact results when the statement runs on integers
+  bool *exact;          // if set, tells whether `integers` holds the results of all rows
+} MathBatchOptions;
+
+// Rows evaluated together in a batch, each stack slot holds a vector of this many values
+#define MATH_EXPR_BATCH_BLOCK 256
+// Stack vectors a batch provides for user functions, on top of what the expression needs
+#define MATH_EXPR_BATCH_STACK_SIZE 64
 
 typedef struct {
   String_View name;
@@ -27,6 +112,8 @@ typedef struct {
   String_View *argument_names;
   String_View lexer_content;
   MathOperator *rpn;
+  MathExpr body;
+  ssize_t next_overload; // next function with the same name, -1 if none
 } MathUserFunction;
 
 typedef struct {
@@ -34,13 +121,64 @@ typedef struct {
   double value;
 } MathVariable;
 
+// Entry of the binding table for global variables. The value lives at the same index (the slot) in `MathParser.values`.
+// Slots are created when a variable is first referenced, and stay undefined until it is assigned.
+typedef struct {
+  String_View name;
+  bool defined;
+  bool integer; // the exact value is in `MathParser.integers`, `values` holds it rounded
+} MathBinding;
+
+// stb_ds string map from case folded name to index
+typedef struct {
+  char *key;
+  size_t value;
+} MathSymbolIndex;
+
+// Default `MathOptimizeOptions.inline_limit`, instructions of an inlined call with its arguments substituted
+#define MATH_PARSER_INLINE_LIMIT 64
+// Largest |n| of x^n computed by squaring with `MathOptimizeOptions.reduce_strength`, each step may add an ulp of error
+#define MATH_PARSER_POWI_LIMIT 32
+
+typedef struct {
+  bool fold_constants;  // compute operators and builtin calls on constants at compile time
+  bool jit;             // compile expressions to native code in `math_parser_compile` where supported
+  size_t inline_limit;  // inline calls to user functions into at most this many instructions, 0 disables inlining
+  bool share;           // evaluate repeated subexpressions once in `math_parser_compile`, see `math_expr_share`
+  bool reduce_strength; // x^n for small integers n by multiplications, x / c by x * (1 / c) where that is exact
+  bool contract;        // fuse a * b + c into fma(a, b, c), which rounds once and may change the last bits
+  bool polynomials;     // evaluate sums of terms c * x^k in a single variable as one polynomial, see `math_poly`
+} MathOptimizeOptions;
+
+typedef enum {
+  MATH_DIAGNOSTICS_PRINT,   // print to stderr as they happen
+  MATH_DIAGNOSTICS_COLLECT, // append to `MathParser.diagnostics`, formatted only on request
+  MATH_DIAGNOSTICS_IGNORE,  // drop them, only the returned error codes remain
+} MathDiagnosticsMode;
+
 typedef struct {
   Lexer lexer;
+  // tokens of the current statement and those looked ahead at, so `math_parser_rpn` lexes each token once
+  Token *tokens;         // stb_ds array, indexed with any lookahead
+  size_t next_token;     // next token to parse
+  String_View tokens_at; // `lexer.content` the buffer continues at, a different lexer starts a new buffer
+  Lexer tokens_end;      // lexer after the last buffered token, more tokens are lexed from it when needed
+  LexerError tokens_err; // LERR_OK while there may be more tokens, else why lexing stopped (see `tokens_end.error`)
   MathOperator *output_queue;
   MathOperator *operator_stack;
-  MathVariable *variables;
+  MathBinding *variables;
+  double *values; // indexed by slot
+  int64_t *integers; // indexed by slot, valid for integer bindings
   MathUserFunction *functions;
+  MathSymbolIndex *variable_index; // into `variables`
+  MathSymbolIndex *function_index; // into `functions`, first of all overloads
   size_t paren_depth;
+  MathOptimizeOptions optimize; // used when compiling, `math_parser_init` enables all but the JIT and contraction
+  MathDiagnosticsMode diagnostics_mode; // MATH_DIAGNOSTICS_PRINT after `math_parser_init`
+  // stb_ds array, collected errors each followed by their notes. Evaluations on several threads may report at once,
+  // reading or clearing the array must not overlap them.
+  Diagnostic *diagnostics;
+  atomic_flag diagnostics_lock; // held while an error and its notes are reported
 } MathParser;
 
 typedef enum {
@@ -52,6 +190,7 @@ typedef enum {
   MERR_INPUT_EMPTY,
   MERR_UNRECOGNIZED_SYMBOL,
   MERR_SYMBOL_ALREADY_SET,
+  MERR_STACK_OVERFLOW,
 } MathParserError;
 
 #define RETURN(v) do { \
@@ -64,12 +203,20 @@ typedef enum {
 } while(0)
 
 MathParser math_parser_init(Lexer lexer);
-// Converts infix string contained in lexer to RPN notation.
+// Converts infix string contained in lexer to RPN notation, one statement per call.
 // Result will be in `output_queue` member, can be evaluated with `math_parser_eval`.
+// Each token is lexed once, later calls continue with the tokens the last one looked ahead at as long as
+// `lexer` is where it left it.
 MathParserError math_parser_rpn(MathParser *parser);
 // Evaluates a previously-parsed result by iterating `output_queue`. Clears the queue.
 MathParserError math_parser_eval(MathParser *parser, double *result);
 void math_parser_free(MathParser *parser);
+// Reports an error or note according to `parser->diagnostics_mode`. Notes must follow their error.
+void math_parser_report(MathParser *parser, Diagnostic diag);
+// Reports an error and its notes at once, so they stay together when several threads report.
+void math_parser_report_all(MathParser *parser, const Diagnostic *diags, size_t count);
+// Drops all collected diagnostics, the texts they point to may be free'd afterwards
+void math_parser_clear_diagnostics(MathParser *parser);
 // Use to clear all internal data structures. Only necessary after an error.
 // Does *NOT* clear variables.
 // Must set new lexer after use, or MERR_INPUT_EMPTY will be returned.
@@ -78,5 +225,55 @@ void math_parser_clear(MathParser *parser);
 // Returns the result of the last expression.
 // Essentially calls `math_parser_rpn` and `math_parser_eval` until all input is consumed.
 MathParserError math_parser_evaluate_input(MathParser *parser, Lexer input, double *result);
+// Same as `math_parser_evaluate_input`, but keeps the result exact if it was computed on integers.
+MathParserError math_parser_evaluate_input_value(MathParser *parser, Lexer input, MathValue *result);
+// Compiles all statements contained in `input` into `expr`. Function definitions are registered immediately.
+// `expr` must be free'd with `math_expr_free`, also on error.
+MathParserError math_parser_compile(MathParser *parser, Lexer input, MathExpr *expr);
+// Evaluates all statements in `expr` and returns the result of the last one.
+// Does not modify `expr`. The parser is only modified by assignments, so expressions without assignments
+// may be evaluated from several threads at once, as long as no thread changes the parser concurrently.
+// Uses a stack of MATH_EXPR_STACK_SIZE slots on the C stack, and only allocates if `expr->max_stack` exceeds it.
+MathParserError math_expr_eval(MathParser *parser, const MathExpr *expr, double *result);
+// Same as `math_expr_eval`, but keeps the result exact if it was computed on integers.
+MathParserError math_expr_eval_value(MathParser *parser, const MathExpr *expr, MathValue *result);
+// Same as `math_expr_eval`, but evaluates on the caller provided `stack` of `capacity` slots.
+// `capacity` must be at least `expr->max_stack`, more is needed when calling user functions.
+// Never allocates, except for assignments.
+MathParserError math_expr_eval_stack(MathParser *parser, const MathExpr *expr, double *stack, size_t capacity, double *result);
+// Evaluates the last statement of `expr` once for each of `rows` rows and writes the results to `out`.
+// Variables with a column in `columns` take their value from the row, all others from the parser.
+// Runs one instruction over a block of rows at a time. Earlier statements only have their reads checked,
+// assignments are not supported. `options` may be NULL for the defaults (exact, on the calling thread).
+// With a thread pool, `expr` and `parser` are shared read-only by the workers and must not change during the call.
+MathParserError math_expr_eval_batch(MathParser *parser, const MathExpr *expr, const MathBatchColumn *columns, size_t ncolumns, size_t rows, double *out, const MathBatchOptions *options);
+void math_expr_free(MathExpr *expr);
+// Lowers one statement in RPN (as produced by `math_parser_rpn`) into bytecode and appends it to `expr`.
+// Statements without a value (e.g. only assignments) are skipped, `*added` tells whether anything was appended.
+// Symbols are resolved in `parser`, to the arguments of `fn` first if lowering the body of a user function.
+MathParserError math_expr_lower(MathParser *parser, const MathUserFunction *fn, MathExpr *expr, const MathOperator *queue, size_t size, bool *added);
+// Common subexpression elimination: builds a DAG of `expr` where identical pure operations on the same operands
+// are one node, across all statements. Nodes used more than once are computed the first time, saved in a temporary
+// (BC_SAVE) and read back (BC_TEMP) everywhere else. Integer statements only share within themselves,
+// so their temporaries are never read by a statement of the other tier. Returns the instructions removed.
+size_t math_expr_share(MathExpr *expr);
+void math_expr_dump(const MathExpr *expr, FILE *stream);
+// Compiles `expr` to native code, which `math_expr_eval` then uses instead of the interpreter.
+// Only expressions without assignments and calls to user functions are supported, returns false if `expr` is not compiled.
+bool math_jit_compile(MathExpr *expr);
+void math_jit_free(MathJitCode *jit);
+// Returns the index of user function `name` with `nargs` arguments in `parser->functions`, or -1.
+// `nargs` < 0 matches any number of arguments.
+ssize_t math_parser_find_function(const MathParser *const parser, String_View name, ssize_t nargs);
+// Defines variable `name`. Fails if it is a builtin constant or already defined.
 bool math_parser_set_var(MathParser *parser, String_View name, double value);
 bool math_parser_get_var(MathParser *parser, String_View name, double *value);
+// Returns the slot of variable `name` in the binding table, creating an undefined one if needed.
+// Returns -1 for builtin constants, they are not bound to slots.
+ssize_t math_parser_bind_var(MathParser *parser, String_View name);
+// Defines or redefines the variable in `slot`. Compiled expressions see the new value on their next evaluation.
+void math_parser_set_slot(MathParser *parser, size_t slot, double value);
+// Same as `math_parser_set_slot`, but keeps the exact value for integer statements.
+void math_parser_set_slot_int(MathParser *parser, size_t slot, int64_t value);
+// Defines variable `name` as an exact integer. Fails if it is a builtin constant or already defined.
+bool math_parser_set_int_var(MathParser *parser, String_View name, int64_t value);
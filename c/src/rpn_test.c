@@ -1,3 +1,4 @@
+#include "format.h"
 #include "lexer.h"
 #include "rpn.h"
 #include "stb_ds.h"
@@ -23,11 +24,24 @@ int main(int argc, char *argv[])
         printf(" " SV_Fmt, SV_Arg(parser.output_queue[i].token.content));
       }
       printf("\n");
+      MathExpr expr = {0};
+      bool added;
+      if (math_expr_lower(&parser, NULL, &expr, parser.output_queue, arrlenu(parser.output_queue), &added) == MERR_OK)
+      {
+        printf("Bytecode:\n");
+        math_expr_dump(&expr, stdout);
+      }
+      math_expr_free(&expr);
       double result;
       err = math_parser_eval(&parser, &result);
       if (err != MERR_OK)
         fprintf(stderr, "Evaluation stopped abnormally with error %d\n", err);
-      else printf("Result: %lf\n", result);
+      else
+      {
+        char buf[MATH_FORMAT_BUFFER_SIZE];
+        math_format_double(result, buf);
+        printf("Result: %s\n", buf);
+      }
     }
     math_parser_free(&parser);
   }
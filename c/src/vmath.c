@@ -0,0 +1,338 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "vmath.h"
+
+// GCC vector extensions, compiled to whatever SIMD the target has
+typedef double v4d __attribute__((vector_size(32)));
+typedef int64_t v4di __attribute__((vector_size(32)));
+#define LANES 4
+// Inlined into the array loops, vectors are never passed to real calls
+#define VINLINE inline __attribute__((always_inline))
+#if defined(__x86_64__) && defined(__linux__)
+#include <emmintrin.h>
+// The array loops are also compiled for AVX2, the loader picks the version the CPU supports.
+// Without FMA, so both compute the same results.
+#define VCLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define VCLONES
+#endif
+
+// Private functions
+
+static VINLINE v4d vsplat(double x)
+{
+  return (v4d) { x, x, x, x };
+}
+
+// Lanes of `a` where `mask` is set, of `b` elsewhere
+static VINLINE v4d vsel(v4di mask, v4d a, v4d b)
+{
+  return (v4d) (((v4di) a & mask) | ((v4di) b & ~mask));
+}
+
+static VINLINE v4d vabs(v4d x)
+{
+  return (v4d) ((v4di) x & INT64_MAX);
+}
+
+static VINLINE v4d vcopysign(v4d x, v4d sign)
+{
+  return (v4d) (((v4di) x & INT64_MAX) | ((v4di) sign & INT64_MIN));
+}
+
+static VINLINE v4d vsqrt(v4d x)
+{
+#ifdef __SSE2__
+  __m128d lo = _mm_sqrt_pd((__m128d) { x[0], x[1] }), hi = _mm_sqrt_pd((__m128d) { x[2], x[3] });
+  return (v4d) { lo[0], lo[1], hi[0], hi[1] };
+#else
+  for (int i = 0; i < LANES; ++i) x[i] = sqrt(x[i]);
+  return x;
+#endif
+}
+
+// Clears the low 32 bits of the mantissa
+static VINLINE v4d vtrunc32(v4d x)
+{
+  return (v4d) ((v4di) x & (int64_t) 0xFFFFFFFF00000000);
+}
+
+// Recomputes the lanes selected by `mask` with the scalar function `f`
+static VINLINE v4d vfallback(v4di mask, v4d x, v4d r, double (*f)(double))
+{
+  if ((mask[0] | mask[1] | mask[2] | mask[3]) == 0) return r;
+  for (int i = 0; i < LANES; ++i)
+  {
+    if (mask[i]) r[i] = f(x[i]);
+  }
+  return r;
+}
+
+// Applies the vector function `_kernel` to `a[0..n)`, padding the last step with zeros
+#define VECTORIZE(_name, _kernel)                   \
+  VCLONES void _name(double *a, size_t n)           \
+  {                                                 \
+    size_t i = 0;                                   \
+    v4d x;                                          \
+    for (; i + LANES <= n; i += LANES)              \
+    {                                               \
+      memcpy(&x, a + i, sizeof(x));                 \
+      x = _kernel(x);                               \
+      memcpy(a + i, &x, sizeof(x));                 \
+    }                                               \
+    if (i == n) return;                             \
+    x = vsplat(0);                                  \
+    memcpy(&x, a + i, (n - i) * sizeof(double));    \
+    x = _kernel(x);                                 \
+    memcpy(a + i, &x, (n - i) * sizeof(double));    \
+  }
+
+// sin, cos and tan (fdlibm k_sin.c, k_cos.c, e_rem_pio2.c)
+
+static const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03, S3 = -1.98412698298579493134e-04,
+                    S4 = 2.75573137070700676789e-06, S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+static const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03, C3 = 2.48015872894767294178e-05,
+                    C4 = -2.75573143513906633035e-07, C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+// pi/2 split in parts of 33 bits, their products with n < 2^20 are exact
+static const double INVPIO2 = 6.36619772367581382433e-01, PIO2_1 = 1.57079632673412561417e+00,
+                    PIO2_2 = 6.07710050630396597660e-11, PIO2_3 = 2.02226624871116645580e-21,
+                    PIO2_3T = 8.47842766036889956997e-32;
+#define MATH_VTRIG_LIMIT 0x1p20
+
+// sin(x + y) for |x| <= pi/4, |y| <= ulp(x)
+static VINLINE v4d vksin(v4d x, v4d y)
+{
+  v4d z = x * x, w = z * z;
+  v4d r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+  v4d v = z * x;
+  return x - ((z * (0.5 * y - v * r) - y) - v * S1);
+}
+
+// cos(x + y) for |x| <= pi/4, |y| <= ulp(x)
+static VINLINE v4d vkcos(v4d x, v4d y)
+{
+  v4d z = x * x, w = z * z;
+  v4d r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+  v4d hz = 0.5 * z;
+  w = 1.0 - hz;
+  return w + (((1.0 - w) - hz) + (z * r - x * y));
+}
+
+// a + b = s + e exactly
+static VINLINE void vtwosum(v4d a, v4d b, v4d *s, v4d *e)
+{
+  *s = a + b;
+  v4d bb = *s - a;
+  *e = (a - (*s - bb)) + (b - bb);
+}
+
+// Reduces x to y0 + y1 in [-pi/4, pi/4] (roughly) and returns the quadrant in the low 2 bits of `n`.
+// Only valid for |x| <= MATH_VTRIG_LIMIT.
+static VINLINE void vrem_pio2(v4d x, v4d *y0, v4d *y1, v4di *n)
+{
+  const double magic = 0x1.8p52; // adding it rounds to an integer, which ends up in the low mantissa bits
+  v4d t = x * INVPIO2 + magic;
+  v4d fn = t - magic;
+  *n = (v4di) t;
+  v4d r = x - fn * PIO2_1; // exact
+  v4d e1, e2;
+  vtwosum(r, -(fn * PIO2_2), &r, &e1);
+  vtwosum(r, -(fn * PIO2_3), &r, &e2);
+  v4d tail = (e1 + e2) - fn * PIO2_3T;
+  *y0 = r + tail;
+  *y1 = (r - *y0) + tail;
+}
+
+static VINLINE v4d vsin(v4d x)
+{
+  v4d y0, y1;
+  v4di n;
+  vrem_pio2(x, &y0, &y1, &n);
+  v4d s = vksin(y0, y1), c = vkcos(y0, y1);
+  v4d r = vsel((n & 1) != 0, c, s);
+  r = vsel((n & 2) != 0, -r, r);
+  r = vsel(vabs(x) < 0x1p-27, x, r); // keeps the sign of zero
+  return vfallback(~(vabs(x) <= MATH_VTRIG_LIMIT), x, r, sin);
+}
+
+static VINLINE v4d vcos(v4d x)
+{
+  v4d y0, y1;
+  v4di n;
+  vrem_pio2(x, &y0, &y1, &n);
+  v4d s = vksin(y0, y1), c = vkcos(y0, y1);
+  v4d r = vsel((n & 1) != 0, s, c);
+  r = vsel(((n + 1) & 2) != 0, -r, r);
+  return vfallback(~(vabs(x) <= MATH_VTRIG_LIMIT), x, r, cos);
+}
+
+static VINLINE v4d vtan(v4d x)
+{
+  v4d y0, y1;
+  v4di n;
+  vrem_pio2(x, &y0, &y1, &n);
+  v4d s = vksin(y0, y1), c = vkcos(y0, y1);
+  v4d r = vsel((n & 1) != 0, -c / s, s / c);
+  r = vsel(vabs(x) < 0x1p-27, x, r);
+  return vfallback(~(vabs(x) <= MATH_VTRIG_LIMIT), x, r, tan);
+}
+
+// asin and acos (fdlibm e_asin.c, e_acos.c)
+
+static const double PIO2_HI = 1.57079632679489655800e+00, PIO2_LO = 6.12323399573676603587e-17,
+                    PIO4_HI = 7.85398163397448278999e-01, PI = 3.14159265358979311600e+00;
+static const double PS0 = 1.66666666666666657415e-01, PS1 = -3.25565818622400915405e-01, PS2 = 2.01212532134862925881e-01,
+                    PS3 = -4.00555345006794114027e-02, PS4 = 7.91534994289814532176e-04, PS5 = 3.47933107596021167570e-05,
+                    QS1 = -2.40339491173441421878e+00, QS2 = 2.02094576023350569471e+00, QS3 = -6.88283971605453293030e-01,
+                    QS4 = 7.70381505559019352791e-02;
+
+static VINLINE v4d vasin_r(v4d t)
+{
+  v4d p = t * (PS0 + t * (PS1 + t * (PS2 + t * (PS3 + t * (PS4 + t * PS5)))));
+  v4d q = 1.0 + t * (QS1 + t * (QS2 + t * (QS3 + t * QS4)));
+  return p / q;
+}
+
+static VINLINE v4d vasin(v4d x)
+{
+  v4d ax = vabs(x);
+  v4di small = ax < 0.5;
+  v4d t = vsel(small, x * x, (1.0 - ax) * 0.5);
+  v4d r = vasin_r(t);
+  v4d s = vsqrt(t);
+  v4d near_one = PIO2_HI - (2.0 * (s + s * r) - PIO2_LO);
+  v4d df = vtrunc32(s);
+  v4d c = (t - df * df) / (s + df);
+  v4d p = 2.0 * s * r - (PIO2_LO - 2.0 * c);
+  v4d q = PIO4_HI - 2.0 * df;
+  v4d big = vcopysign(vsel(ax >= 0.975, near_one, PIO4_HI - (p - q)), x);
+  return vsel(small, x + x * r, big);
+}
+
+static VINLINE v4d vacos(v4d x)
+{
+  v4d ax = vabs(x);
+  v4di small = ax < 0.5, negative = x <= -0.5;
+  v4d z = vsel(small, x * x, vsel(negative, (1.0 + x) * 0.5, (1.0 - x) * 0.5));
+  v4d r = vasin_r(z);
+  v4d s = vsqrt(z);
+  v4d df = vtrunc32(s);
+  v4d c = (z - df * df) / (s + df);
+  v4d positive = 2.0 * (df + (r * s + c));
+  positive = vsel(x == 1.0, vsplat(0.0), positive); // c is 0/0
+  v4d big = vsel(negative, PI - 2.0 * (s + (r * s - PIO2_LO)), positive);
+  return vsel(small, PIO2_HI - (x - (PIO2_LO - x * r)), big);
+}
+
+// atan (fdlibm s_atan.c)
+
+static const double ATANHI[] = { 4.63647609000806093515e-01, 7.85398163397448278999e-01, 9.82793723247329054082e-01, 1.57079632679489655800e+00 };
+static const double ATANLO[] = { 2.26987774529616870924e-17, 3.06161699786838301793e-17, 1.39033110312309984516e-17, 6.12323399573676603587e-17 };
+static const double AT[] = {
+  3.33333333333329318027e-01, -1.99999999998764832476e-01, 1.42857142725034663711e-01, -1.11111104054623557880e-01,
+  9.09088713343650656196e-02, -7.69187620504482999495e-02, 6.66107313738753120669e-02, -5.83357013379057348645e-02,
+  4.97687799461593236017e-02, -3.65315727442169155270e-02, 1.62858201153657823623e-02,
+};
+
+static VINLINE v4d vatan(v4d x)
+{
+  v4d ax = vabs(x);
+  // reduce to t = (ax - a) / (1 + a ax) around a = 0, 1/2, 1, 3/2, inf and add atan(a) = hi + lo
+  v4di r0 = ax >= 0.4375, r1 = ax >= 0.6875, r2 = ax >= 1.1875, r3 = ax >= 2.4375;
+  v4d num = vsel(r3, vsplat(-1.0), vsel(r2, ax - 1.5, vsel(r1, ax - 1.0, vsel(r0, 2.0 * ax - 1.0, ax))));
+  v4d den = vsel(r3, ax, vsel(r2, 1.0 + 1.5 * ax, vsel(r1, ax + 1.0, vsel(r0, 2.0 + ax, vsplat(1.0)))));
+  v4d hi = vsel(r3, vsplat(ATANHI[3]), vsel(r2, vsplat(ATANHI[2]), vsel(r1, vsplat(ATANHI[1]), vsel(r0, vsplat(ATANHI[0]), vsplat(0.0)))));
+  v4d lo = vsel(r3, vsplat(ATANLO[3]), vsel(r2, vsplat(ATANLO[2]), vsel(r1, vsplat(ATANLO[1]), vsel(r0, vsplat(ATANLO[0]), vsplat(0.0)))));
+  v4d t = num / den;
+  v4d z = t * t, w = z * z;
+  v4d s1 = z * (AT[0] + w * (AT[2] + w * (AT[4] + w * (AT[6] + w * (AT[8] + w * AT[10])))));
+  v4d s2 = w * (AT[1] + w * (AT[3] + w * (AT[5] + w * (AT[7] + w * AT[9]))));
+  return vcopysign(hi - ((t * (s1 + s2) - lo) - t), x);
+}
+
+// Logarithms (fdlibm e_log.c)
+
+static const double LN2_HI = 6.93147180369123816490e-01, LN2_LO = 1.90821492927058770002e-10;
+static const double LG1 = 6.666666666666735130e-01, LG2 = 3.999999999940941908e-01, LG3 = 2.857142874366239149e-01,
+                    LG4 = 2.222219843214978396e-01, LG5 = 1.818357216161805012e-01, LG6 = 1.531383769920937332e-01,
+                    LG7 = 1.479819860511658591e-01;
+static const double INVLN2 = 1.44269504088896338700e+00, INVLN10 = 4.34294481903251816668e-01,
+                    LOG10_2HI = 3.01029995663611771306e-01, LOG10_2LO = 3.69423907715893078616e-13;
+
+// Splits positive finite x = 2^k (1 + f) with 1 + f in [sqrt(2)/2, sqrt(2)), log(1 + f) = f - (hfsq - s (hfsq + R))
+static VINLINE void vlog_parts(v4d x, v4d *k, v4d *f, v4d *hfsq, v4d *sr)
+{
+  v4di subnormal = x < 0x1p-1022;
+  x = vsel(subnormal, x * 0x1p54, x);
+  v4di bits = (v4di) x;
+  v4di hx = (bits >> 32) & 0x000fffff;
+  v4di i = (hx + 0x95f64) & 0x100000;
+  v4di e = ((bits >> 52) & 0x7ff) - 1023 - (subnormal & 54) + (i >> 20);
+  v4d m = (v4d) ((bits & 0x000fffffffffffff) | ((i ^ 0x3ff00000) << 32));
+  *k = __builtin_convertvector(e, v4d);
+  *f = m - 1.0;
+  v4d s = *f / (2.0 + *f);
+  v4d z = s * s, w = z * z;
+  v4d t1 = w * (LG2 + w * (LG4 + w * LG6));
+  v4d t2 = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7)));
+  *hfsq = 0.5 * *f * *f;
+  *sr = s * (*hfsq + (t1 + t2));
+}
+
+static VINLINE v4di vlog_special(v4d x)
+{
+  return ~((x > 0.0) & (x < INFINITY));
+}
+
+static VINLINE v4d vlog_unchecked(v4d x)
+{
+  v4d k, f, hfsq, sr;
+  vlog_parts(x, &k, &f, &hfsq, &sr);
+  return k * LN2_HI - ((hfsq - (sr + k * LN2_LO)) - f);
+}
+
+static VINLINE v4d vlog(v4d x)
+{
+  return vfallback(vlog_special(x), x, vlog_unchecked(x), log);
+}
+
+static VINLINE v4d vlog2(v4d x)
+{
+  v4d k, f, hfsq, sr;
+  vlog_parts(x, &k, &f, &hfsq, &sr);
+  return vfallback(vlog_special(x), x, k + (f - (hfsq - sr)) * INVLN2, log2);
+}
+
+static VINLINE v4d vlog10(v4d x)
+{
+  v4d k, f, hfsq, sr;
+  vlog_parts(x, &k, &f, &hfsq, &sr);
+  return vfallback(vlog_special(x), x, k * LOG10_2HI + (k * LOG10_2LO + (f - (hfsq - sr)) * INVLN10), log10);
+}
+
+// Implementation
+
+VECTORIZE(math_vsin, vsin)
+VECTORIZE(math_vcos, vcos)
+VECTORIZE(math_vtan, vtan)
+VECTORIZE(math_vasin, vasin)
+VECTORIZE(math_vacos, vacos)
+VECTORIZE(math_vatan, vatan)
+VECTORIZE(math_vsqrt, vsqrt)
+VECTORIZE(math_vlog, vlog)
+VECTORIZE(math_vlog2, vlog2)
+VECTORIZE(math_vlog10, vlog10)
+
+VCLONES void math_vlogb(double *left, const double *right, size_t n)
+{
+  v4d a = vsplat(1.0), b = vsplat(1.0);
+  for (size_t i = 0; i < n; i += LANES)
+  {
+    size_t count = n - i < LANES ? n - i : LANES;
+    memcpy(&a, left + i, count * sizeof(double));
+    memcpy(&b, right + i, count * sizeof(double));
+    a = vlog(b) / vlog(a);
+    memcpy(left + i, &a, count * sizeof(double));
+  }
+}
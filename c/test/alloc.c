@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include "../src/rpn.h"
+
+// Counting allocator: glibc lets the executable interpose the allocation functions
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static size_t allocations = 0;
+
+void *malloc(size_t size)
+{
+  ++allocations;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  ++allocations;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  ++allocations;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+static void compile(MathParser *parser, char *input, MathExpr *expr)
+{
+  MathParserError err = math_parser_compile(parser, lexer_init("test", sv_from_cstr(input)), expr);
+  assert(err == MERR_OK);
+}
+
+void testSteadyStateEval() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr defs, expr;
+  compile(&parser, "sq(a) = a*a; hyp(a, b) = sqrt(sq(a) + sq(b))", &defs);
+  assert(math_parser_set_var(&parser, SV("x"), 3));
+  assert(math_parser_set_var(&parser, SV("y"), 4));
+  compile(&parser, "hyp(x, y) * 2 + sin(PI/2) - log(2, 8) ^ 2", &expr);
+
+  double result, stack[64];
+  size_t before = allocations;
+  assert(before > 0 && "counting allocator not interposed");
+  for (int i = 0; i < 1000; ++i)
+  {
+    assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+    assert(fabs(result - 2.) < 1e-9);
+    assert(math_expr_eval_stack(&parser, &expr, stack, 64, &result) == MERR_OK);
+    assert(fabs(result - 2.) < 1e-9);
+  }
+  assert(allocations == before && "evaluation must not allocate");
+
+  math_expr_free(&expr);
+  math_expr_free(&defs);
+  math_parser_free(&parser);
+}
+
+int main(int argc, char **argv)
+{
+  testSteadyStateEval();
+  printf("All tests passed\n");
+  return 0;
+}
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "../src/rpn.h"
 #include "../src/const.h"
+#include "../src/kernels.h"
+#include "../src/stb_ds.h"
 
 #define assertEquals(expected, actual, epsilon) do {       \
   if (fabs((actual) - (expected)) > (epsilon)) {           \
@@ -99,6 +103,85 @@ void testMultiStatements() {
   assertEquals(3.0, eval(" 1+2 ;   ;   "), 0.001);
 }
 
+void testTokenBuffer() {
+  // statements continue in the tokens the previous one looked ahead at
+  MathParser parser = math_parser_init(lexer_init("test", sv_from_cstr("a = b = 2; f(x, y) = x * y + a; f(b, 3) + c")));
+  double result;
+  assert(math_parser_rpn(&parser) == MERR_OK && math_parser_eval(&parser, &result) == MERR_OK && result == 2);
+  assert(parser.lexer.loc.col == 10 && parser.lexer.content.data[0] == ' ');
+  assert(math_parser_rpn(&parser) == MERR_OK);
+  assert(math_parser_find_function(&parser, SV("f"), 2) >= 0 && parser.lexer.loc.col == 31);
+  math_parser_clear(&parser);
+  // the lexer was replaced, tokenize it instead of continuing
+  parser.lexer = lexer_init("test", sv_from_cstr("f(a, 4) / 2; 1 $"));
+  assert(math_parser_rpn(&parser) == MERR_OK && math_parser_eval(&parser, &result) == MERR_OK && result == 5);
+  // lexer errors come up with the statement they are in
+  assert(math_parser_rpn(&parser) == MERR_LEXER_ERROR);
+  assert(parser.lexer.error.code == DIAG_UNRECOGNIZED_TOKEN && parser.lexer.loc.col == 15);
+  math_parser_clear(&parser);
+  // a call is not a definition without =, even without arguments
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("g() + 1")), &result) == MERR_UNEXPECTED_OPERATOR);
+  assert(math_parser_find_function(&parser, SV("g"), -1) < 0 && math_parser_find_function(&parser, SV(")"), -1) < 0);
+  math_parser_clear(&parser);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("g() = 1")), &result) == MERR_OK);
+  assert(math_parser_find_function(&parser, SV("g"), 0) >= 0);
+  math_parser_free(&parser);
+}
+
+void testLexer() {
+  // runs of every length around the 16 characters scanned at once, locations are checked against the offsets
+  char input[8192];
+  size_t len = 0;
+  for (size_t n = 1; n <= 40; ++n)
+  {
+    for (size_t i = 0; i < n; ++i) input[len++] = i % 7 == 3 ? '\n' : i % 5 == 1 ? '\t' : ' ';
+    for (size_t i = 0; i < n; ++i) input[len++] = i == 0 ? 'x' : "a_Z9"[i % 4];
+    input[len++] = '+';
+    for (size_t i = 0; i < n % 19; ++i) input[len++] = '1' + i % 9;
+    input[len++] = '*';
+  }
+  input[len++] = 'y';
+  Lexer lexer = lexer_init("test", sv_from_parts(input, len));
+  Token token;
+  LexerError err;
+  size_t symbols = 0;
+  while ((err = lexer_next_token(&lexer, &token)) == LERR_OK)
+  {
+    size_t offset = token.content.data - input, line = 1, col = offset;
+    for (size_t i = 0; i < offset; ++i)
+    {
+      if (input[i] != '\n') continue;
+      line += 1;
+      col = offset - i - 1;
+    }
+    assert(token.loc.line == line && token.loc.col == col);
+    if (token.kind == TK_SYMBOL) assert(token.content.count == (++symbols <= 40 ? symbols : 1));
+  }
+  assert(err == LERR_EOF && symbols == 41);
+  // characters outside of ASCII are in no class
+  lexer = lexer_init("test", sv_from_cstr("x \xc3\xa9"));
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_SYMBOL && token.content.count == 1);
+  assert(lexer_next_token(&lexer, &token) == LERR_UNRECOGNIZED_TOKEN && lexer.error.loc.col == 2);
+  // exponents and hexadecimal literals, an e without exponent digits is the next token
+  lexer = lexer_init("test", sv_from_cstr("1.5E-2 0x1F 2e+ 1e400"));
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_REAL && token.as.real.value == 1.5E-2 && token.content.count == 6);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_INTEGER && token.as.integer.value == 31);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_INTEGER && token.as.integer.value == 2);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_SYMBOL && token.content.count == 1);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_OP);
+  assert(lexer_next_token(&lexer, &token) == LERR_INVALID_LITERAL && lexer.error.code == DIAG_LITERAL_OVERFLOW);
+  // a signed exponent with digits belongs to the literal, so these are no longer products with the constant e
+  lexer = lexer_init("test", sv_from_cstr("2e-1 3E+2 2e-x"));
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_REAL && token.as.real.value == 0.2 && token.content.count == 4);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_REAL && token.as.real.value == 300 && token.content.count == 4);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_INTEGER && token.as.integer.value == 2);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_SYMBOL && token.content.count == 1);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_OP);
+  assert(lexer_next_token(&lexer, &token) == LERR_OK && token.kind == TK_SYMBOL && token.content.count == 1);
+  assert(eval("2e-1") == 0.2 && eval("3E+2") == 300);
+  assertEquals(2 * M_E - 1, eval("2e - 1"), 0.001);
+}
+
 void testDefVars() {
   assertEquals(M_PI, eval("pi"), 0.001);
   assertEquals(M_E, eval("E"), 0.001);
@@ -125,6 +208,685 @@ void testDefVars() {
 //   assertEquals(Math.log(1000) / Math.log(10), eval("log(1000, 10)"), 0.001);
 // }
 
+void testBuiltinLookup() {
+  assertEquals(sin(1), eval("SIN(1)"), 0.001);
+  assertEquals(cos(1) + tan(1), eval("cos(1) + Tan(1)"), 0.001);
+  assertEquals(asin(.5) + acos(.5) + atan(.5), eval("asin(.5) + acos(.5) + atan(.5)"), 0.001);
+  assertEquals(sqrt(2) + log2(3) + log10(4), eval("sqrt(2) + log2(3) + log10(4)"), 0.001);
+  assertEquals(2 * log(5), eval("ln(5) + log(5)"), 0.001);
+  assertEquals(3.0, eval("log(2, 8)"), 0.001);
+  assertEquals(M_PI + M_PI_2 + M_PI_4, eval("PI + pi_2 + Pi_4"), 0.001);
+  assertEquals(M_E + M_LOG2E + M_LOG10E, eval("e + log2e + LOG10E"), 0.001);
+  assertEquals(M_LN2 + M_LN10 + M_SQRT2, eval("ln2 + ln10 + sqrt2"), 0.001);
+  evalErr("pi_3", MERR_UNRECOGNIZED_SYMBOL);
+  evalErr("cosh(1)", MERR_UNRECOGNIZED_SYMBOL);
+}
+
+void testSymbolTables() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  char buf[64];
+  double result;
+  for (int i = 0; i < 1000; ++i)
+  {
+    int len = snprintf(buf, sizeof(buf), "Var%d = %d; f%d(x) = x + %d; f%d(x, y) = x * y", i, i, i % 100, i % 100, i % 100);
+    MathParserError err = math_parser_evaluate_input(&parser, lexer_init("test", sv_from_parts(buf, len)), &result);
+    assert(err == MERR_OK || (i >= 100 && err == MERR_SYMBOL_ALREADY_SET));
+  }
+  assert(math_parser_get_var(&parser, SV("VAR999"), &result));
+  assertEquals(999.0, result, 0.001);
+  assert(!math_parser_get_var(&parser, SV("var1000"), &result));
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("F42(var3) + f42(2, var3)")), &result) == MERR_OK);
+  assertEquals(51.0, result, 0.001);
+  math_parser_free(&parser);
+}
+
+void testSlots() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  double result;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("f(x) = x * k; f(X) + x")), &expr) == MERR_OK);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  ssize_t x = math_parser_bind_var(&parser, SV("X")), k = math_parser_bind_var(&parser, SV("k"));
+  assert(x >= 0 && k >= 0 && x != k);
+  assert(math_parser_bind_var(&parser, SV("x")) == x);
+  assert(math_parser_bind_var(&parser, SV("PI")) < 0);
+  math_parser_set_slot(&parser, k, 10);
+  for (int i = 0; i < 5; ++i)
+  {
+    // rebinding through the slot is visible to the compiled expression
+    math_parser_set_slot(&parser, x, i);
+    assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+    assertEquals(i * 10.0 + i, result, 0.001);
+  }
+  assert(!math_parser_set_var(&parser, SV("x"), 1)); // defined through the slot
+  math_expr_free(&expr);
+  // arguments shadow globals
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("g(k) = k + 1; g(1)")), &result) == MERR_OK);
+  assertEquals(2.0, result, 0.001);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("e = 1")), &result) == MERR_SYMBOL_ALREADY_SET);
+  math_parser_free(&parser);
+}
+
+void testDirectCalls() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  double result;
+  parser.optimize.fold_constants = false;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("sin(2) * Cos(2) + log(2, 8) + h(1)")), &expr) == MERR_OK);
+  size_t calls[BC_COUNT] = {0};
+  for (size_t i = 0; i < arrlenu(expr.code); ++i) ++calls[expr.code[i].op];
+  assert(calls[BC_CALL1] == 2 && calls[BC_CALL2] == 1 && calls[BC_CALL] == 1); // only h is bound late
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("h(x) = x + 1")), &result) == MERR_OK);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(sin(2) * cos(2) + 3 + 2, result, 0.001);
+  math_expr_free(&expr);
+  parser.optimize.inline_limit = 0;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("h(sqrt(4))")), &expr) == MERR_OK);
+  assert(expr.code[arrlenu(expr.code) - 1].op == BC_CALLU);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(3.0, result, 0.001);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
+void testCallFrames() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  double result, expected = 0;
+  char def[64];
+  enum { LEVELS = 200 };
+  parser.optimize.inline_limit = 0; // every level is a call
+  // each level calls the one below with its arguments swapped, 200 frames deep
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("f0(a, b) = a - b / 2")), &result) == MERR_OK);
+  for (int i = 1; i < LEVELS; ++i)
+  {
+    snprintf(def, sizeof(def), "f%d(a, b) = f%d(b, a) * 0.5 + a", i, i - 1);
+    assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr(def)), &result) == MERR_OK);
+  }
+  for (int i = 0; i < LEVELS; ++i)
+  {
+    double a = (LEVELS - 1 - i) % 2 ? 3 : 5, b = (LEVELS - 1 - i) % 2 ? 5 : 3;
+    expected = i == 0 ? a - b / 2 : expected * 0.5 + a;
+  }
+  snprintf(def, sizeof(def), "f%d(5, 3) + f%d(f0(5, 3), 1) * 0", LEVELS - 1, LEVELS - 1);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(def)), &expr) == MERR_OK);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(expected, result, 1e-9);
+  math_expr_free(&expr);
+  // unbounded recursion through a late bound call stops at the depth limit instead of the C stack
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("r(x) = r(x + 1) + 1")), &result) == MERR_OK);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("r(1)")), &result) == MERR_STACK_OVERFLOW);
+  // the parser stays usable after the overflow
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("f1(2, 4)")), &result) == MERR_OK);
+  assertEquals((4 - 2 / 2.0) * 0.5 + 2, result, 1e-9);
+  // batches run calls on frames as well, as deep as their stack vectors allow
+  double xs[3] = { -1, 0.5, 7 }, out[3];
+  ssize_t x = math_parser_bind_var(&parser, SV("x"));
+  MathBatchColumn columns[] = { { .slot = x, .values = xs } };
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("f12(x, 3) + f3(f2(x, 1), x)")), &expr) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, 3, out, NULL) == MERR_OK);
+  for (int i = 0; i < 3; ++i)
+  {
+    math_parser_set_slot(&parser, x, xs[i]);
+    assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+    assert(result == out[i]);
+  }
+  math_expr_free(&expr);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("r(x)")), &expr) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, 3, out, NULL) == MERR_STACK_OVERFLOW);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
+void testInlining() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  double result;
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("sq(x) = x * x; hyp(a, b) = sqrt(sq(a) + sq(b))")), &result) == MERR_OK);
+  assert(parser.functions[1].body.inlined == 2);
+  // parameters are replaced by their arguments, constants fold across the bodies
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("hyp(3, 4) + hyp(y, 2 * y) - sq(y + 1)")), &expr) == MERR_OK);
+  assert(expr.inlined == 3);
+  for (size_t i = 0; i < arrlenu(expr.code); ++i) assert(expr.code[i].op != BC_CALLU && expr.code[i].op != BC_ARG);
+  assert(expr.code[0].op == BC_CONST && expr.consts[expr.code[0].arg] == 5);
+  math_parser_set_var(&parser, SV("y"), 2);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(5 + sqrt(4 + 16) - 9.0, result, 1e-12);
+  math_expr_free(&expr);
+  // integer arguments stay exact through the body
+  MathValue value;
+  assert(math_parser_evaluate_input_value(&parser, lexer_init("test", sv_from_cstr("sq(3037000499)")), &value) == MERR_OK);
+  assert(value.integer && value.as.integer == 9223372030926249001);
+  // inside a body, the caller's parameters are kept
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("quad(x) = sq(sq(x) + x)")), &result) == MERR_OK);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("quad(y)")), &expr) == MERR_OK);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(36.0, result, 1e-12);
+  math_expr_free(&expr);
+  // calls beyond the limit stay calls
+  parser.optimize.inline_limit = 4;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("sq(y) + sq(y + 1)")), &expr) == MERR_OK);
+  assert(expr.inlined == 1 && expr.code[arrlenu(expr.code) - 2].op == BC_CALLU);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(4.0 + 9, result, 1e-12);
+  math_expr_free(&expr);
+  // errors in an inlined body point into the function
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("g(x) = x + z")), &result) == MERR_OK);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("g(1)")), &expr) == MERR_OK);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  math_expr_free(&expr);
+  // unused arguments are dropped only if they cannot fail, inlining never makes an expression valid
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("first(a, b) = a; q = 1")), &result) == MERR_OK);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("first(2, q * y + 1)")), &expr) == MERR_OK);
+  assert(expr.inlined == 1 && arrlenu(expr.code) == 1);
+  math_expr_free(&expr);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("first(1, zz) + q + q + q + q")), &expr) == MERR_OK);
+  assert(expr.inlined == 0);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  double xs[1] = { 0 }, out[1];
+  MathBatchColumn columns[] = { { .slot = math_parser_bind_var(&parser, SV("x")), .values = xs } };
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, 1, out, NULL) == MERR_UNRECOGNIZED_SYMBOL);
+  math_expr_free(&expr);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("first(1, nofn(2))")), &expr) == MERR_OK);
+  assert(expr.inlined == 0);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
+void testSharing() {
+  const char *inputs[] = {
+    "2 * ((a - b) / c) + sin((a - b) / c) - ((a - b) / c) ^ c",
+    "(a - b) / c; 2 * ((a - b) / c) + sqrt(a - b)",
+    "x = (a - b) / c; (a - b) / c + x",
+  };
+  const size_t temps[] = { 1, 2, 1 }; // (a - b) is only shared by the second
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  parser.optimize.polynomials = false; // n * n would be a polynomial
+  MathExpr shared, plain;
+  double expected, result;
+  assert(math_parser_set_var(&parser, SV("a"), 7.5));
+  assert(math_parser_set_var(&parser, SV("b"), 0.3));
+  assert(math_parser_set_var(&parser, SV("c"), 1.7));
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+  {
+    Lexer lex = lexer_init("test", sv_from_cstr(inputs[i]));
+    parser.optimize.share = false;
+    assert(math_parser_compile(&parser, lex, &plain) == MERR_OK);
+    parser.optimize.share = true;
+    assert(math_parser_compile(&parser, lex, &shared) == MERR_OK);
+    assert(plain.ntemps == 0 && shared.ntemps == temps[i]);
+    assert(shared.shared > 0 && arrlenu(shared.code) == arrlenu(plain.code) - shared.shared);
+    size_t ops[BC_COUNT] = {0};
+    for (size_t pc = 0; pc < arrlenu(shared.code); ++pc) ++ops[shared.code[pc].op];
+    assert(ops[BC_SAVE] == temps[i] && ops[BC_TEMP] >= temps[i]);
+    assert(math_expr_eval(&parser, &plain, &expected) == MERR_OK);
+    math_parser_clear_diagnostics(&parser);
+    if (i == 2) parser.variables[math_parser_bind_var(&parser, SV("x"))].defined = false;
+    assert(math_expr_eval(&parser, &shared, &result) == MERR_OK);
+    assert(memcmp(&expected, &result, sizeof(result)) == 0 && "must be bit-identical");
+    math_expr_free(&plain);
+    math_expr_free(&shared);
+  }
+  // shared within the last statement, the native code keeps the temporary itself
+  parser.optimize.jit = true;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(inputs[0])), &shared) == MERR_OK);
+  assert((shared.jit.fn != NULL) == MATH_JIT_SUPPORTED);
+  assert(math_expr_eval(&parser, &shared, &result) == MERR_OK);
+  assertEquals(2 * (7.2 / 1.7) + sin(7.2 / 1.7) - pow(7.2 / 1.7, 1.7), result, 1e-12);
+  math_expr_free(&shared);
+  // saved by an earlier statement, batches run it too
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(inputs[1])), &shared) == MERR_OK);
+  assert(shared.jit.fn == NULL);
+  enum { ROWS = 300 };
+  static double as[ROWS], out[ROWS];
+  for (size_t i = 0; i < ROWS; ++i) as[i] = i * 0.25;
+  MathBatchColumn columns[] = { { .slot = math_parser_bind_var(&parser, SV("a")), .values = as } };
+  assert(math_expr_eval_batch(&parser, &shared, columns, 1, ROWS, out, NULL) == MERR_OK);
+  for (size_t i = 0; i < ROWS; ++i)
+  {
+    double d = as[i] - 0.3;
+    assert(isnan(out[i]) == (d < 0));
+    if (d >= 0) assertEquals(2 * (d / 1.7) + sqrt(d), out[i], 1e-12);
+  }
+  math_expr_free(&shared);
+  parser.optimize.jit = false;
+  // integer statements share on int64_t
+  MathValue value;
+  assert(math_parser_set_int_var(&parser, SV("n"), 3037000499));
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("n * n - 7 + 0 * (n * n)")), &shared) == MERR_OK);
+  assert(shared.statements[0].integer && shared.ntemps == 1);
+  assert(math_expr_eval_value(&parser, &shared, &value) == MERR_OK);
+  assert(value.integer && value.as.integer == 9223372030926248994);
+  math_expr_free(&shared);
+  // undefined variables are still found
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("n * n; 2 * (a - z) + (a - z)")), &shared) == MERR_OK);
+  assert(math_expr_eval(&parser, &shared, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  assert(math_parser_set_var(&parser, SV("z"), 1));
+  assert(math_expr_eval(&parser, &shared, &result) == MERR_OK);
+  assertEquals(6.5 * 3, result, 1e-12);
+  math_expr_free(&shared);
+  // integer literals that round to the same double are different nodes
+  assert(math_parser_set_int_var(&parser, SV("k"), 0));
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("k + 9007199254740993 - (k + 9007199254740992)")), &shared) == MERR_OK);
+  assert(shared.ntemps == 0);
+  assert(math_expr_eval_value(&parser, &shared, &value) == MERR_OK);
+  assert(value.integer && value.as.integer == 1);
+  math_expr_free(&shared);
+  math_parser_free(&parser);
+}
+
+void testConstantFolding() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  double result;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("2*PI*r; sqrt(2)/2*r; -(1+2)^log(2, 4) r")), &expr) == MERR_OK);
+  assert(arrlenu(expr.code) == 9 && arrlenu(expr.consts) == 3); // CONST LOAD MUL each
+  assert(expr.folded == 2 + 3 + 7);
+  math_parser_set_var(&parser, SV("r"), 3);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(-pow(3, 2) * 3, result, 0.001);
+  math_expr_free(&expr);
+  // folding does not cross statements, and stops at variables
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("2; r*2*PI")), &expr) == MERR_OK);
+  assert(expr.folded == 0);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(3 * 2 * M_PI, result, 0.001);
+  math_expr_free(&expr);
+  parser.optimize.fold_constants = false;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("2*PI*r")), &expr) == MERR_OK);
+  assert(arrlenu(expr.code) == 5 && expr.folded == 0);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
+void testStrengthReduction() {
+  const char *inputs[] = {
+    "x^2 + x^3 - x^(-3) + x / 4 - y / 3 + x^40 - x^1 * y",
+    "1 - x * y + (x - 2) * y + x * (y * x - x)",
+  };
+  const size_t powis[] = { 3, 0 }, fmas[] = { 2, 4 };
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  parser.optimize.polynomials = false; // would take the sums of powers
+  MathExpr reduced, plain;
+  double expected, result;
+  assert(math_parser_set_var(&parser, SV("x"), 1.75));
+  assert(math_parser_set_var(&parser, SV("y"), -0.3));
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+  {
+    Lexer lex = lexer_init("test", sv_from_cstr(inputs[i]));
+    parser.optimize.reduce_strength = parser.optimize.contract = false;
+    assert(math_parser_compile(&parser, lex, &plain) == MERR_OK);
+    parser.optimize.reduce_strength = parser.optimize.contract = true;
+    assert(math_parser_compile(&parser, lex, &reduced) == MERR_OK);
+    size_t ops[BC_COUNT] = {0};
+    for (size_t pc = 0; pc < arrlenu(reduced.code); ++pc) ++ops[reduced.code[pc].op];
+    assert(ops[BC_POWI] == powis[i] && ops[BC_FMA] == fmas[i]);
+    assert(ops[BC_POW] == (i == 0) && ops[BC_DIV] == (i == 0)); // x^40 and y / 3 stay
+    assert(math_expr_eval(&parser, &plain, &expected) == MERR_OK);
+    assert(math_expr_eval(&parser, &reduced, &result) == MERR_OK);
+    assertEquals(expected, result, 1e-12 * fabs(expected));
+    // the same operations in every evaluator
+    double rows[] = { 1.75, 1.75 }, out[2];
+    MathBatchColumn columns[] = { { .slot = math_parser_bind_var(&parser, SV("x")), .values = rows } };
+    assert(math_expr_eval_batch(&parser, &reduced, columns, 1, 2, out, NULL) == MERR_OK);
+    assert(memcmp(&out[1], &result, sizeof(result)) == 0 && "must be bit-identical");
+    math_expr_free(&reduced);
+    parser.optimize.jit = true;
+    assert(math_parser_compile(&parser, lex, &reduced) == MERR_OK);
+    assert((reduced.jit.fn != NULL) == MATH_JIT_SUPPORTED);
+    assert(math_expr_eval(&parser, &reduced, &expected) == MERR_OK);
+    assert(memcmp(&expected, &result, sizeof(result)) == 0 && "must be bit-identical");
+    parser.optimize.jit = false;
+    math_expr_free(&reduced);
+    math_expr_free(&plain);
+  }
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("1 - x * y")), &reduced) == MERR_OK);
+  assert(math_expr_eval(&parser, &reduced, &result) == MERR_OK);
+  assert(result == fma(1.75, 0.3, 1));
+  math_expr_free(&reduced);
+  // integers stay exact, arguments of inlined calls can become exponents
+  MathValue value;
+  assert(math_parser_set_int_var(&parser, SV("n"), 3037000499));
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("f(a, b) = a^b; f(n, 2) - n * 3 + n")), &reduced) == MERR_OK);
+  assert(reduced.inlined == 1 && reduced.statements[arrlenu(reduced.statements) - 1].integer);
+  assert(math_expr_eval_value(&parser, &reduced, &value) == MERR_OK);
+  assert(value.integer && value.as.integer == 9223372024852248003);
+  math_expr_free(&reduced);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("n^3 + n")), &reduced) == MERR_OK);
+  assert(math_expr_eval_value(&parser, &reduced, &value) == MERR_OK);
+  assert(!value.integer);
+  assertEquals(pow(3037000499.0, 3), value.as.real, 1e15);
+  math_expr_free(&reduced);
+  math_parser_free(&parser);
+}
+
+void testPolynomials() {
+  const char *inputs[] = {
+    "7 + 3*x^4 + 2*x^3 - x",
+    "sin(x) * (x^3/4 - 2*x + 1) - x^2 * y - x",
+    "x^16/8 - 4*x^12 + 6*x^9 - x^4 + x - y",
+  };
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr poly, plain;
+  double expected, result;
+  assert(math_parser_set_var(&parser, SV("x"), 1.75));
+  assert(math_parser_set_var(&parser, SV("y"), -0.3));
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+  {
+    Lexer lex = lexer_init("test", sv_from_cstr(inputs[i]));
+    parser.optimize.polynomials = false;
+    assert(math_parser_compile(&parser, lex, &plain) == MERR_OK);
+    parser.optimize.polynomials = true;
+    assert(math_parser_compile(&parser, lex, &poly) == MERR_OK);
+    size_t polys = 0;
+    for (size_t pc = 0; pc < arrlenu(poly.code); ++pc) polys += poly.code[pc].op == BC_POLY;
+    assert(polys == 1 && arrlenu(poly.code) < arrlenu(plain.code));
+    assert(math_expr_eval(&parser, &plain, &expected) == MERR_OK);
+    assert(math_expr_eval(&parser, &poly, &result) == MERR_OK);
+    assertEquals(expected, result, 1e-12 * fabs(expected));
+    // the same operations in every evaluator
+    double rows[] = { 1.75, 1.75 }, out[2];
+    MathBatchColumn columns[] = { { .slot = math_parser_bind_var(&parser, SV("x")), .values = rows } };
+    assert(math_expr_eval_batch(&parser, &poly, columns, 1, 2, out, NULL) == MERR_OK);
+    assert(memcmp(&out[1], &result, sizeof(result)) == 0 && "must be bit-identical");
+    math_expr_free(&poly);
+    parser.optimize.jit = true;
+    assert(math_parser_compile(&parser, lex, &poly) == MERR_OK);
+    assert((poly.jit.fn != NULL) == MATH_JIT_SUPPORTED);
+    assert(math_expr_eval(&parser, &poly, &expected) == MERR_OK);
+    assert(memcmp(&expected, &result, sizeof(result)) == 0 && "must be bit-identical");
+    parser.optimize.jit = false;
+    math_expr_free(&poly);
+    math_expr_free(&plain);
+  }
+  // products of sums, several variables and coefficients that would be rounded are left as they are
+  const char *kept[] = { "(x - 1)^2 + x*y + y^2", "x^2/3 + x", "0.1*x*0.3*x + x", "0.1*x^2 + 0.2*x^2 + 1", "x^2 + x - x" };
+  for (size_t i = 0; i < sizeof(kept) / sizeof(kept[0]); ++i)
+  {
+    assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(kept[i])), &poly) == MERR_OK);
+    assert(arrlast(poly.code).op != BC_POLY);
+    math_expr_free(&poly);
+  }
+  // missing terms are not multiplied, x^2 + 1 is inf and not 0 * inf for x = inf
+  const char *sparse[] = { "x^2 + 1", "x*x + 1", "x^4 + 1", "x^3/2 + x", "1 - x^8" };
+  const double xs[] = { INFINITY, -INFINITY, 1e200, NAN };
+  size_t x_slot = math_parser_bind_var(&parser, SV("x"));
+  for (size_t i = 0; i < sizeof(sparse) / sizeof(sparse[0]); ++i)
+  {
+    double outs[4];
+    MathBatchColumn columns[] = { { .slot = x_slot, .values = xs } };
+    for (int jit = 0; jit < 2; ++jit)
+    {
+      parser.optimize.jit = jit;
+      assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(sparse[i])), &poly) == MERR_OK);
+      assert(arrlast(poly.code).op == BC_POLY);
+      parser.optimize.polynomials = false;
+      assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(sparse[i])), &plain) == MERR_OK);
+      parser.optimize.polynomials = true;
+      if (!jit) assert(math_expr_eval_batch(&parser, &poly, columns, 1, 4, outs, NULL) == MERR_OK);
+      for (size_t k = 0; k < 4; ++k)
+      {
+        math_parser_set_slot(&parser, x_slot, xs[k]);
+        assert(math_expr_eval(&parser, &plain, &expected) == MERR_OK);
+        assert(math_expr_eval(&parser, &poly, &result) == MERR_OK);
+        assert(isnan(expected) ? isnan(result) : expected == result);
+        if (!jit) assert(isnan(expected) ? isnan(outs[k]) : expected == outs[k]);
+      }
+      math_expr_free(&poly);
+      math_expr_free(&plain);
+    }
+  }
+  parser.optimize.jit = false;
+  math_parser_set_slot(&parser, x_slot, 1.75);
+  // function bodies, inlined or not
+  parser.optimize.inline_limit = 0;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("p(t) = t^3 - 2*t + 1; p(x) * 2")), &poly) == MERR_OK);
+  const MathExpr *body = &parser.functions[math_parser_find_function(&parser, SV("p"), 1)].body;
+  assert(arrlenu(body->code) == 2 && body->code[1].op == BC_POLY && body->code[1].nargs == 3);
+  assert(math_expr_eval(&parser, &poly, &result) == MERR_OK);
+  assertEquals(2 * (pow(1.75, 3) - 3.5 + 1), result, 1e-12);
+  math_expr_free(&poly);
+  parser.optimize.inline_limit = MATH_PARSER_INLINE_LIMIT;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("p(x) * 2; p(2)")), &poly) == MERR_OK);
+  assert(poly.inlined == 2 && poly.code[1].op == BC_POLY && arrlenu(poly.code) == 5);
+  assert(math_expr_eval(&parser, &poly, &result) == MERR_OK);
+  assertEquals(5.0, result, 0);
+  math_expr_free(&poly);
+  // integer coefficients stay exact
+  MathValue value;
+  assert(math_parser_set_int_var(&parser, SV("n"), 3037000499));
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("n^2 + n")), &poly) == MERR_OK);
+  assert(poly.statements[0].integer && poly.code[1].op == BC_POLY);
+  assert(math_expr_eval_value(&parser, &poly, &value) == MERR_OK);
+  assert(value.integer && value.as.integer == 9223372033963249500);
+  math_expr_free(&poly);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("n^3 - n")), &poly) == MERR_OK);
+  assert(math_expr_eval_value(&parser, &poly, &value) == MERR_OK);
+  assert(!value.integer);
+  assertEquals(pow(3037000499.0, 3), value.as.real, 1e15);
+  math_expr_free(&poly);
+  math_parser_free(&parser);
+}
+
+void testJit() {
+  const char *inputs[] = {
+    "x * y - x / y + -x",
+    "x ^ y + 2 ^ -y",
+    "sin(x) / cos(y) + log(x, y) + sqrt(y) - ln(x)",
+    "x + (y + (x + (y + (x * (y - x / (y + 1))))))",
+    "0 / 0 * x; -x / 0",
+    "y; x + y",
+  };
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr interpreted, compiled;
+  double expected, result;
+  assert(math_parser_set_var(&parser, SV("x"), 1.75));
+  assert(math_parser_set_var(&parser, SV("y"), -0.3));
+  parser.optimize.fold_constants = false;
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+  {
+    Lexer lex = lexer_init("test", sv_from_cstr(inputs[i]));
+    parser.optimize.jit = false;
+    assert(math_parser_compile(&parser, lex, &interpreted) == MERR_OK);
+    parser.optimize.jit = true;
+    assert(math_parser_compile(&parser, lex, &compiled) == MERR_OK);
+    assert(interpreted.jit.fn == NULL);
+    assert((compiled.jit.fn != NULL) == MATH_JIT_SUPPORTED);
+    assert(math_expr_eval(&parser, &interpreted, &expected) == MERR_OK);
+    assert(math_expr_eval(&parser, &compiled, &result) == MERR_OK);
+    assert(memcmp(&expected, &result, sizeof(result)) == 0 && "must be bit-identical");
+    math_expr_free(&interpreted);
+    math_expr_free(&compiled);
+  }
+  // unsupported instructions stay interpreted, inlined calls are compiled
+  parser.optimize.inline_limit = 0;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("f(a) = a; f(x)")), &compiled) == MERR_OK);
+  assert(compiled.jit.fn == NULL);
+  assert(math_expr_eval(&parser, &compiled, &result) == MERR_OK);
+  assertEquals(1.75, result, 0.001);
+  math_expr_free(&compiled);
+  parser.optimize.inline_limit = MATH_PARSER_INLINE_LIMIT;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("f(x) * 2")), &compiled) == MERR_OK);
+  assert((compiled.jit.fn != NULL) == MATH_JIT_SUPPORTED);
+  assert(math_expr_eval(&parser, &compiled, &result) == MERR_OK);
+  assertEquals(3.5, result, 0.001);
+  math_expr_free(&compiled);
+  // reads are still checked
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("w * 2; x")), &compiled) == MERR_OK);
+  assert(math_expr_eval(&parser, &compiled, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  math_expr_free(&compiled);
+  math_parser_free(&parser);
+}
+
+void testBatch() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  enum { ROWS = 1000 }; // not a multiple of the block size
+  static double xs[ROWS], ys[ROWS], out[ROWS];
+  double result;
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("k = 3; f(a) = a * k - y")), &result) == MERR_OK);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("x; -x * y + k / sin(y) + g(x, 2) ^ 2")), &expr) == MERR_OK);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("g(a, b) = f(a) + b")), &result) == MERR_OK);
+  ssize_t x = math_parser_bind_var(&parser, SV("x")), y = math_parser_bind_var(&parser, SV("y"));
+  for (size_t i = 0; i < ROWS; ++i)
+  {
+    xs[i] = i * 0.5;
+    ys[i] = 1.0 + i;
+  }
+  MathBatchColumn columns[] = {
+    { .slot = x, .values = xs },
+    { .slot = y, .values = ys },
+  };
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, ROWS, out, NULL) == MERR_UNRECOGNIZED_SYMBOL); // y missing
+  assert(math_expr_eval_batch(&parser, &expr, columns, 2, ROWS, out, NULL) == MERR_OK);
+  for (size_t i = 0; i < ROWS; ++i)
+  {
+    math_parser_set_slot(&parser, x, xs[i]);
+    math_parser_set_slot(&parser, y, ys[i]);
+    assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+    assert(memcmp(&out[i], &result, sizeof(result)) == 0);
+  }
+  math_expr_free(&expr);
+  // fast builtins stay within a few ulp
+  static double fast[ROWS];
+  MathBatchOptions options = { .accuracy = MATH_ACCURACY_FAST };
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("sin(x) * cos(y) + log(2, y) - atan(x) / sqrt(y)")), &expr) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 2, ROWS, out, NULL) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 2, ROWS, fast, &options) == MERR_OK);
+  for (size_t i = 0; i < ROWS; ++i)
+  {
+    assertEquals(out[i], fast[i], 1e-12 * fabs(out[i]));
+  }
+  math_expr_free(&expr);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("z = x")), &expr) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 2, ROWS, out, NULL) == MERR_UNEXPECTED_OPERATOR);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
+void testBatchThreads() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  enum { ROWS = 100003 }; // several chunks, the last one partial
+  static double xs[ROWS], expected[ROWS], out[ROWS];
+  double result;
+  MathThreadPool *pool = math_thread_pool_create(4);
+  assert(pool != NULL && math_thread_pool_size(pool) == 4);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("f(a) = a ^ 2 - sin(a)")), &result) == MERR_OK);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("f(x) / (1 + x) + g(x)")), &expr) == MERR_OK);
+  ssize_t x = math_parser_bind_var(&parser, SV("x"));
+  for (size_t i = 0; i < ROWS; ++i) xs[i] = i * 0.25 - 1000;
+  MathBatchColumn columns[] = { { .slot = x, .values = xs } };
+  MathBatchOptions options = { .pool = pool };
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, ROWS, out, &options) == MERR_UNRECOGNIZED_SYMBOL); // g missing
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("g(a) = 2 * a")), &result) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, ROWS, expected, NULL) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, ROWS, out, &options) == MERR_OK);
+  assert(memcmp(expected, out, sizeof(out)) == 0);
+  math_expr_free(&expr);
+  math_thread_pool_free(pool);
+  math_parser_free(&parser);
+}
+
+void testIntegers() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  MathValue value;
+#define EVAL_VALUE(_input) math_parser_evaluate_input_value(&parser, lexer_init("test", sv_from_cstr(_input)), &value)
+  // exact beyond 2^53, promoted to double right at the boundaries
+  assert(EVAL_VALUE("9007199254740993") == MERR_OK && value.integer && value.as.integer == 9007199254740993);
+  assert(EVAL_VALUE("9223372036854775806 + 1") == MERR_OK && value.integer && value.as.integer == INT64_MAX);
+  assert(EVAL_VALUE("9223372036854775807 + 1") == MERR_OK && !value.integer && value.as.real == 0x1p63);
+  assert(EVAL_VALUE("-9223372036854775807 - 1") == MERR_OK && value.integer && value.as.integer == INT64_MIN);
+  assert(EVAL_VALUE("-9223372036854775807 - 2") == MERR_OK && !value.integer && value.as.real == -0x1p63);
+  assert(EVAL_VALUE("-(-9223372036854775807 - 1)") == MERR_OK && !value.integer && value.as.real == 0x1p63);
+  assert(EVAL_VALUE("3037000499 * 3037000499") == MERR_OK && value.integer && value.as.integer == 9223372030926249001);
+  assert(EVAL_VALUE("3037000500 * 3037000500") == MERR_OK && !value.integer && value.as.real == 3037000500.0 * 3037000500.0);
+  assert(EVAL_VALUE("99999999999999999999") == MERR_OK && !value.integer && value.as.real == 1e20); // literal beyond int64_t
+  assert(EVAL_VALUE("0x7FFFFFFFFFFFFFFF") == MERR_OK && value.integer && value.as.integer == INT64_MAX);
+  assert(EVAL_VALUE("1e3 + 2e") == MERR_OK && !value.integer && value.as.real == 1e3 + 2 * M_E);
+  assert(EVAL_VALUE("2 * 3 / 1") == MERR_OK && !value.integer && value.as.real == 6);
+  // variables keep their exact value, doubles mixed in promote
+  assert(EVAL_VALUE("big = 9007199254740993") == MERR_OK && value.integer);
+  assert(EVAL_VALUE("big + 2") == MERR_OK && value.integer && value.as.integer == 9007199254740995);
+  assert(EVAL_VALUE("big + 0.5") == MERR_OK && !value.integer);
+  assert(math_parser_set_int_var(&parser, SV("n"), INT64_MAX - 1));
+  assert(!math_parser_set_int_var(&parser, SV("n"), 0));
+  assert(EVAL_VALUE("n + 1") == MERR_OK && value.integer && value.as.integer == INT64_MAX);
+  assert(EVAL_VALUE("m = n + 2; m") == MERR_OK && !value.integer && value.as.real == 0x1p63);
+  // without folding, overflows are found at runtime
+  parser.optimize.fold_constants = false;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("n * 2 - n")), &expr) == MERR_OK);
+  assert(expr.statements[0].integer);
+  assert(math_expr_eval_value(&parser, &expr, &value) == MERR_OK && !value.integer && value.as.real == (double) (INT64_MAX - 1));
+  math_parser_set_slot_int(&parser, math_parser_bind_var(&parser, SV("n")), 1LL << 61);
+  assert(math_expr_eval_value(&parser, &expr, &value) == MERR_OK && value.integer && value.as.integer == 1LL << 61);
+  math_parser_set_slot(&parser, math_parser_bind_var(&parser, SV("n")), 1LL << 61);
+  assert(math_expr_eval_value(&parser, &expr, &value) == MERR_OK && !value.integer && value.as.real == 0x1p61);
+  math_expr_free(&expr);
+  parser.optimize.fold_constants = true;
+#undef EVAL_VALUE
+
+  // batches run integer blocks exactly, a block with an overflow runs on doubles
+  enum { ROWS = 1000 };
+  static int64_t ids[ROWS], exact[ROWS];
+  static double out[ROWS];
+  ssize_t id = math_parser_bind_var(&parser, SV("id"));
+  for (size_t i = 0; i < ROWS; ++i) ids[i] = 9007199254740993 + i;
+  MathBatchColumn columns[] = { { .slot = id, .integers = ids } };
+  bool all_exact;
+  MathBatchOptions options = { .integers = exact, .exact = &all_exact };
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("id * 2 - big")), &expr) == MERR_OK);
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, ROWS, out, &options) == MERR_OK && all_exact);
+  for (size_t i = 0; i < ROWS; ++i)
+  {
+    assert(exact[i] == ids[i] * 2 - 9007199254740993);
+    assert(out[i] == (double) exact[i]);
+  }
+  ids[ROWS - 1] = INT64_MAX;
+  assert(math_expr_eval_batch(&parser, &expr, columns, 1, ROWS, out, &options) == MERR_OK && !all_exact);
+  assert(exact[0] == 9007199254740993 && out[ROWS - 1] == 0x1p64 - 0x1p53);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
+void testKernels() {
+  enum { N = 37 }; // leaves tails for every width
+  double left[N], right[N], expected[N], actual[N];
+  for (size_t i = 0; i < N; ++i)
+  {
+    left[i] = (i % 5 == 0 ? -1.0 : 1.0) * (i + 0.1) / 3;
+    right[i] = i % 7 == 0 ? 0.0 : i * 1.7 - 20;
+  }
+  const MathKernels *scalar = math_kernels_get(MATH_KERNELS_SCALAR);
+  assert(scalar != NULL && math_kernels_best() != NULL);
+  for (int level = 0; level < MATH_KERNELS_COUNT; ++level)
+  {
+    const MathKernels *kernels = math_kernels_get(level);
+    if (kernels == NULL) continue; // not supported by this CPU
+    for (size_t n = 0; n <= N; ++n)
+    {
+      MathKernelBinary binary[] = { kernels->add, kernels->sub, kernels->mul, kernels->div };
+      MathKernelBinary reference[] = { scalar->add, scalar->sub, scalar->mul, scalar->div };
+      for (size_t op = 0; op < 4; ++op)
+      {
+        memcpy(expected, left, sizeof(left));
+        memcpy(actual, left, sizeof(left));
+        reference[op](expected, right, n);
+        binary[op](actual, right, n);
+        assert(memcmp(expected, actual, sizeof(actual)) == 0);
+      }
+      memcpy(expected, left, sizeof(left));
+      memcpy(actual, left, sizeof(left));
+      scalar->neg(expected, n);
+      kernels->neg(actual, n);
+      assert(memcmp(expected, actual, sizeof(actual)) == 0);
+    }
+  }
+}
+
 void testSyntax() {
   assertEquals(2., eval("+2"), 0.001); // unary +
   evalErr("   ( 2 + 3  ", MERR_UNBALANCED_PARENTHESIS); // )
@@ -134,6 +896,91 @@ void testSyntax() {
   // assertEquals(null, eval("$"));
 }
 
+enum { DIAGNOSTICS_TASK_EVALS = 1000 };
+
+typedef struct {
+  MathParser *parser;
+  const MathExpr *expr;
+} DiagnosticsTask;
+
+static void diagnosticsTask(void *ctx, size_t worker)
+{
+  DiagnosticsTask *task = ctx;
+  double result;
+  for (int i = 0; i < DIAGNOSTICS_TASK_EVALS; ++i) assert(math_expr_eval(task->parser, task->expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+}
+
+void testDiagnostics() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  double result;
+  char buf[128];
+  parser.diagnostics_mode = MATH_DIAGNOSTICS_COLLECT;
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("1 + * 2")), &result) == MERR_UNEXPECTED_OPERATOR);
+  assert(arrlenu(parser.diagnostics) == 2);
+  assert(parser.diagnostics[0].code == DIAG_UNEXPECTED_OPERATOR && parser.diagnostics[0].loc.col == 4);
+  assert(parser.diagnostics[1].code == DIAG_NOTE_PRECEDED_BY_OPERATOR && parser.diagnostics[1].loc.col == 2);
+  assert(diag_message(&parser.diagnostics[0], buf, sizeof(buf)) > 0);
+  assert(strcmp(buf, "Unexpected operator *, expected expression") == 0);
+  math_parser_clear(&parser);
+  math_parser_clear_diagnostics(&parser);
+  // lexer errors are reported once, even though the lexer looks ahead
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("f(x $")), &result) == MERR_LEXER_ERROR);
+  assert(arrlenu(parser.diagnostics) == 1 && parser.diagnostics[0].code == DIAG_UNRECOGNIZED_TOKEN);
+  math_parser_clear(&parser);
+  math_parser_clear_diagnostics(&parser);
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("sin(1, 2)")), &result) == MERR_UNRECOGNIZED_SYMBOL);
+  assert(arrlenu(parser.diagnostics) == 2 && parser.diagnostics[1].code == DIAG_NOTE_FUNCTION_ARITY && parser.diagnostics[1].value.count == 1);
+  math_parser_clear(&parser);
+  math_parser_clear_diagnostics(&parser);
+  // evaluations on several threads collect whole groups
+  MathExpr expr;
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("sin(1, 2)")), &expr) == MERR_OK);
+  MathThreadPool *pool = math_thread_pool_create(4);
+  assert(pool != NULL);
+  DiagnosticsTask task = { .parser = &parser, .expr = &expr };
+  math_thread_pool_run(pool, diagnosticsTask, &task);
+  assert(arrlenu(parser.diagnostics) == 2 * 4 * DIAGNOSTICS_TASK_EVALS);
+  for (size_t i = 0; i < arrlenu(parser.diagnostics); i += 2)
+  {
+    assert(parser.diagnostics[i].code == DIAG_UNRECOGNIZED_FUNCTION && parser.diagnostics[i + 1].code == DIAG_NOTE_FUNCTION_ARITY);
+  }
+  math_thread_pool_free(pool);
+  math_expr_free(&expr);
+  math_parser_clear_diagnostics(&parser);
+  parser.diagnostics_mode = MATH_DIAGNOSTICS_IGNORE;
+  assert(math_parser_evaluate_input(&parser, lexer_init("test", sv_from_cstr("(1")), &result) == MERR_UNBALANCED_PARENTHESIS);
+  assert(arrlenu(parser.diagnostics) == 0);
+  math_parser_free(&parser);
+}
+
+void testCompiledExpr() {
+  MathParser parser = math_parser_init(EMPTY_LEXER);
+  MathExpr expr;
+  double result;
+  char *input = strdup("x * 2 + 1; 2 x");
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(input)), &expr) == MERR_OK);
+  free(input); // expression owns its source
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_UNRECOGNIZED_SYMBOL);
+  assert(math_parser_set_var(&parser, SV("x"), 3));
+  for (int i = 0; i < 3; ++i)
+  {
+    assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+    assertEquals(6.0, result, 0.001);
+  }
+  math_expr_free(&expr);
+
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("sq(a) = a*a; sq(x) + 1")), &expr) == MERR_OK);
+  assert(math_expr_eval(&parser, &expr, &result) == MERR_OK);
+  assertEquals(10.0, result, 0.001);
+  math_expr_free(&expr);
+
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr(" ; ")), &expr) == MERR_INPUT_EMPTY);
+  math_expr_free(&expr);
+  assert(math_parser_compile(&parser, lexer_init("test", sv_from_cstr("1 + ")), &expr) == MERR_UNEXPECTED_OPERATOR);
+  math_expr_free(&expr);
+  math_parser_free(&parser);
+}
+
 int main(int argc, char **argv)
 {
   fclose(stderr);
@@ -143,10 +990,29 @@ int main(int argc, char **argv)
   testBrackets();
   testWhitespace();
   testMultiStatements();
+  testTokenBuffer();
+  testLexer();
   testDefVars();
+  testBuiltinLookup();
+  testSymbolTables();
+  testSlots();
+  testDirectCalls();
+  testCallFrames();
+  testInlining();
+  testSharing();
+  testConstantFolding();
+  testStrengthReduction();
+  testPolynomials();
+  testJit();
+  testBatch();
+  testBatchThreads();
+  testIntegers();
+  testKernels();
   // testUserVars();
   // testDefFunc();
   testSyntax();
+  testCompiledExpr();
+  testDiagnostics();
   printf("All tests passed\n");
   return 0;
 }
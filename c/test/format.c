@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/format.h"
+
+// Checks that math_format_double round-trips and is as short as possible,
+// over random bit patterns (covering every binade, subnormals and specials) and some fixed values.
+
+#define SAMPLES 4000000
+#define SHORTEST_SAMPLES 200000
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t xorshift(void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static double from_bits(uint64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Writes the significant digits of a formatted value to `out`, without leading and trailing zeros
+static int significant_digits(const char *s, char *out)
+{
+  int count = 0;
+  for (; *s && *s != 'e'; ++s)
+  {
+    if (*s < '0' || *s > '9' || (count == 0 && *s == '0')) continue;
+    out[count++] = *s;
+  }
+  while (count > 0 && out[count - 1] == '0') --count;
+  out[count] = '\0';
+  return count;
+}
+
+static void check(double value, int shortest)
+{
+  char buf[MATH_FORMAT_BUFFER_SIZE];
+  size_t len = math_format_double(value, buf);
+  assert(len == strlen(buf));
+  double back = strtod(buf, NULL);
+  if (isnan(value))
+  {
+    assert(isnan(back));
+    return;
+  }
+  if (memcmp(&back, &value, sizeof(value)) != 0)
+  {
+    fprintf(stderr, "%a formatted as %s reads back as %a\n", value, buf, back);
+    exit(1);
+  }
+  if (!shortest || value == 0 || isinf(value)) return;
+  // no shorter precision of printf round-trips, and at the same precision we pick the closest digits like printf
+  char digits[32], expected[32], printed[64];
+  int count = significant_digits(buf, digits);
+  if (count > 1)
+  {
+    snprintf(printed, sizeof(printed), "%.*e", count - 2, value);
+    if (strtod(printed, NULL) == value)
+    {
+      fprintf(stderr, "%a formatted as %s, but %s is shorter\n", value, buf, printed);
+      exit(1);
+    }
+  }
+  snprintf(printed, sizeof(printed), "%.*e", count - 1, value);
+  significant_digits(printed, expected);
+  // the closest digits may fall outside the interval below powers of two, where it is only half as wide
+  if (strtod(printed, NULL) == value && strcmp(digits, expected) != 0)
+  {
+    fprintf(stderr, "%a formatted as %s, but %s is closer\n", value, buf, printed);
+    exit(1);
+  }
+}
+
+static void expect(double value, const char *expected)
+{
+  char buf[MATH_FORMAT_BUFFER_SIZE];
+  math_format_double(value, buf);
+  if (strcmp(buf, expected) != 0)
+  {
+    fprintf(stderr, "%a formatted as %s, expected %s\n", value, buf, expected);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  expect(0.0, "0");
+  expect(-0.0, "-0");
+  expect(1.0, "1");
+  expect(0.1, "0.1");
+  expect(0.1 + 0.2, "0.30000000000000004");
+  expect(123456.0, "123456");
+  expect(-2.5, "-2.5");
+  expect(1e21, "1e+21");
+  expect(1e20, "100000000000000000000");
+  expect(1e-7, "1e-7");
+  expect(1.5e-7, "1.5e-7");
+  expect(1.5e-6, "0.0000015");
+  expect(5e-324, "5e-324");
+  expect(1.7976931348623157e308, "1.7976931348623157e+308");
+  expect(9007199254740993.0, "9007199254740992");
+  expect(INFINITY, "inf");
+  expect(-INFINITY, "-inf");
+  expect(NAN, "nan");
+  for (uint64_t i = 0; i < SAMPLES; ++i)
+  {
+    check(from_bits(xorshift()), i < SHORTEST_SAMPLES);
+  }
+  // powers of two and their neighbours, where the lower bound is closer
+  for (int e = -1074; e <= 1023; ++e)
+  {
+    double p = ldexp(1.0, e);
+    check(p, 1);
+    check(nextafter(p, 0), 1);
+    check(nextafter(p, INFINITY), 1);
+  }
+  // integers and short decimals
+  for (int i = 1; i < 100000; ++i)
+  {
+    check(i, 1);
+    check(i / 1000.0, 1);
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <assert.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/format.h"
+#include "../src/number.h"
+
+// Checks that math_number_parse_double agrees with strtod bit for bit, over literals printed from random doubles
+// at every precision, random digit strings of any length and exponent, exact halfway points and their neighbours.
+// Literals are followed by more digits in memory, which must not be read.
+
+#define SAMPLES 1000000
+#define DIGIT_SAMPLES 1000000
+#define HALFWAY_SAMPLES 20000
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t xorshift(void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static double from_bits(uint64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static void check(const char *literal)
+{
+  char buf[2048];
+  size_t n = strlen(literal);
+  assert(n + 4 <= sizeof(buf));
+  memcpy(buf, literal, n);
+  memcpy(buf + n, "5e5", 4);
+  double value, expected = strtod(literal, NULL);
+  MathNumberError err = math_number_parse_double(buf, n, &value);
+  MathNumberError expected_err = MATH_NUMBER_OK;
+  if (isinf(expected)) expected_err = MATH_NUMBER_OVERFLOW;
+  if (expected == 0 && strcspn(literal, "123456789") < strcspn(literal, "eE")) expected_err = MATH_NUMBER_UNDERFLOW;
+  if (err != expected_err || memcmp(&value, &expected, sizeof(value)) != 0)
+  {
+    fprintf(stderr, "%s parsed as %a (error %d), strtod gives %a\n", literal, value, err, expected);
+    exit(1);
+  }
+}
+
+static void expect_int(const char *literal, MathNumberError expected_err, int64_t expected)
+{
+  int64_t value = 0;
+  MathNumberError err = math_number_parse_int64(literal, strlen(literal), &value);
+  if (err != expected_err || (err == MATH_NUMBER_OK && value != expected))
+  {
+    fprintf(stderr, "%s parsed as %" PRId64 " (error %d), expected %" PRId64 " (error %d)\n", literal, value, err, expected, expected_err);
+    exit(1);
+  }
+}
+
+static void expect_invalid(const char *literal)
+{
+  double value;
+  int64_t integer;
+  if (math_number_parse_double(literal, strlen(literal), &value) != MATH_NUMBER_INVALID ||
+      math_number_parse_int64(literal, strlen(literal), &integer) != MATH_NUMBER_INVALID)
+  {
+    fprintf(stderr, "%s should be invalid\n", literal);
+    exit(1);
+  }
+}
+
+// A random literal of 1 to 40 digits with a point anywhere (or none) and an exponent in [-350, 320]
+static void random_digits(char *buf)
+{
+  size_t count = 1 + xorshift() % 40, point = xorshift() % (count + 2), len = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (i == point) buf[len++] = '.';
+    buf[len++] = '0' + xorshift() % 10;
+  }
+  if (xorshift() % 4 != 0) len += sprintf(buf + len, "e%d", (int) (xorshift() % 671) - 350);
+  buf[len] = '\0';
+}
+
+int main(int argc, char **argv)
+{
+  const char *fixed[] = {
+    "0", "00", "0.0", "0e0", "1", "1.", ".5", "1.5", "0.1", "1e-3", "1E+3", "6.02E+23", "123456789012345678",
+    "9007199254740992", "9007199254740993", "9007199254740993.000000000000000000000000000001",
+    "1.7976931348623157e308", "1.7976931348623158e308", "1.797693134862315807e308", "1.8e308", "1e309",
+    "2.2250738585072014e-308", "2.2250738585072011e-308", "4.9406564584124654e-324", "4.9e-324",
+    "2.4703282292062327e-324", "2.4703282292062328e-324", "1e-324", "1e-400", "1e100000", "1e-100000",
+    "0.000000000000000000000000000000000000000000000000000000000000000000000000000000000001e80",
+    "0x0", "0x1F", "0XaBc", "0x1fffffffffffff", "0x20000000000001", "0x20000000000003", "0xffffffffffffffff",
+    "0x10000000000000800000000000000001", "0x8000000000000400",
+  };
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); ++i) check(fixed[i]);
+  // long literals, the digits past what the exact conversion keeps still decide the rounding
+  static char buf[2048];
+  for (const char *prefix = "9007199254740993"; prefix != NULL; prefix = prefix[0] == '9' ? "1" : NULL)
+  {
+    size_t len = sprintf(buf, "%s.", prefix);
+    memset(buf + len, '0', 1000);
+    strcpy(buf + len + 1000, "1");
+    check(buf);
+    strcpy(buf + len + 1000, "e-5");
+    check(buf);
+  }
+  char hex[300] = "0x";
+  memset(hex + 2, 'f', 280);
+  hex[282] = '\0';
+  check(hex);
+  hex[258] = '\0';
+  check(hex);
+
+  for (uint64_t i = 0; i < SAMPLES; ++i)
+  {
+    double value = fabs(from_bits(xorshift()));
+    if (isnan(value) || isinf(value)) continue;
+    sprintf(buf, "%.17g", value);
+    check(buf);
+    sprintf(buf, "%.*e", (int) (xorshift() % 17), value);
+    check(buf);
+    math_format_double(value, buf);
+    check(buf);
+  }
+  for (uint64_t i = 0; i < DIGIT_SAMPLES; ++i)
+  {
+    random_digits(buf);
+    check(buf);
+  }
+#if LDBL_MANT_DIG >= 64
+  // halfway between two doubles, and just above and below it
+  for (uint64_t i = 0; i < HALFWAY_SAMPLES; ++i)
+  {
+    double value = fabs(from_bits(xorshift()));
+    if (isnan(value) || isinf(value) || value == DBL_MAX) continue;
+    long double halfway = ((long double) value + nextafter(value, INFINITY)) / 2;
+    int len = sprintf(buf, "%.780Le", halfway);
+    char *e = strchr(buf, 'e');
+    check(buf);
+    // the digits are exact, with trailing zeros: make the last one 1 for above, and decrement for below
+    e[-1] = '1';
+    check(buf);
+    e[-1] = '0';
+    char *d = e - 1;
+    for (; *d == '0' || *d == '.'; --d) if (*d == '0') *d = '9';
+    *d -= 1;
+    check(buf);
+    assert(len > 0);
+  }
+#endif
+
+  expect_int("0", MATH_NUMBER_OK, 0);
+  expect_int("42", MATH_NUMBER_OK, 42);
+  expect_int("0x2A", MATH_NUMBER_OK, 42);
+  expect_int("9223372036854775807", MATH_NUMBER_OK, INT64_MAX);
+  expect_int("9223372036854775808", MATH_NUMBER_OVERFLOW, 0);
+  expect_int("99999999999999999999", MATH_NUMBER_OVERFLOW, 0);
+  expect_int("0x7fffffffffffffff", MATH_NUMBER_OK, INT64_MAX);
+  expect_int("0x8000000000000000", MATH_NUMBER_OVERFLOW, 0);
+  expect_int("1.5", MATH_NUMBER_INVALID, 0);
+  expect_int("1e3", MATH_NUMBER_INVALID, 0);
+  for (uint64_t i = 0; i < SAMPLES; ++i)
+  {
+    int64_t value = (int64_t) (xorshift() >> (1 + xorshift() % 63));
+    sprintf(buf, "%" PRId64, value);
+    expect_int(buf, MATH_NUMBER_OK, value);
+    sprintf(buf, "0x%" PRIx64, value);
+    expect_int(buf, MATH_NUMBER_OK, value);
+  }
+
+  const char *invalid[] = { "", ".", "e5", ".e5", "1e", "1e+", "1e-", "0x", "0xg", "1.2.3", "1a", "1e5.0", "+1", "-1", " 1", "1 " };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) expect_invalid(invalid[i]);
+  printf("All tests passed\n");
+  return 0;
+}
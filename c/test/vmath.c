@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "../src/vmath.h"
+
+// Sweeps the vectorized functions over their whole domain and checks their error against libm
+// stays within the bounds documented in src/vmath.h.
+
+#define SAMPLES_PER_BINADE 256
+#define DENSE_SAMPLES 200000
+#define BATCH 1000 // odd sizes exercise the tails
+
+static uint64_t state = 0x9E3779B97F4A7C15u;
+
+static uint64_t next(void)
+{
+  // xorshift64*
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1Du;
+}
+
+// Maps doubles to integers that are consecutive for consecutive doubles
+static int64_t ordered(double x)
+{
+  int64_t i;
+  memcpy(&i, &x, sizeof(i));
+  return i < 0 ? INT64_MIN - i : i;
+}
+
+static uint64_t ulps(double expected, double actual)
+{
+  if (isnan(expected) || isnan(actual)) return isnan(expected) && isnan(actual) ? 0 : UINT64_MAX;
+  int64_t a = ordered(expected), b = ordered(actual);
+  return a > b ? (uint64_t) a - b : (uint64_t) b - a;
+}
+
+typedef struct {
+  const char *name;
+  void (*vector)(double *a, size_t n);
+  double (*exact)(double);
+  uint64_t bound;
+  double dense_min, dense_max; // where most inputs are expected
+} Function;
+
+static uint64_t worst;
+static double worst_input;
+
+static void check(const Function *fn, double *inputs, size_t n)
+{
+  double values[BATCH];
+  memcpy(values, inputs, n * sizeof(double));
+  fn->vector(values, n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    uint64_t error = ulps(fn->exact(inputs[i]), values[i]);
+    if (error > worst)
+    {
+      worst = error;
+      worst_input = inputs[i];
+    }
+  }
+}
+
+static double sample(int binade)
+{
+  // random mantissa in binade [2^binade, 2^(binade + 1)), down to the subnormals
+  double mantissa = 1.0 + (next() >> 11) * 0x1p-53;
+  return binade < -1022 ? ldexp((next() >> 12) * 0x1p-52, -1022) : ldexp(mantissa, binade);
+}
+
+static void testFunction(const Function *fn)
+{
+  double inputs[BATCH];
+  size_t n = 0;
+  worst = 0;
+  worst_input = 0;
+#define PUSH(x) do {                                  \
+  inputs[n++] = (x);                                  \
+  if (n == BATCH - 3) { check(fn, inputs, n); n = 0; } \
+} while (0)
+  for (int binade = -1023; binade <= 1023; ++binade)
+  {
+    for (size_t i = 0; i < SAMPLES_PER_BINADE; ++i)
+    {
+      double x = sample(binade);
+      PUSH(x);
+      PUSH(-x);
+    }
+  }
+  for (size_t i = 0; i < DENSE_SAMPLES; ++i)
+  {
+    PUSH(fn->dense_min + (next() >> 11) * 0x1p-53 * (fn->dense_max - fn->dense_min));
+  }
+  const double specials[] = { 0.0, -0.0, 1.0, -1.0, 0.5, -0.5, M_PI, M_PI_2, M_PI_4, 0x1p20, -0x1p20, 0x1.0000000000001p20, DBL_MIN, DBL_TRUE_MIN, DBL_MAX, INFINITY, -INFINITY, NAN };
+  for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); ++i)
+  {
+    PUSH(specials[i]);
+  }
+#undef PUSH
+  check(fn, inputs, n);
+  printf("%-6s max error %llu ulp (at %a), bound %llu\n", fn->name, (unsigned long long) worst, worst_input, (unsigned long long) fn->bound);
+  assert(worst <= fn->bound);
+}
+
+static void testLogBase(void)
+{
+  enum { N = 1001 };
+  double left[N], right[N];
+  worst = 0;
+  for (size_t round = 0; round < 200; ++round)
+  {
+    for (size_t i = 0; i < N; ++i)
+    {
+      left[i] = sample((int) (next() % 2046) - 1022);
+      right[i] = i % 3 == 0 ? 1 + (next() >> 11) * 0x1p-53 * 9 : sample((int) (next() % 2046) - 1022);
+    }
+    double base[N];
+    memcpy(base, left, sizeof(left));
+    math_vlogb(left, right, N);
+    for (size_t i = 0; i < N; ++i)
+    {
+      uint64_t error = ulps(log(right[i]) / log(base[i]), left[i]);
+      if (error > worst) worst = error;
+    }
+  }
+  printf("%-6s max error %llu ulp, bound 3\n", "logb", (unsigned long long) worst);
+  assert(worst <= 3);
+}
+
+int main(int argc, char **argv)
+{
+  const Function functions[] = {
+    { "sqrt", math_vsqrt, sqrt, 0, 0, 100 },
+    { "sin", math_vsin, sin, 1, -10, 10 },
+    { "cos", math_vcos, cos, 1, -10, 10 },
+    { "tan", math_vtan, tan, 2, -10, 10 },
+    { "asin", math_vasin, asin, 1, -1, 1 },
+    { "acos", math_vacos, acos, 1, -1, 1 },
+    { "atan", math_vatan, atan, 1, -10, 10 },
+    { "log", math_vlog, log, 1, 0.5, 2 },
+    { "log2", math_vlog2, log2, 2, 0.5, 2 },
+    { "log10", math_vlog10, log10, 2, 0.5, 2 },
+  };
+  for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i)
+  {
+    testFunction(&functions[i]);
+  }
+  testLogBase();
+  printf("All tests passed\n");
+  return 0;
+}